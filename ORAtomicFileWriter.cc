@@ -0,0 +1,42 @@
+#include "ORAtomicFileWriter.hh"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sstream>
+
+#include "ORLogger.hh"
+
+using namespace std;
+
+string ORAtomicFileWriter::PartialFileName(const string& label, unsigned run)
+{
+  return FinalFileName(PartialLabel(label), run);
+}
+
+string ORAtomicFileWriter::FinalFileName(const string& label, unsigned run)
+{
+  ostringstream name;
+  name << label << "_run" << run << ".root";
+  return name.str();
+}
+
+ORDataProcessor::EReturnCode ORAtomicFileWriter::EndRun()
+{
+  EReturnCode code = ORFileWriter::EndRun();
+  unsigned run = fRunContext->GetRunNumber();
+  string partial = PartialFileName(fFinalLabel, run);
+  if (code == kFailure) {
+    ORLog(kError) << "Run " << run << " not finished; output left in " << partial << endl;
+    return code;
+  }
+  string finalName = FinalFileName(fFinalLabel, run);
+  if (rename(partial.c_str(), finalName.c_str()) != 0) {
+    ORLog(kError) << "Couldn't rename " << partial << " to " << finalName << ": "
+                  << strerror(errno) << endl;
+    return kFailure;
+  }
+  fLastFileName = finalName;
+  return code;
+}
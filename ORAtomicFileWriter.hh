@@ -0,0 +1,38 @@
+#ifndef _ORAtomicFileWriter_hh_
+#define _ORAtomicFileWriter_hh_
+
+#include <string>
+
+#include "ORFileWriter.hh"
+
+/*
+ORFileWriter that never leaves a half-written <label>_run<N>.root behind.
+The run is written to <label>.part_run<N>.root and only renamed to its
+real name once ORFileWriter::EndRun has closed it successfully, so anything
+picking up NaI_ET_run*.root (auto_process.py, Calibration) sees either a
+complete file or nothing.  An interrupted conversion leaves the .part file,
+which getSpectrum --resume continues from (see ORCheckpoint.hh).
+*/
+
+class ORAtomicFileWriter : public ORFileWriter
+{
+  public:
+    ORAtomicFileWriter(const std::string& label = "OR") :
+      ORFileWriter(PartialLabel(label)), fFinalLabel(label) {}
+    virtual ~ORAtomicFileWriter() {}
+
+    virtual EReturnCode EndRun();
+    // Final name of the last run written, "" before the first one is done.
+    const std::string& GetLastFileName() const { return fLastFileName; }
+
+    static std::string PartialLabel(const std::string& label) { return label + ".part"; }
+    // The names ORFileWriter gives run N's file, while and after it is written.
+    static std::string PartialFileName(const std::string& label, unsigned run);
+    static std::string FinalFileName(const std::string& label, unsigned run);
+
+  protected:
+    std::string fFinalLabel;
+    std::string fLastFileName;
+};
+
+#endif
@@ -0,0 +1,328 @@
+#include "ORBlockArchive.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/stat.h>
+
+#include <deque>
+#include <future>
+#include <memory>
+
+#include "ORLogger.hh"
+#include "ORRecordIndex.hh"
+
+using namespace std;
+
+// A block on its way through the pool: raw bytes in, compressed bytes out
+// (or the other way round when extracting).
+struct ORArchiveBlock {
+  ORBlockArchiveEntry entry;
+  vector<char> data;
+  bool ok;
+  future<void> done;
+};
+
+static int64_t MTimeOf(const struct stat& st)
+{
+  return (int64_t) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static bool WriteAll(int fd, const void* data, size_t nBytes)
+{
+  const char* p = (const char*) data;
+  while (nBytes > 0) {
+    ssize_t n = write(fd, p, nBytes);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    nBytes -= n;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, void* data, size_t nBytes, uint64_t offset)
+{
+  char* p = (char*) data;
+  while (nBytes > 0) {
+    ssize_t n = pread(fd, p, nBytes, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    nBytes -= n;
+    offset += n;
+  }
+  return true;
+}
+
+static void CompressBlock(ORArchiveBlock& block, int rawFd, int level)
+{
+  vector<char> raw(block.entry.rawBytes);
+  block.ok = ReadAll(rawFd, &(raw[0]), raw.size(), block.entry.rawOffset);
+  if (!block.ok) return;
+  block.entry.crc = crc32(0, (const Bytef*) &(raw[0]), raw.size());
+  uLongf size = compressBound(raw.size());
+  block.data.resize(size);
+  block.ok = compress2((Bytef*) &(block.data[0]), &size, (const Bytef*) &(raw[0]), raw.size(),
+                       level) == Z_OK;
+  block.data.resize(size);
+}
+
+// Records every part of a run needs: all but the hits (and the garbage
+// records of a damaged file).
+static bool IsRunControl(const ORRecordIndexEntry& record)
+{
+  return (record.flags & (kORIndexSIS3302 | kORIndexUnknownId)) == 0;
+}
+
+// Record-aligned blocks over the complete records, then plain pieces over
+// whatever is left.
+static vector<ORBlockArchiveEntry> CutBlocks(const string& rawFile, uint64_t rawSize,
+                                             size_t blockSize, uint64_t& nRecords)
+{
+  vector<ORBlockArchiveEntry> blocks;
+  ORBlockArchiveEntry block;
+  memset(&block, 0, sizeof(block));
+  ORRecordIndex index;
+  uint64_t framed = 0;
+  nRecords = 0;
+  if (index.Build(rawFile) && !index.GetEntries().empty()) {
+    const vector<ORRecordIndexEntry>& records = index.GetEntries();
+    framed = index.GetHeader().endOffset;
+    nRecords = records.size();
+    size_t iFirst = 0;
+    for (size_t i = 1; i <= records.size(); i++) {
+      uint64_t start = records[iFirst].offset;
+      uint64_t end = (i < records.size()) ? records[i].offset : framed;
+      uint64_t next = (i + 1 < records.size()) ? records[i + 1].offset : framed;
+      bool control = IsRunControl(records[iFirst]);
+      // The header record goes alone; a record bigger than blockSize too.
+      // Hits and run-control records go in separate blocks.
+      if (i == records.size() || iFirst == 0 || IsRunControl(records[i]) != control ||
+          next - start > blockSize) {
+        block.rawOffset = start;
+        block.rawBytes = end - start;
+        block.firstRecord = iFirst;
+        block.nRecords = i - iFirst;
+        block.flags = control ? kORBlockRunControl : 0;
+        blocks.push_back(block);
+        iFirst = i;
+      }
+    }
+  }
+  for (uint64_t start = framed; start < rawSize; start += blockSize) {
+    block.rawOffset = start;
+    block.rawBytes = (rawSize - start < blockSize) ? rawSize - start : blockSize;
+    block.firstRecord = nRecords;
+    block.nRecords = 0;
+    block.flags = 0;
+    blocks.push_back(block);
+  }
+  return blocks;
+}
+
+ORBlockArchive::ORBlockArchive() : fFd(-1)
+{
+  memset(&fHeader, 0, sizeof(fHeader));
+}
+
+ORBlockArchive::~ORBlockArchive()
+{
+  Close();
+}
+
+bool ORBlockArchive::IsArchive(const string& fileName)
+{
+  static const string kSuffix = ".orz";
+  return fileName.size() >= kSuffix.size() &&
+         fileName.compare(fileName.size() - kSuffix.size(), kSuffix.size(), kSuffix) == 0;
+}
+
+bool ORBlockArchive::Write(const string& rawFile, const string& path, ORWorkerPool& pool,
+                           int level, size_t blockSize)
+{
+  struct stat before;
+  int rawFd = open(rawFile.c_str(), O_RDONLY);
+  if (rawFd < 0 || fstat(rawFd, &before) != 0) {
+    ORLog(kError) << "Couldn't open " << rawFile << ": " << strerror(errno) << endl;
+    if (rawFd >= 0) close(rawFd);
+    return false;
+  }
+  ORBlockArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = 1;
+  header.level = level;
+  header.blockSize = blockSize;
+  header.rawSize = before.st_size;
+  header.rawMTime = MTimeOf(before);
+  vector<ORBlockArchiveEntry> blocks = CutBlocks(rawFile, header.rawSize, blockSize, header.nRecords);
+  header.nBlocks = blocks.size();
+  if (header.nRecords == 0) {
+    ORLog(kWarning) << "Couldn't walk the records of " << rawFile
+                    << "; archiving it without record numbers" << endl;
+  }
+
+  string tmpPath = path + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    ORLog(kError) << "Couldn't create " << tmpPath << ": " << strerror(errno) << endl;
+    close(rawFd);
+    return false;
+  }
+  // No magic yet: this only marks the space.
+  bool ok = WriteAll(fd, &header, sizeof(header));
+  uint64_t offset = sizeof(header);
+  vector<ORBlockArchiveEntry> entries;
+  entries.reserve(blocks.size());
+  deque<shared_ptr<ORArchiveBlock> > inFlight;
+  size_t maxInFlight = 2 * pool.GetNWorkers() + 1;
+  size_t iNext = 0;
+  while (ok && (iNext < blocks.size() || !inFlight.empty())) {
+    if (iNext < blocks.size() && inFlight.size() < maxInFlight) {
+      shared_ptr<ORArchiveBlock> block(new ORArchiveBlock);
+      block->entry = blocks[iNext++];
+      block->ok = false;
+      block->done = pool.Submit([block, rawFd, level](size_t) { CompressBlock(*block, rawFd, level); });
+      inFlight.push_back(block);
+      continue;
+    }
+    shared_ptr<ORArchiveBlock> block = inFlight.front();
+    inFlight.pop_front();
+    block->done.wait();
+    if (!block->ok) {
+      ORLog(kError) << "Couldn't compress " << rawFile << " at byte " << block->entry.rawOffset << endl;
+      ok = false;
+      break;
+    }
+    block->entry.offset = offset;
+    block->entry.size = block->data.size();
+    ok = WriteAll(fd, &(block->data[0]), block->data.size());
+    offset += block->data.size();
+    entries.push_back(block->entry);
+  }
+  // The pool still holds rawFd in whatever is left.
+  for (size_t i = 0; i < inFlight.size(); i++) inFlight[i]->done.wait();
+
+  header.indexOffset = offset;
+  if (ok && !entries.empty()) ok = WriteAll(fd, &(entries[0]), entries.size() * sizeof(ORBlockArchiveEntry));
+  memcpy(header.magic, kORBlockArchiveMagic, sizeof(header.magic));
+  if (ok) ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header);
+  ok = (close(fd) == 0) && ok;
+
+  // ORCA may still have been writing it.
+  struct stat after;
+  if (ok && (fstat(rawFd, &after) != 0 || after.st_size != before.st_size ||
+             MTimeOf(after) != MTimeOf(before))) {
+    ORLog(kError) << rawFile << " changed while it was being archived" << endl;
+    ok = false;
+  }
+  close(rawFd);
+  if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(tmpPath.c_str());
+  return ok;
+}
+
+bool ORBlockArchive::Open(const string& path)
+{
+  Close();
+  fFd = open(path.c_str(), O_RDONLY);
+  if (fFd < 0) return false;
+  struct stat st;
+  bool ok = fstat(fFd, &st) == 0 && ReadAll(fFd, &fHeader, sizeof(fHeader), 0) &&
+            memcmp(fHeader.magic, kORBlockArchiveMagic, sizeof(fHeader.magic)) == 0 &&
+            fHeader.version == 1 &&
+            fHeader.indexOffset + fHeader.nBlocks * sizeof(ORBlockArchiveEntry) <= (uint64_t) st.st_size;
+  if (ok) {
+    fEntries.resize(fHeader.nBlocks);
+    ok = fHeader.nBlocks == 0 ||
+         ReadAll(fFd, &(fEntries[0]), fEntries.size() * sizeof(ORBlockArchiveEntry), fHeader.indexOffset);
+  }
+  if (!ok) {
+    Close();
+    return false;
+  }
+  fPath = path;
+  return true;
+}
+
+void ORBlockArchive::Close()
+{
+  if (fFd >= 0) close(fFd);
+  fFd = -1;
+  fPath = "";
+  memset(&fHeader, 0, sizeof(fHeader));
+  fEntries.clear();
+}
+
+bool ORBlockArchive::ReadBlock(size_t i, vector<char>& raw) const
+{
+  if (i >= fEntries.size()) return false;
+  const ORBlockArchiveEntry& entry = fEntries[i];
+  vector<char> compressed(entry.size);
+  if (!ReadAll(fFd, &(compressed[0]), compressed.size(), entry.offset)) return false;
+  raw.resize(entry.rawBytes);
+  uLongf size = raw.size();
+  return uncompress((Bytef*) &(raw[0]), &size, (const Bytef*) &(compressed[0]),
+                    compressed.size()) == Z_OK && size == entry.rawBytes &&
+         crc32(0, (const Bytef*) &(raw[0]), raw.size()) == entry.crc;
+}
+
+bool ORBlockArchive::Extract(const string& rawFile, ORWorkerPool& pool) const
+{
+  string tmpPath = rawFile + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    ORLog(kError) << "Couldn't create " << tmpPath << ": " << strerror(errno) << endl;
+    return false;
+  }
+  bool ok = true;
+  deque<shared_ptr<ORArchiveBlock> > inFlight;
+  size_t maxInFlight = 2 * pool.GetNWorkers() + 1;
+  size_t iNext = 0;
+  while (ok && (iNext < fEntries.size() || !inFlight.empty())) {
+    if (iNext < fEntries.size() && inFlight.size() < maxInFlight) {
+      shared_ptr<ORArchiveBlock> block(new ORArchiveBlock);
+      size_t i = iNext++;
+      block->entry = fEntries[i];
+      block->ok = false;
+      block->done = pool.Submit([this, block, i](size_t) { block->ok = ReadBlock(i, block->data); });
+      inFlight.push_back(block);
+      continue;
+    }
+    shared_ptr<ORArchiveBlock> block = inFlight.front();
+    inFlight.pop_front();
+    block->done.wait();
+    if (!block->ok) {
+      ORLog(kError) << fPath << ": block at raw byte " << block->entry.rawOffset << " is damaged" << endl;
+      ok = false;
+      break;
+    }
+    ok = WriteAll(fd, &(block->data[0]), block->data.size());
+  }
+  for (size_t i = 0; i < inFlight.size(); i++) inFlight[i]->done.wait();
+
+  struct timespec times[2];
+  times[0].tv_sec = times[1].tv_sec = fHeader.rawMTime / 1000000000LL;
+  times[0].tv_nsec = times[1].tv_nsec = fHeader.rawMTime % 1000000000LL;
+  if (ok) ok = futimens(fd, times) == 0;
+  ok = (close(fd) == 0) && ok;
+  if (ok) ok = rename(tmpPath.c_str(), rawFile.c_str()) == 0;
+  if (!ok) unlink(tmpPath.c_str());
+  return ok;
+}
+
+vector<size_t> ORBlockArchive::BlocksForRecords(uint64_t first, uint64_t last) const
+{
+  vector<size_t> blocks;
+  for (size_t i = 0; i < fEntries.size(); i++) {
+    // Without record numbers there's nothing to choose by.
+    bool wanted = (i == 0) || fHeader.nRecords == 0 || (fEntries[i].flags & kORBlockRunControl) ||
+                  (fEntries[i].nRecords > 0 && fEntries[i].firstRecord >= first &&
+                   fEntries[i].firstRecord <= last);
+    if (wanted) blocks.push_back(i);
+  }
+  return blocks;
+}
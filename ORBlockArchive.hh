@@ -0,0 +1,115 @@
+#ifndef _ORBlockArchive_hh_
+#define _ORBlockArchive_hh_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "ORWorkerPool.hh"
+
+/*
+Seekable archive of a raw ORCA file (<raw>.orz): the file is cut into
+blocks of about blockSize bytes, each block is compressed on its own
+(zlib), and an index of the blocks goes at the end, so any block can be
+read and inflated without touching the others:
+
+  ORBlockArchiveHeader                64 bytes
+  compressed blocks                   back to back
+  ORBlockArchiveEntry[nBlocks]        48 bytes each, at indexOffset
+
+Blocks are cut on record boundaries (found with ORRecordIndex) and block 0
+holds only the header record, so block 0 followed by any run of blocks is
+itself a valid stream for ORVReader.  Each entry has the number of its
+first record and how many records start in it.  Records other than
+SIS3302 hits (run start and end, heartbeats, other cards) never share a
+block with hits, and their blocks are flagged kORBlockRunControl, so a
+part of a run can be read with the run records around it.
+
+A file whose records can't be walked (byte-swapped, damaged) is still
+archived, in plain blockSize pieces with no record numbers, and whatever
+follows the last complete record goes into a final block of its own.  Blocks cover the raw
+file exactly, so Extract gives it back byte for byte, with its mtime.
+
+Write compresses the blocks on a worker pool and writes them in order,
+with a bounded number in flight; the header goes in last, after the
+index, so a half-written archive has no magic and is never mistaken for a
+good one.  Everything is in host byte order.
+*/
+
+static const char kORBlockArchiveMagic[8] = { 'O', 'R', 'B', 'L', 'K', '1', '\0', '\0' };
+
+struct ORBlockArchiveHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t level;         // zlib compression level
+  uint64_t blockSize;
+  uint64_t nBlocks;
+  uint64_t nRecords;      // 0 if the records couldn't be walked
+  uint64_t rawSize;
+  int64_t rawMTime;       // ns
+  uint64_t indexOffset;
+};
+
+enum EORBlockArchiveFlags {
+  kORBlockRunControl = 1  // the header record, or records that aren't hits
+};
+
+struct ORBlockArchiveEntry {
+  uint64_t offset;        // of the compressed block in the archive
+  uint64_t rawOffset;
+  uint64_t firstRecord;
+  uint32_t size;          // compressed
+  uint32_t rawBytes;
+  uint32_t nRecords;      // records starting in this block
+  uint32_t crc;           // crc32 of the raw bytes
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+
+class ORBlockArchive
+{
+  public:
+    ORBlockArchive();
+    virtual ~ORBlockArchive();
+
+    static std::string ArchivePath(const std::string& rawFile) { return rawFile + ".orz"; }
+    static bool IsArchive(const std::string& fileName);
+
+    // Compresses rawFile into path on the pool's workers.  False (and no
+    // file at path) if anything fails.
+    static bool Write(const std::string& rawFile, const std::string& path, ORWorkerPool& pool,
+                      int level = 6, size_t blockSize = 4 << 20);
+
+    // Reads header and index; false if path isn't a complete archive.
+    virtual bool Open(const std::string& path);
+    virtual void Close();
+
+    // Inflates block i into raw and checks it against its crc.  Safe to
+    // call from several threads at once.
+    virtual bool ReadBlock(size_t i, std::vector<char>& raw) const;
+    // Inflates every block on the pool and writes the raw file back out.
+    virtual bool Extract(const std::string& rawFile, ORWorkerPool& pool) const;
+
+    // The run-control blocks and the blocks whose first record is in
+    // [first, last].  Ranges that meet (0-999, 1000-1999, ...) share only
+    // the run-control blocks and miss none.
+    virtual std::vector<size_t> BlocksForRecords(uint64_t first, uint64_t last) const;
+
+    const ORBlockArchiveHeader& GetHeader() const { return fHeader; }
+    const std::vector<ORBlockArchiveEntry>& GetEntries() const { return fEntries; }
+    const std::string& GetPath() const { return fPath; }
+
+  protected:
+    std::string fPath;
+    int fFd;
+    ORBlockArchiveHeader fHeader;
+    std::vector<ORBlockArchiveEntry> fEntries;
+
+  private:
+    ORBlockArchive(const ORBlockArchive&);
+    ORBlockArchive& operator=(const ORBlockArchive&);
+};
+
+#endif
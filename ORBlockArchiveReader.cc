@@ -0,0 +1,129 @@
+#include "ORBlockArchiveReader.hh"
+
+#include <deque>
+#include <future>
+#include <memory>
+
+#include "ORBlockArchive.hh"
+#include "ORLogger.hh"
+
+using namespace std;
+
+ORBlockArchiveReader::ORBlockArchiveReader(size_t nThreads) :
+  ORQueueReader(kMaxChunks), fPool(nThreads)
+{
+  fFirstRecord = 0;
+  fLastRecord = UINT64_MAX;
+  fStarted = false;
+  fCompressedBytes = 0;
+}
+
+ORBlockArchiveReader::~ORBlockArchiveReader()
+{
+  Stop();
+}
+
+bool ORBlockArchiveReader::OKToRead()
+{
+  if (!fStarted) {
+    fStarted = true;
+    fThread = thread(&ORBlockArchiveReader::Feed, this);
+  }
+  return ORQueueReader::OKToRead();
+}
+
+size_t ORBlockArchiveReader::Read(char* buffer, size_t nBytes)
+{
+  if (!fStarted) OKToRead();
+  return ORQueueReader::Read(buffer, nBytes);
+}
+
+void ORBlockArchiveReader::CloseDataStream()
+{
+  Stop();
+}
+
+void ORBlockArchiveReader::Stop()
+{
+  ORQueueReader::CloseDataStream();
+  if (fThread.joinable()) fThread.join();
+}
+
+void ORBlockArchiveReader::Feed()
+{
+  for (size_t i = 0; i < fFileList.size() && !fQueue.IsCancelled(); i++) {
+    FeedFile(fFileList[i]);
+  }
+  fQueue.Close();
+}
+
+bool ORBlockArchiveReader::FeedFile(const string& fileName)
+{
+  ORBlockArchive archive;
+  if (!archive.Open(fileName)) {
+    ORLog(kWarning) << "Couldn't open " << fileName << " as a block archive" << endl;
+    return false;
+  }
+  const ORBlockArchiveHeader& header = archive.GetHeader();
+  bool ranged = (fFirstRecord > 0 || fLastRecord != UINT64_MAX);
+  vector<size_t> blocks;
+  if (ranged) blocks = archive.BlocksForRecords(fFirstRecord, fLastRecord);
+  else {
+    // Everything, including any unframed tail.
+    blocks.resize(header.nBlocks);
+    for (size_t i = 0; i < blocks.size(); i++) blocks[i] = i;
+  }
+  ORLog(kRoutine) << "Streaming " << fileName << ": " << blocks.size() << " of " << header.nBlocks
+                  << " blocks on " << fPool.GetNWorkers() << " thread(s)" << endl;
+  if (ranged && header.nRecords == 0) {
+    ORLog(kWarning) << fileName << " has no record numbers; reading all of it" << endl;
+  } else if (ranged) {
+    const vector<ORBlockArchiveEntry>& entries = archive.GetEntries();
+    size_t nControl = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      if (entries[blocks[i]].flags & kORBlockRunControl) nControl++;
+    }
+    ORLog(kRoutine) << "  " << blocks.size() - nControl << " blocks of records " << fFirstRecord
+                    << " - " << fLastRecord << ", " << nControl << " of run records" << endl;
+  }
+
+  // Inflated blocks waiting to go out in order.
+  struct Pending {
+    vector<char> data;
+    bool ok;
+    future<void> done;
+  };
+  deque<shared_ptr<Pending> > inFlight;
+  size_t maxInFlight = 2 * fPool.GetNWorkers();
+  size_t iNext = 0;
+  bool ok = true;
+  while (ok && (iNext < blocks.size() || !inFlight.empty())) {
+    if (iNext < blocks.size() && inFlight.size() < maxInFlight) {
+      shared_ptr<Pending> pending(new Pending);
+      size_t iBlock = blocks[iNext++];
+      pending->ok = false;
+      ORBlockArchive* source = &archive;
+      pending->done = fPool.Submit([source, pending, iBlock](size_t) {
+        pending->ok = source->ReadBlock(iBlock, pending->data);
+      });
+      inFlight.push_back(pending);
+      continue;
+    }
+    shared_ptr<Pending> pending = inFlight.front();
+    inFlight.pop_front();
+    pending->done.wait();
+    if (!pending->ok) {
+      ORLog(kError) << fileName << " has a damaged block; stopping there" << endl;
+      ok = false;
+      break;
+    }
+    ok = fQueue.Push(pending->data);
+  }
+  // The pool's tasks still point at archive.
+  for (size_t i = 0; i < inFlight.size(); i++) inFlight[i]->done.wait();
+  if (ok) {
+    const vector<ORBlockArchiveEntry>& entries = archive.GetEntries();
+    for (size_t i = 0; i < blocks.size(); i++) fCompressedBytes += entries[blocks[i]].size;
+  }
+  return ok;
+}
@@ -0,0 +1,65 @@
+#ifndef _ORBlockArchiveReader_hh_
+#define _ORBlockArchiveReader_hh_
+
+#include <stdint.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ORQueueReader.hh"
+#include "ORWorkerPool.hh"
+
+/*
+Reader for raw ORCA files archived by rawArchive (<raw>.orz, see
+ORBlockArchive.hh).  A feeder thread has the blocks inflated on a pool of
+nThreads workers, several at a time, and hands them to Read() in file
+order through the ORQueueReader's bounded queue, so decompression runs in
+parallel and overlaps with decoding.
+
+SetRecordRange reads only the run-control blocks (the header, run start
+and end, ...) and the hit blocks whose first record is in [first, last]
+(ORBlockArchive::BlocksForRecords), seeking straight to them, so each
+part is converted as a complete run of its own.  The range is rounded to
+whole blocks, and ranges that meet split the hits without overlap.  A damaged block (bad crc or
+compressed data) ends that file with an error rather than handing on
+garbage.
+*/
+
+class ORBlockArchiveReader : public ORQueueReader
+{
+  public:
+    ORBlockArchiveReader(size_t nThreads = 2);
+    virtual ~ORBlockArchiveReader();
+
+    virtual void AddFileToProcess(const std::string& fileName)
+      { fFileList.push_back(fileName); }
+    virtual void SetRecordRange(uint64_t first, uint64_t last)
+      { fFirstRecord = first; fLastRecord = last; }
+    virtual bool OKToRead();
+    virtual void CloseDataStream();
+
+    // Compressed bytes of the blocks streamed so far.
+    uint64_t GetCompressedBytes() const { return fCompressedBytes; }
+
+  protected:
+    virtual size_t Read(char* buffer, size_t nBytes);
+
+    // Feeder thread.
+    virtual void Feed();
+    virtual bool FeedFile(const std::string& fileName);
+
+    virtual void Stop();
+
+    static const size_t kMaxChunks = 4;
+
+    std::vector<std::string> fFileList;
+    uint64_t fFirstRecord;
+    uint64_t fLastRecord;
+    ORWorkerPool fPool;
+    std::thread fThread;
+    bool fStarted;
+    uint64_t fCompressedBytes;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef _ORCheckpoint_hh_
+#define _ORCheckpoint_hh_
+
+/*
+Progress record for one conversion, kept next to the output while it is
+being written (NaI_ET_<raw file>.ckpt).  ORSIS3302TreeWriter rewrites it
+every few seconds, each time right after the tree has been saved to disk,
+so everything it describes is safely in the partial output file:
+
+  run 1234
+  partial NaI_ET.part_run1234.root
+  options columnar=0 histograms=1 ...
+  rawOffset 1073741824       bytes of the raw stream fully processed
+  rawRecords 512000          records (of any kind) fully processed
+  sisRecords 509876          SIS3302 records handled, rejected ones included
+  entries 509876             tree entries saved in the partial file
+  rejected 5 1234            one line per channel skipped by --channels
+
+getSpectrum --resume copies the first "entries" entries out of the partial
+file and lets the first "sisRecords" SIS3302 records go by, so the result
+is the same as an uninterrupted conversion.  A checkpoint is only used
+with the same output options ("options") it was written with.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+struct ORCheckpoint {
+  unsigned run;
+  std::string partialFile;
+  std::string options;
+  uint64_t rawOffset;
+  uint64_t rawRecords;
+  uint64_t sisRecords;
+  int64_t entries;
+  std::map<unsigned short, int64_t> rejected;
+
+  ORCheckpoint() : run(0), rawOffset(0), rawRecords(0), sisRecords(0), entries(0) {}
+
+  /* Writes to path + ".tmp" and renames, so a crash never leaves half a
+     checkpoint behind. */
+  bool Write(const std::string& path) const
+  {
+    std::string tmpPath = path + ".tmp";
+    {
+      std::ofstream out(tmpPath.c_str());
+      out << "run " << run << "\n"
+          << "partial " << partialFile << "\n"
+          << "options " << options << "\n"
+          << "rawOffset " << rawOffset << "\n"
+          << "rawRecords " << rawRecords << "\n"
+          << "sisRecords " << sisRecords << "\n"
+          << "entries " << entries << "\n";
+      for (std::map<unsigned short, int64_t>::const_iterator it = rejected.begin();
+           it != rejected.end(); it++) {
+        out << "rejected " << it->first << " " << it->second << "\n";
+      }
+      out.flush();
+      if (!out) {
+        unlink(tmpPath.c_str());
+        return false;
+      }
+    }
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+      unlink(tmpPath.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /* False if the file is missing or doesn't name a partial file. */
+  bool Read(const std::string& path)
+  {
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    *this = ORCheckpoint();
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string key;
+      fields >> key;
+      if (key == "run") fields >> run;
+      else if (key == "partial") fields >> partialFile;
+      else if (key == "options") std::getline(fields >> std::ws, options);
+      else if (key == "rawOffset") fields >> rawOffset;
+      else if (key == "rawRecords") fields >> rawRecords;
+      else if (key == "sisRecords") fields >> sisRecords;
+      else if (key == "entries") fields >> entries;
+      else if (key == "rejected") {
+        unsigned short channel;
+        int64_t count;
+        if (fields >> channel >> count) rejected[channel] = count;
+      }
+    }
+    return partialFile != "";
+  }
+};
+
+#endif
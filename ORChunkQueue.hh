@@ -0,0 +1,115 @@
+#ifndef _ORChunkQueue_hh_
+#define _ORChunkQueue_hh_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/*
+Bounded FIFO of byte chunks between one producer (a decompressor thread, a
+socket event loop) and one consumer (an ORQueueReader).  Chunks are swapped
+in and out, never copied.  The producer calls Close() when it has no more
+data; the consumer calls Cancel() when it stops listening, which drops
+whatever is queued and makes any further Push fail.
+*/
+
+class ORChunkQueue
+{
+  public:
+    ORChunkQueue(size_t maxChunks) : fMaxChunks(maxChunks ? maxChunks : 1),
+                                     fClosed(false), fCancelled(false) {}
+
+    // Blocks while the queue is full.  Takes the contents of chunk.
+    // Returns false if the consumer has cancelled.
+    bool Push(std::vector<char>& chunk)
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      while (fChunks.size() >= fMaxChunks && !fCancelled) fSpaceFree.wait(lock);
+      return Append(chunk, lock);
+    }
+
+    // Like Push but returns false instead of waiting; chunk is left alone
+    // unless it was queued.
+    bool TryPush(std::vector<char>& chunk)
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      if (fChunks.size() >= fMaxChunks) return false;
+      return Append(chunk, lock);
+    }
+
+    // Blocks until a chunk is available.  Returns false once the queue is
+    // closed and empty, or cancelled.
+    bool Pop(std::vector<char>& chunk)
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      while (fChunks.empty() && !fClosed && !fCancelled) fDataReady.wait(lock);
+      if (fChunks.empty() || fCancelled) return false;
+      chunk.swap(fChunks.front());
+      fChunks.pop_front();
+      lock.unlock();
+      fSpaceFree.notify_one();
+      return true;
+    }
+
+    // Blocks until Pop would not; returns true if it would succeed.
+    bool WaitForData()
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      while (fChunks.empty() && !fClosed && !fCancelled) fDataReady.wait(lock);
+      return !fChunks.empty() && !fCancelled;
+    }
+
+    void Close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fClosed = true;
+      }
+      fDataReady.notify_all();
+    }
+
+    void Cancel()
+    {
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fCancelled = true;
+        fChunks.clear();
+      }
+      fDataReady.notify_all();
+      fSpaceFree.notify_all();
+    }
+
+    bool IsFull()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fChunks.size() >= fMaxChunks;
+    }
+
+    bool IsCancelled()
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fCancelled;
+    }
+
+  protected:
+    bool Append(std::vector<char>& chunk, std::unique_lock<std::mutex>& lock)
+    {
+      if (fCancelled) return false;
+      fChunks.push_back(std::vector<char>());
+      fChunks.back().swap(chunk);
+      lock.unlock();
+      fDataReady.notify_one();
+      return true;
+    }
+
+    size_t fMaxChunks;
+    std::deque<std::vector<char> > fChunks;
+    std::mutex fMutex;
+    std::condition_variable fDataReady;
+    std::condition_variable fSpaceFree;
+    bool fClosed;
+    bool fCancelled;
+};
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef _ORColumnarFile_hh_
+#define _ORColumnarFile_hh_
+
+/*
+Flat columnar sidecar written next to each NaI_ET_run*.root file.  One
+contiguous, typed array per field, so a reader can mmap the file and loop
+over e.g. energy[] without going through TTree decompression.
+
+Layout (host byte order):
+  ORColumnarHeader                       64 bytes
+  ORColumnDesc[nColumns]                 64 bytes each
+  column data, each starting on a 64-byte boundary
+
+Only plain C/POSIX here: getSpectrum writes these files and the Calibration
+code reads them, and neither side needs the other's libraries for it.
+*/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+static const char kORColumnarMagic[8] = { 'O', 'R', 'C', 'O', 'L', 'S', '1', '\0' };
+static const size_t kORColumnarAlign = 64;
+
+enum EORColumnType {
+  kORColFloat64 = 0,
+  kORColUInt16 = 1,
+  kORColUInt32 = 2,
+  kORColUInt8 = 3,
+  kORColInt64 = 4,
+  kORColFloat32 = 5
+};
+
+struct ORColumnarHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nColumns;
+  uint64_t nEntries;
+  double startTime;
+  uint32_t runNumber;
+  uint8_t reserved[28];
+};
+
+struct ORColumnDesc {
+  char name[32];
+  uint32_t type;
+  uint32_t elementSize;
+  uint64_t offset;
+  uint64_t nBytes;
+  uint8_t reserved[8];
+};
+
+inline size_t ORColumnTypeSize(uint32_t type)
+{
+  switch (type) {
+    case kORColFloat64: return 8;
+    case kORColInt64: return 8;
+    case kORColUInt32: return 4;
+    case kORColFloat32: return 4;
+    case kORColUInt16: return 2;
+    case kORColUInt8: return 1;
+  }
+  return 0;
+}
+
+inline uint64_t ORColumnarPad(uint64_t offset)
+{
+  return (offset + kORColumnarAlign - 1) / kORColumnarAlign * kORColumnarAlign;
+}
+
+/* Column data handed to ORWriteColumnarFile.  data must hold nEntries elements. */
+struct ORColumnSource {
+  std::string name;
+  uint32_t type;
+  const void* data;
+};
+
+/* Writes to path + ".tmp" and renames, so readers never see a partial file.
+   Returns false (and removes the temporary) on any error. */
+inline bool ORWriteColumnarFile(const std::string& path, uint64_t nEntries,
+                                double startTime, uint32_t runNumber,
+                                const std::vector<ORColumnSource>& columns)
+{
+  ORColumnarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kORColumnarMagic, sizeof(header.magic));
+  header.version = 1;
+  header.nColumns = columns.size();
+  header.nEntries = nEntries;
+  header.startTime = startTime;
+  header.runNumber = runNumber;
+
+  std::vector<ORColumnDesc> descs(columns.size());
+  uint64_t offset = ORColumnarPad(sizeof(header) + columns.size() * sizeof(ORColumnDesc));
+  for (size_t i = 0; i < columns.size(); i++) {
+    memset(&descs[i], 0, sizeof(ORColumnDesc));
+    strncpy(descs[i].name, columns[i].name.c_str(), sizeof(descs[i].name) - 1);
+    descs[i].type = columns[i].type;
+    descs[i].elementSize = ORColumnTypeSize(columns[i].type);
+    descs[i].offset = offset;
+    descs[i].nBytes = nEntries * descs[i].elementSize;
+    offset = ORColumnarPad(offset + descs[i].nBytes);
+  }
+
+  std::string tmpPath = path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == NULL) return false;
+  static const char zeros[kORColumnarAlign] = { 0 };
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && !descs.empty()) {
+    ok = fwrite(&descs[0], sizeof(ORColumnDesc), descs.size(), file) == descs.size();
+  }
+  uint64_t pos = sizeof(header) + descs.size() * sizeof(ORColumnDesc);
+  for (size_t i = 0; ok && i < columns.size(); i++) {
+    ok = fwrite(zeros, 1, descs[i].offset - pos, file) == descs[i].offset - pos;
+    if (ok && descs[i].nBytes > 0) {
+      ok = fwrite(columns[i].data, 1, descs[i].nBytes, file) == descs[i].nBytes;
+    }
+    pos = descs[i].offset + descs[i].nBytes;
+  }
+  if (fclose(file) != 0) ok = false;
+  if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(tmpPath.c_str());
+  return ok;
+}
+
+/* Read-only mmap view of a sidecar file. */
+class ORColumnarFile
+{
+  public:
+    ORColumnarFile(const std::string& path) : fMap(NULL), fLength(0), fHeader(NULL), fDescs(NULL)
+    {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) return;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(ORColumnarHeader)) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+          fMap = (const char*) map;
+          fLength = st.st_size;
+        }
+      }
+      close(fd);
+      if (fMap == NULL) return;
+
+      const ORColumnarHeader* header = (const ORColumnarHeader*) fMap;
+      if (memcmp(header->magic, kORColumnarMagic, sizeof(header->magic)) != 0 ||
+          sizeof(ORColumnarHeader) + header->nColumns * sizeof(ORColumnDesc) > fLength) {
+        Unmap();
+        return;
+      }
+      const ORColumnDesc* descs = (const ORColumnDesc*) (fMap + sizeof(ORColumnarHeader));
+      for (uint32_t i = 0; i < header->nColumns; i++) {
+        if (descs[i].offset + descs[i].nBytes > fLength) {
+          Unmap();
+          return;
+        }
+      }
+      fHeader = header;
+      fDescs = descs;
+    }
+
+    ~ORColumnarFile() { Unmap(); }
+
+    bool IsValid() const { return fHeader != NULL; }
+    uint64_t GetNEntries() const { return fHeader ? fHeader->nEntries : 0; }
+    double GetStartTime() const { return fHeader ? fHeader->startTime : 0; }
+    uint32_t GetRunNumber() const { return fHeader ? fHeader->runNumber : 0; }
+
+    /* Returns NULL if the column is missing or stored with another type. */
+    const void* GetColumn(const std::string& name, uint32_t type) const
+    {
+      if (fHeader == NULL) return NULL;
+      for (uint32_t i = 0; i < fHeader->nColumns; i++) {
+        if (name == fDescs[i].name) {
+          if (fDescs[i].type != type) return NULL;
+          return fMap + fDescs[i].offset;
+        }
+      }
+      return NULL;
+    }
+
+  private:
+    ORColumnarFile(const ORColumnarFile&);
+    ORColumnarFile& operator=(const ORColumnarFile&);
+
+    void Unmap()
+    {
+      if (fMap != NULL) munmap((void*) fMap, fLength);
+      fMap = NULL;
+      fLength = 0;
+      fHeader = NULL;
+      fDescs = NULL;
+    }
+
+    const char* fMap;
+    size_t fLength;
+    const ORColumnarHeader* fHeader;
+    const ORColumnDesc* fDescs;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef _OREventBuilder_hh_
+#define _OREventBuilder_hh_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/*
+Groups hits from several channels into time-ordered events.  Hits arrive
+in readout order, which interleaves the channels in blocks; within one
+channel they are in time order.  Each channel gets its own queue and the
+queues are merged (k-way, through a heap of queue heads) into one
+time-ordered stream, so every hit costs O(log channels).
+
+A hit can only be merged once every channel seen so far has a later hit
+waiting, since a quiet channel might still deliver an earlier one.
+Channels that haven't shown up yet can't hold anything back, so nothing
+is merged at all until a quarter of maxBuffered hits are waiting.  A
+channel that goes silent would hold everything back, so past
+maxBuffered waiting hits the oldest are merged regardless; a hit that
+then turns up earlier than one already merged is counted as late and
+starts an event of its own.  Flush merges everything at the end of the
+run.
+
+The merged stream is cut into events: an event opens with a hit and
+takes every following hit up to window after it (the window doesn't
+extend with later hits).  Completed events are laid out one after
+another in GetReadyHits, event i ending at GetReadyEnds()[i].
+*/
+
+struct ORHit {
+  double time;
+  double energy;
+  double amplitude;
+  uint16_t channel;
+};
+
+class OREventBuilder
+{
+  public:
+    OREventBuilder(double window = 0, size_t maxBuffered = 1 << 20) :
+      fWindow(window), fMaxBuffered(maxBuffered) { Reset(); }
+
+    void SetWindow(double window) { fWindow = window; }
+    void SetMaxBuffered(size_t maxBuffered) { fMaxBuffered = maxBuffered; }
+
+    // Forget all hits and events, e.g. at the start of a run.
+    void Reset()
+    {
+      fQueues.clear();
+      fQueueIndex.clear();
+      fHeads = Heap();
+      fNEmpty = 0;
+      fNBuffered = 0;
+      fOpen.clear();
+      fReadyHits.clear();
+      fReadyEnds.clear();
+      fLastTime = 0;
+      fNMerged = 0;
+      fNLate = 0;
+      fNHits = 0;
+      fNEvents = 0;
+    }
+
+    void AddHit(const ORHit& hit)
+    {
+      fNHits++;
+      std::map<uint16_t, size_t>::iterator it = fQueueIndex.find(hit.channel);
+      if (it == fQueueIndex.end()) {
+        it = fQueueIndex.insert(std::make_pair(hit.channel, fQueues.size())).first;
+        fQueues.push_back(std::deque<ORHit>());
+        fNEmpty++;
+      }
+      std::deque<ORHit>& queue = fQueues[it->second];
+      if (queue.empty()) {
+        fHeads.push(std::make_pair(hit.time, it->second));
+        fNEmpty--;
+      }
+      queue.push_back(hit);
+      fNBuffered++;
+      Merge(false);
+    }
+
+    // Merge every waiting hit and close the open event.
+    void Flush()
+    {
+      Merge(true);
+      CloseEvent();
+    }
+
+    const std::vector<ORHit>& GetReadyHits() const { return fReadyHits; }
+    const std::vector<size_t>& GetReadyEnds() const { return fReadyEnds; }
+    void ClearReady() { fReadyHits.clear(); fReadyEnds.clear(); }
+
+    uint64_t GetNHits() const { return fNHits; }
+    uint64_t GetNEvents() const { return fNEvents; }
+    uint64_t GetNLate() const { return fNLate; }
+
+  protected:
+    // Min-heap of (time of a queue's first hit, queue index).
+    typedef std::priority_queue<std::pair<double, size_t>, std::vector<std::pair<double, size_t> >,
+                                std::greater<std::pair<double, size_t> > > Heap;
+
+    void Merge(bool all)
+    {
+      if (!all && fNMerged == 0 && fNBuffered < fMaxBuffered / 4) return;
+      while (!fHeads.empty() && (all || fNEmpty == 0 || fNBuffered > fMaxBuffered)) {
+        size_t iQueue = fHeads.top().second;
+        fHeads.pop();
+        std::deque<ORHit>& queue = fQueues[iQueue];
+        Place(queue.front());
+        queue.pop_front();
+        fNBuffered--;
+        if (queue.empty()) fNEmpty++;
+        else fHeads.push(std::make_pair(queue.front().time, iQueue));
+      }
+    }
+
+    void Place(const ORHit& hit)
+    {
+      bool late = fNMerged > 0 && hit.time < fLastTime;
+      if (late) fNLate++;
+      if (late || (!fOpen.empty() && hit.time - fOpen[0].time > fWindow)) CloseEvent();
+      fOpen.push_back(hit);
+      if (!late) fLastTime = hit.time;
+      fNMerged++;
+    }
+
+    void CloseEvent()
+    {
+      if (fOpen.empty()) return;
+      fReadyHits.insert(fReadyHits.end(), fOpen.begin(), fOpen.end());
+      fReadyEnds.push_back(fReadyHits.size());
+      fOpen.clear();
+      fNEvents++;
+    }
+
+    double fWindow;
+    size_t fMaxBuffered;
+    std::vector<std::deque<ORHit> > fQueues;
+    std::map<uint16_t, size_t> fQueueIndex;
+    Heap fHeads;
+    size_t fNEmpty;
+    size_t fNBuffered;
+    std::vector<ORHit> fOpen;
+    std::vector<ORHit> fReadyHits;
+    std::vector<size_t> fReadyEnds;
+    double fLastTime;
+    uint64_t fNMerged;
+    uint64_t fNLate;
+    uint64_t fNHits;
+    uint64_t fNEvents;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "ORFollowFileReader.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ORLogger.hh"
+#include "ORStageMetrics.hh"
+
+using namespace std;
+
+ORFollowFileReader::ORFollowFileReader(const string& fileName, double idleTimeout) :
+  fFileName(fileName), fIdleTimeout(idleTimeout), fFD(-1), fBuffer(kBufferSize),
+  fBegin(0), fEnd(0), fBytesRead(0), fFinished(false)
+{
+}
+
+ORFollowFileReader::~ORFollowFileReader()
+{
+  if (fFD >= 0) close(fFD);
+}
+
+bool ORFollowFileReader::OKToRead()
+{
+  return Open();
+}
+
+bool ORFollowFileReader::OpenDataStream()
+{
+  return Open();
+}
+
+void ORFollowFileReader::CloseDataStream()
+{
+  if (fFD >= 0) close(fFD);
+  fFD = -1;
+  fBegin = fEnd = 0;
+  fFinished = true;
+}
+
+static void SleepPoll()
+{
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = ORFollowFileReader::kPollMilliseconds * 1000000L;
+  nanosleep(&ts, NULL);
+}
+
+bool ORFollowFileReader::Open()
+{
+  if (fFD >= 0) return true;
+  if (fFinished) return false;
+  uint64_t waitStart = ORStageMetrics::Now();
+  bool logged = false;
+  while ((fFD = open(fFileName.c_str(), O_RDONLY)) < 0) {
+    if (errno != ENOENT) {
+      ORLog(kError) << "Couldn't open " << fFileName << ": " << strerror(errno) << endl;
+      return false;
+    }
+    if (1e-9 * (ORStageMetrics::Now() - waitStart) > fIdleTimeout) {
+      ORLog(kError) << fFileName << " didn't appear within " << fIdleTimeout << " s" << endl;
+      return false;
+    }
+    if (!logged) ORLog(kRoutine) << "Waiting for " << fFileName << " to appear..." << endl;
+    logged = true;
+    SleepPoll();
+  }
+  ORLog(kRoutine) << "Following " << fFileName << endl;
+  return true;
+}
+
+bool ORFollowFileReader::Refill()
+{
+  if (!Open()) return false;
+  fBegin = fEnd = 0;
+  uint64_t idleStart = ORStageMetrics::Now();
+  while (true) {
+    // Checked before reading, so whatever was written before the run
+    // ended is still picked up.
+    bool finished = fFinished;
+    ssize_t n = read(fFD, &(fBuffer[0]), fBuffer.size());
+    if (n > 0) {
+      fEnd = n;
+      return true;
+    }
+    if (n < 0 && errno != EINTR) {
+      ORLog(kError) << "Error reading " << fFileName << ": " << strerror(errno) << endl;
+      return false;
+    }
+    if (finished) return false;
+    if (1e-9 * (ORStageMetrics::Now() - idleStart) > fIdleTimeout) {
+      ORLog(kWarning) << fFileName << " hasn't grown for " << fIdleTimeout
+                      << " s and no run-end record was seen; stopping" << endl;
+      return false;
+    }
+    SleepPoll();
+  }
+}
+
+size_t ORFollowFileReader::Read(char* buffer, size_t nBytes)
+{
+  size_t nRead = 0;
+  while (nRead < nBytes) {
+    if (fBegin == fEnd) {
+      if (!Refill()) break;
+      continue;
+    }
+    size_t n = fEnd - fBegin;
+    if (n > nBytes - nRead) n = nBytes - nRead;
+    memcpy(buffer + nRead, &(fBuffer[fBegin]), n);
+    fBegin += n;
+    nRead += n;
+  }
+  fBytesRead += nRead;
+  return nRead;
+}
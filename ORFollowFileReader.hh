@@ -0,0 +1,74 @@
+#ifndef _ORFollowFileReader_hh_
+#define _ORFollowFileReader_hh_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "ORVDataProcessor.hh"
+#include "ORVReader.hh"
+
+/*
+Reader for a raw file that ORCA is still writing.  Read() hands out what
+is on disk and, at the current end of the file, waits for more instead of
+reporting the end of the stream, so ORVReader::ReadRecord only ever sees
+complete records and the conversion keeps pace with data taking.
+
+The stream ends once Finish() has been called (ORFollowRunEnd does that
+when the manager ends the run, i.e. on the run-end record) and everything
+written up to then has been read, or when the file hasn't grown for the
+idle timeout, in case ORCA died without closing the run.  The file itself
+may also appear only after the reader is started.
+*/
+
+class ORFollowFileReader : public ORVReader
+{
+  public:
+    ORFollowFileReader(const std::string& fileName, double idleTimeout = 60);
+    virtual ~ORFollowFileReader();
+
+    virtual bool OKToRead();
+    virtual bool OpenDataStream();
+    virtual void CloseDataStream();
+
+    // Safe to call from any thread.
+    virtual void Finish() { fFinished = true; }
+    virtual size_t GetBytesRead() const { return fBytesRead; }
+
+    static const size_t kBufferSize = 1 << 20;
+    static const unsigned kPollMilliseconds = 100;
+
+  protected:
+    virtual size_t Read(char* buffer, size_t nBytes);
+    // Waits for the file to be there and opens it.
+    virtual bool Open();
+    // Replaces the (used up) buffer with whatever is available, waiting for
+    // more if nothing is.  False at the end of the stream.
+    virtual bool Refill();
+
+    std::string fFileName;
+    double fIdleTimeout;
+    int fFD;
+    std::vector<char> fBuffer;
+    size_t fBegin;
+    size_t fEnd;
+    size_t fBytesRead;
+    std::atomic<bool> fFinished;
+};
+
+/*
+Add after the other processors when following a file: tells the reader
+the run is over once the manager has ended it.
+*/
+
+class ORFollowRunEnd : public ORVDataProcessor
+{
+  public:
+    ORFollowRunEnd(ORFollowFileReader* reader) : fReader(reader) {}
+    virtual EReturnCode EndRun() { fReader->Finish(); return kSuccess; }
+
+  protected:
+    ORFollowFileReader* fReader;
+};
+
+#endif
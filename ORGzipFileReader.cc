@@ -0,0 +1,225 @@
+#include "ORGzipFileReader.hh"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ORLogger.hh"
+
+using namespace std;
+
+ORGzipFileReader::ORGzipFileReader(const string& fileName) : ORQueueReader(kMaxChunks)
+{
+  fStarted = false;
+  fTarHeaderFill = 0;
+  fTarRemaining = 0;
+  fTarPadding = 0;
+  fTarEntryWanted = false;
+  fTarEnded = false;
+  if (fileName != "") AddFileToProcess(fileName);
+}
+
+ORGzipFileReader::~ORGzipFileReader()
+{
+  Stop();
+}
+
+bool ORGzipFileReader::EndsWith(const string& name, const string& suffix)
+{
+  return name.size() >= suffix.size() &&
+         name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool ORGzipFileReader::IsCompressed(const string& fileName)
+{
+  return EndsWith(fileName, ".gz") || EndsWith(fileName, ".tgz") || EndsWith(fileName, ".tar");
+}
+
+bool ORGzipFileReader::OKToRead()
+{
+  if (!fStarted) {
+    fStarted = true;
+    fThread = thread(&ORGzipFileReader::Inflate, this);
+  }
+  return ORQueueReader::OKToRead();
+}
+
+size_t ORGzipFileReader::Read(char* buffer, size_t nBytes)
+{
+  if (!fStarted) OKToRead();
+  return ORQueueReader::Read(buffer, nBytes);
+}
+
+void ORGzipFileReader::CloseDataStream()
+{
+  Stop();
+}
+
+void ORGzipFileReader::Stop()
+{
+  ORQueueReader::CloseDataStream();
+  if (fThread.joinable()) fThread.join();
+}
+
+void ORGzipFileReader::Inflate()
+{
+  for (size_t i = 0; i < fFileList.size() && !fQueue.IsCancelled(); i++) {
+    InflateFile(fFileList[i]);
+  }
+  if (!fFilling.empty()) fQueue.Push(fFilling);
+  fQueue.Close();
+}
+
+bool ORGzipFileReader::InflateFile(const string& fileName)
+{
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (file == NULL) {
+    ORLog(kWarning) << "Couldn't open " << fileName << ": " << strerror(errno) << endl;
+    return false;
+  }
+  bool gzipped = EndsWith(fileName, ".gz") || EndsWith(fileName, ".tgz");
+  bool untar = EndsWith(fileName, ".tar") || EndsWith(fileName, ".tar.gz") ||
+               EndsWith(fileName, ".tgz");
+  fTarHeaderFill = 0;
+  fTarRemaining = 0;
+  fTarPadding = 0;
+  fTarEntryWanted = false;
+  fTarEnded = false;
+  ORLog(kRoutine) << "Streaming " << fileName << (gzipped ? " through gunzip" : "")
+                  << (untar ? (gzipped ? " and tar" : " through tar") : "") << endl;
+
+  vector<char> in(256 * 1024);
+  vector<char> out(256 * 1024);
+  bool ok = true;
+
+  if (!gzipped) {
+    size_t n;
+    while (ok && (n = fread(&(in[0]), 1, in.size(), file)) > 0) ok = Emit(&(in[0]), n, untar);
+    fclose(file);
+    return ok;
+  }
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+    ORLog(kError) << "Couldn't initialize zlib for " << fileName << endl;
+    fclose(file);
+    return false;
+  }
+  bool finished = false;
+  size_t nMembers = 0;
+  while (ok) {
+    if (zs.avail_in == 0) {
+      size_t n = fread(&(in[0]), 1, in.size(), file);
+      if (n == 0) break;
+      zs.next_in = (Bytef*) &(in[0]);
+      zs.avail_in = n;
+    }
+    zs.next_out = (Bytef*) &(out[0]);
+    zs.avail_out = out.size();
+    int status = inflate(&zs, Z_NO_FLUSH);
+    if (status == Z_DATA_ERROR && finished) {
+      // Padding after the last gzip member, e.g. from tape blocking.
+      ORLog(kWarning) << "Ignoring trailing bytes after the gzip data in " << fileName << endl;
+      finished = true;
+      break;
+    }
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+      ORLog(kError) << "Decompression error in " << fileName << " after "
+                    << zs.total_in << " compressed bytes: "
+                    << (zs.msg ? zs.msg : "unknown") << endl;
+      ok = false;
+      break;
+    }
+    size_t nOut = out.size() - zs.avail_out;
+    if (nOut > 0) ok = Emit(&(out[0]), nOut, untar);
+    finished = (status == Z_STREAM_END);
+    // gzip allows several members back to back.
+    if (finished) {
+      nMembers++;
+      inflateReset(&zs);
+    }
+  }
+  if (ok && !finished) {
+    ORLog(kWarning) << fileName << " ends in the middle of the compressed stream" << endl;
+  }
+  inflateEnd(&zs);
+  fclose(file);
+  return ok;
+}
+
+bool ORGzipFileReader::Emit(const char* data, size_t nBytes, bool untar)
+{
+  if (!untar) return Push(data, nBytes);
+
+  while (nBytes > 0 && !fTarEnded) {
+    if (fTarRemaining > 0) {
+      size_t n = (nBytes < fTarRemaining) ? nBytes : (size_t) fTarRemaining;
+      if (fTarEntryWanted && !Push(data, n)) return false;
+      data += n;
+      nBytes -= n;
+      fTarRemaining -= n;
+      continue;
+    }
+    if (fTarPadding > 0) {
+      size_t n = (nBytes < fTarPadding) ? nBytes : (size_t) fTarPadding;
+      data += n;
+      nBytes -= n;
+      fTarPadding -= n;
+      continue;
+    }
+
+    size_t n = sizeof(fTarHeader) - fTarHeaderFill;
+    if (n > nBytes) n = nBytes;
+    memcpy(fTarHeader + fTarHeaderFill, data, n);
+    fTarHeaderFill += n;
+    data += n;
+    nBytes -= n;
+    if (fTarHeaderFill < sizeof(fTarHeader)) break;
+    fTarHeaderFill = 0;
+
+    bool empty = true;
+    for (size_t i = 0; i < sizeof(fTarHeader) && empty; i++) empty = (fTarHeader[i] == 0);
+    if (empty) {
+      fTarEnded = true;
+      break;
+    }
+
+    // Size is octal text, or big-endian binary when the top bit is set.
+    unsigned long long size = 0;
+    const unsigned char* field = (const unsigned char*) fTarHeader + 124;
+    if (field[0] & 0x80) {
+      for (size_t i = 1; i < 12; i++) size = (size << 8) | field[i];
+    } else {
+      char text[13];
+      memcpy(text, field, 12);
+      text[12] = '\0';
+      size = strtoull(text, NULL, 8);
+    }
+    char type = fTarHeader[156];
+    fTarEntryWanted = (type == '0' || type == '\0' || type == '7');
+    fTarRemaining = size;
+    fTarPadding = (512 - size % 512) % 512;
+    if (fTarEntryWanted) {
+      ORLog(kRoutine) << "  archive member " << string(fTarHeader, strnlen(fTarHeader, 100))
+                      << " (" << size << " bytes)" << endl;
+    }
+  }
+  return true;
+}
+
+bool ORGzipFileReader::Push(const char* data, size_t nBytes)
+{
+  while (nBytes > 0) {
+    size_t n = kChunkSize - fFilling.size();
+    if (n > nBytes) n = nBytes;
+    fFilling.insert(fFilling.end(), data, data + n);
+    data += n;
+    nBytes -= n;
+    if (fFilling.size() < kChunkSize) break;
+
+    if (!fQueue.Push(fFilling)) return false;
+    fFilling.reserve(kChunkSize);
+  }
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef _ORGzipFileReader_hh_
+#define _ORGzipFileReader_hh_
+
+#include <stdio.h>
+#include <zlib.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ORQueueReader.hh"
+
+/*
+File reader for raw ORCA files that have been archived, as zip_data in
+auto_process.py leaves them (RunNNNN.tar.gz).  A decompressor thread
+inflates the input and hands fixed-size chunks to Read() through the
+ORQueueReader's bounded queue, so inflating the next chunk overlaps with decoding the last
+one and nothing is ever written to disk.
+
+Inputs are handled by name: .tar.gz/.tgz are gunzipped and untarred, .gz is
+gunzipped, .tar is untarred, anything else is read as is.  From a tar archive
+the regular files are streamed one after another; directories and extended
+headers are skipped.  Record framing and byte swapping are left to
+ORVReader::ReadRecord, as with ORFileReader.
+*/
+
+class ORGzipFileReader : public ORQueueReader
+{
+  public:
+    ORGzipFileReader(const std::string& fileName = "");
+    virtual ~ORGzipFileReader();
+
+    virtual void AddFileToProcess(const std::string& fileName)
+      { fFileList.push_back(fileName); }
+    virtual bool OKToRead();
+    virtual void CloseDataStream();
+
+    static bool IsCompressed(const std::string& fileName);
+
+  protected:
+    virtual size_t Read(char* buffer, size_t nBytes);
+
+    // Decompressor thread.
+    virtual void Inflate();
+    virtual bool InflateFile(const std::string& fileName);
+    virtual bool Emit(const char* data, size_t nBytes, bool untar);
+    virtual bool Push(const char* data, size_t nBytes);
+
+    virtual void Stop();
+    static bool EndsWith(const std::string& name, const std::string& suffix);
+
+    static const size_t kChunkSize = 1 << 20;
+    static const size_t kMaxChunks = 8;
+
+    std::vector<std::string> fFileList;
+    std::thread fThread;
+    bool fStarted;
+
+    // Only touched by the decompressor thread.
+    std::vector<char> fFilling;
+    char fTarHeader[512];
+    size_t fTarHeaderFill;
+    unsigned long long fTarRemaining;
+    unsigned long long fTarPadding;
+    bool fTarEntryWanted;
+    bool fTarEnded;
+};
+
+#endif
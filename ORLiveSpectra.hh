@@ -0,0 +1,274 @@
+#ifndef _ORLiveSpectra_hh_
+#define _ORLiveSpectra_hh_
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "OREventBuilder.hh"
+
+/*
+Live per-channel energy and amplitude spectra, published in a POSIX
+shared-memory segment (shm_open name, e.g. /orcaroot_live) that viewers
+map read-only; see liveSpectra.cc.  The segment is one ORLiveSegment:
+
+  ORLiveHeader
+  ORLiveChannel[kORLiveMaxChannels]   the first header.nChannels in use
+
+Tree writers hand hits over in blocks (Add), and the spectra are filled
+in a private copy.  At most every interval seconds that copy goes out to
+the segment under a seqlock: the writer makes header.sequence odd, copies,
+and makes it even again.  A reader copies the segment out and keeps the
+copy only if sequence was even and unchanged across the copy
+(ORLiveSpectraReader::Snapshot).  Readers never block the writer, and a
+slow reader only retries.
+
+Energy bins start one unit wide and are merged in pairs (width doubled)
+whenever an energy lands past the end, as in ORSpectrumAccumulator;
+amplitude bins are a fixed kORLiveAmpBinWidth.  Counts add up from the
+start of the publishing process, across runs and streams, so rates are
+differences between snapshots.  Channels past kORLiveMaxChannels are only
+counted in header.nDropped.
+*/
+
+static const char kORLiveMagic[8] = { 'O', 'R', 'L', 'I', 'V', 'E', '1', '\0' };
+static const size_t kORLiveMaxChannels = 32;
+static const size_t kORLiveEnergyBins = 16384;
+static const size_t kORLiveAmpBins = 1024;
+static const size_t kORLiveAmpBinWidth = 65536 / kORLiveAmpBins;
+
+struct ORLiveHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nChannels;     // channel slots in use
+  uint64_t sequence;      // odd while a snapshot is being written
+  uint64_t nSnapshots;
+  int64_t startTime;      // unix time in ns when publishing started
+  int64_t publishTime;    // unix time in ns of this snapshot
+  uint64_t nHits;
+  uint64_t nDropped;
+};
+
+struct ORLiveChannel {
+  uint32_t channel;
+  uint32_t reserved;
+  double energyBinWidth;
+  uint64_t nEntries;
+  uint32_t energy[kORLiveEnergyBins + 1];   // [0] counts energies below 0
+  uint32_t amplitude[kORLiveAmpBins];
+};
+
+struct ORLiveSegment {
+  ORLiveHeader header;
+  ORLiveChannel channels[kORLiveMaxChannels];
+};
+
+inline int64_t ORLiveNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// shm_open wants one leading slash.
+inline std::string ORLiveSegmentName(const std::string& name)
+{
+  return (name != "" && name[0] == '/') ? name : "/" + name;
+}
+
+class ORLiveSpectra
+{
+  public:
+    ORLiveSpectra(const std::string& name, double interval = 0.25) :
+      fName(ORLiveSegmentName(name)), fInterval((int64_t) (interval * 1e9)),
+      fShared(NULL), fLocal(new ORLiveSegment), fNextPublish(0)
+    {
+      memset(fLocal, 0, sizeof(ORLiveSegment));
+      memcpy(fLocal->header.magic, kORLiveMagic, sizeof(kORLiveMagic));
+      fLocal->header.version = 1;
+      fLocal->header.startTime = ORLiveNow();
+
+      int fd = shm_open(fName.c_str(), O_CREAT | O_RDWR, 0644);
+      if (fd < 0) return;
+      if (ftruncate(fd, sizeof(ORLiveSegment)) == 0) {
+        void* map = mmap(NULL, sizeof(ORLiveSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) fShared = (ORLiveSegment*) map;
+      }
+      close(fd);
+      if (fShared == NULL) return;
+      // Left over from an earlier process: restart it as an empty snapshot.
+      uint64_t sequence = __atomic_load_n(&fShared->header.sequence, __ATOMIC_RELAXED);
+      fLocal->header.sequence = (sequence + 1) & ~1ULL;
+      Publish();
+    }
+
+    ~ORLiveSpectra()
+    {
+      if (fShared != NULL) {
+        munmap(fShared, sizeof(ORLiveSegment));
+        shm_unlink(fName.c_str());
+      }
+      delete fLocal;
+    }
+
+    bool IsValid() const { return fShared != NULL; }
+    const std::string& GetName() const { return fName; }
+
+    // Whether hits handed over now would be published right away.  Cheap
+    // enough to ask for every hit.
+    bool IsDue() const { return ORLiveNow() >= fNextPublish.load(std::memory_order_relaxed); }
+
+    // Add hits from any thread; publishes if the interval is up, or if
+    // publish is set.
+    void Add(const std::vector<ORHit>& hits, bool publish = false)
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      for (size_t i = 0; i < hits.size(); i++) Fill(hits[i]);
+      if (publish || ORLiveNow() >= fNextPublish.load(std::memory_order_relaxed)) Publish();
+    }
+
+  protected:
+    void Fill(const ORHit& hit)
+    {
+      ORLiveHeader& header = fLocal->header;
+      header.nHits++;
+      std::map<uint16_t, size_t>::iterator it = fSlots.find(hit.channel);
+      if (it == fSlots.end()) {
+        if (header.nChannels == kORLiveMaxChannels) {
+          header.nDropped++;
+          return;
+        }
+        it = fSlots.insert(std::make_pair(hit.channel, (size_t) header.nChannels)).first;
+        ORLiveChannel& fresh = fLocal->channels[header.nChannels++];
+        fresh.channel = hit.channel;
+        fresh.energyBinWidth = 1;
+      }
+      ORLiveChannel& channel = fLocal->channels[it->second];
+      channel.nEntries++;
+      if (hit.energy < 0) channel.energy[0]++;
+      else {
+        while (hit.energy >= kORLiveEnergyBins * channel.energyBinWidth) {
+          for (size_t i = 0; i < kORLiveEnergyBins / 2; i++) {
+            channel.energy[1 + i] = channel.energy[1 + 2 * i] + channel.energy[2 + 2 * i];
+          }
+          memset(channel.energy + 1 + kORLiveEnergyBins / 2, 0,
+                 kORLiveEnergyBins / 2 * sizeof(uint32_t));
+          channel.energyBinWidth *= 2;
+        }
+        channel.energy[1 + (size_t) (hit.energy / channel.energyBinWidth)]++;
+      }
+      size_t iAmp = (hit.amplitude <= 0) ? 0 : (size_t) hit.amplitude / kORLiveAmpBinWidth;
+      channel.amplitude[iAmp < kORLiveAmpBins ? iAmp : kORLiveAmpBins - 1]++;
+    }
+
+    void Publish()
+    {
+      if (fShared == NULL) return;
+      ORLiveHeader& header = fLocal->header;
+      header.nSnapshots++;
+      header.publishTime = ORLiveNow();
+      // Odd first, and ordered before the copy.
+      __atomic_store_n(&fShared->header.sequence, header.sequence + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      memcpy(fShared->header.magic, header.magic, sizeof(header.magic));
+      fShared->header.version = header.version;
+      fShared->header.nChannels = header.nChannels;
+      fShared->header.nSnapshots = header.nSnapshots;
+      fShared->header.startTime = header.startTime;
+      fShared->header.publishTime = header.publishTime;
+      fShared->header.nHits = header.nHits;
+      fShared->header.nDropped = header.nDropped;
+      memcpy(fShared->channels, fLocal->channels, header.nChannels * sizeof(ORLiveChannel));
+      header.sequence += 2;
+      __atomic_store_n(&fShared->header.sequence, header.sequence, __ATOMIC_RELEASE);
+      fNextPublish.store(header.publishTime + fInterval, std::memory_order_relaxed);
+    }
+
+    std::string fName;
+    int64_t fInterval;
+    ORLiveSegment* fShared;
+    ORLiveSegment* fLocal;
+    std::mutex fMutex;
+    std::map<uint16_t, size_t> fSlots;
+    std::atomic<int64_t> fNextPublish;
+
+  private:
+    ORLiveSpectra(const ORLiveSpectra&);
+    ORLiveSpectra& operator=(const ORLiveSpectra&);
+};
+
+class ORLiveSpectraReader
+{
+  public:
+    ORLiveSpectraReader() : fShared(NULL) {}
+    ~ORLiveSpectraReader() { Close(); }
+
+    // False if there is no such segment or it isn't one of ours.
+    bool Open(const std::string& name)
+    {
+      Close();
+      int fd = shm_open(ORLiveSegmentName(name).c_str(), O_RDONLY, 0);
+      if (fd < 0) return false;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(ORLiveSegment)) {
+        void* map = mmap(NULL, sizeof(ORLiveSegment), PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) fShared = (const ORLiveSegment*) map;
+      }
+      close(fd);
+      if (fShared != NULL && memcmp(fShared->header.magic, kORLiveMagic, sizeof(kORLiveMagic)) != 0) {
+        Close();
+      }
+      return fShared != NULL;
+    }
+
+    void Close()
+    {
+      if (fShared != NULL) munmap((void*) fShared, sizeof(ORLiveSegment));
+      fShared = NULL;
+    }
+
+    // Copies a consistent snapshot into out (only out.header.nChannels
+    // channels are filled).  False if the writer kept it busy for all of
+    // maxTries attempts.
+    bool Snapshot(ORLiveSegment& out, size_t maxTries = 1000) const
+    {
+      if (fShared == NULL) return false;
+      for (size_t i = 0; i < maxTries; i++) {
+        uint64_t before = __atomic_load_n(&fShared->header.sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+          sched_yield();
+          continue;
+        }
+        memcpy(&out.header, &fShared->header, sizeof(ORLiveHeader));
+        size_t nChannels = out.header.nChannels;
+        if (nChannels > kORLiveMaxChannels) nChannels = kORLiveMaxChannels;
+        memcpy(out.channels, fShared->channels, nChannels * sizeof(ORLiveChannel));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&fShared->header.sequence, __ATOMIC_RELAXED) == before) {
+          out.header.nChannels = nChannels;
+          return true;
+        }
+      }
+      return false;
+    }
+
+  protected:
+    const ORLiveSegment* fShared;
+
+  private:
+    ORLiveSpectraReader(const ORLiveSpectraReader&);
+    ORLiveSpectraReader& operator=(const ORLiveSpectraReader&);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "ORMMapFileReader.hh"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ORLogger.hh"
+
+using namespace std;
+
+ORMMapFileReader::ORMMapFileReader(const string& fileName)
+{
+  fFileIndex = 0;
+  fMap = NULL;
+  fMapLength = 0;
+  fOffset = 0;
+  fOwnedBuffer = NULL;
+  fOwnedLength = 0;
+  fBytesRead = 0;
+  if (fileName != "") AddFileToProcess(fileName);
+}
+
+ORMMapFileReader::~ORMMapFileReader()
+{
+  UnmapFile();
+}
+
+bool ORMMapFileReader::OKToRead()
+{
+  if (fMap != NULL) return true;
+  return MapNextFile();
+}
+
+bool ORMMapFileReader::OpenDataStream()
+{
+  return OKToRead();
+}
+
+void ORMMapFileReader::CloseDataStream()
+{
+  UnmapFile();
+  fFileIndex = fFileList.size();
+}
+
+bool ORMMapFileReader::MapNextFile()
+{
+  UnmapFile();
+  while (fFileIndex < fFileList.size()) {
+    const string& fileName = fFileList[fFileIndex++];
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+      ORLog(kWarning) << "Couldn't open " << fileName << ": " << strerror(errno) << endl;
+      continue;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) (2 * sizeof(UInt_t))) {
+      ORLog(kWarning) << fileName << " is empty or unreadable, skipping" << endl;
+      close(fd);
+      continue;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      ORLog(kWarning) << "Couldn't map " << fileName << ": " << strerror(errno) << endl;
+      continue;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // The first record is the XML header, data ID 0.  In a file written with
+    // the other byte order the data ID bits show up as junk.
+    UInt_t first = *((UInt_t*) map);
+    if (DataIdOf(&first) != 0) {
+      ORLog(kError) << fileName << " needs byte swapping, which the mmap reader "
+                    << "doesn't do; use the default file reader" << endl;
+      munmap(map, st.st_size);
+      continue;
+    }
+    fMap = (char*) map;
+    fMapLength = st.st_size;
+    fOffset = 0;
+    ORLog(kRoutine) << "Mapped file " << fileName << " (" << fMapLength << " bytes)" << endl;
+    return true;
+  }
+  return false;
+}
+
+void ORMMapFileReader::UnmapFile()
+{
+  if (fMap == NULL) return;
+  munmap(fMap, fMapLength);
+  fMap = NULL;
+  fMapLength = 0;
+  fOffset = 0;
+}
+
+bool ORMMapFileReader::ReadRecord(UInt_t*& buffer, size_t& nLongsMax)
+{
+  if (fOwnedBuffer == NULL) {
+    fOwnedBuffer = buffer;
+    fOwnedLength = nLongsMax;
+  }
+
+  while (fMap != NULL || MapNextFile()) {
+    if (fOffset + sizeof(UInt_t) > fMapLength) {
+      MapNextFile();
+      continue;
+    }
+    UInt_t* record = (UInt_t*) (fMap + fOffset);
+    size_t nBytes = LengthOf(record) * sizeof(UInt_t);
+    if (nBytes == 0 || fOffset + nBytes > fMapLength) {
+      ORLog(kWarning) << "Truncated or corrupt record at byte " << fOffset
+                      << " of " << fFileList[fFileIndex-1] << "; skipping rest of file" << endl;
+      MapNextFile();
+      continue;
+    }
+    fOffset += nBytes;
+    fBytesRead += nBytes;
+    buffer = record;
+    nLongsMax = nBytes / sizeof(UInt_t);
+    return true;
+  }
+
+  buffer = fOwnedBuffer;
+  nLongsMax = fOwnedLength;
+  return false;
+}
+
+size_t ORMMapFileReader::Read(char* buffer, size_t nBytes)
+{
+  // Copying fallback for callers that go through the byte-stream interface.
+  size_t nRead = 0;
+  while (nRead < nBytes && (fMap != NULL || MapNextFile())) {
+    size_t nLeft = fMapLength - fOffset;
+    if (nLeft == 0) {
+      MapNextFile();
+      continue;
+    }
+    size_t n = (nBytes - nRead < nLeft) ? nBytes - nRead : nLeft;
+    memcpy(buffer + nRead, fMap + fOffset, n);
+    fOffset += n;
+    nRead += n;
+  }
+  fBytesRead += nRead;
+  return nRead;
+}
@@ -0,0 +1,68 @@
+#ifndef _ORMMapFileReader_hh_
+#define _ORMMapFileReader_hh_
+
+#include <string>
+#include <vector>
+
+#include "ORVReader.hh"
+
+/*
+File reader that maps raw ORCA files into memory and walks the record headers
+in place.  ReadRecord hands the processors a pointer straight into the
+mapping instead of copying each record into the manager's buffer.  The
+manager's own buffer is held on to and given back once the stream is
+exhausted, so whoever allocated it still frees it.
+
+The mapping is private and writable, so in-place edits by processors never
+touch the file on disk.  Byte-swapped files are refused; use the default
+ORFileReader for those.
+
+Handing out the mapping relies on how ORDataProcManager::ProcessDataStream
+drives ORVReader::ReadRecord(buffer, nLongsMax), which ORCARoot doesn't
+document as a contract:
+  - the manager passes its own buffer by reference and decodes the record
+    from wherever buffer points after the call, not from a copy of the
+    pointer it held before;
+  - it only uses nLongsMax through the next ReadRecord call (here it is the
+    record's length, not a capacity);
+  - it frees its buffer (delete[]) only after ReadRecord has returned
+    false, which is when the original buffer and length are put back;
+  - no processor keeps a record pointer past its own ProcessDataRecord,
+    since the mapping is unmapped at the end of each file.
+If ORCARoot changes any of this (e.g. frees the buffer after leaving the
+loop early on a failed record), this reader must copy each record into the
+manager's buffer instead, as ORVReader::ReadRecord does, growing it with
+delete[]/new[].
+*/
+
+class ORMMapFileReader : public ORVReader
+{
+  public:
+    ORMMapFileReader(const std::string& fileName = "");
+    virtual ~ORMMapFileReader();
+
+    virtual void AddFileToProcess(const std::string& fileName)
+      { fFileList.push_back(fileName); }
+    virtual bool OKToRead();
+    virtual bool OpenDataStream();
+    virtual void CloseDataStream();
+    virtual bool ReadRecord(UInt_t*& buffer, size_t& nLongsMax);
+
+    virtual size_t GetBytesRead() const { return fBytesRead; }
+
+  protected:
+    virtual size_t Read(char* buffer, size_t nBytes);
+    virtual bool MapNextFile();
+    virtual void UnmapFile();
+
+    std::vector<std::string> fFileList;
+    size_t fFileIndex;
+    char* fMap;
+    size_t fMapLength;
+    size_t fOffset;
+    UInt_t* fOwnedBuffer;
+    size_t fOwnedLength;
+    size_t fBytesRead;
+};
+
+#endif
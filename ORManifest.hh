@@ -0,0 +1,287 @@
+#ifndef _ORManifest_hh_
+#define _ORManifest_hh_
+
+/*
+Conversion manifest: one line per raw file getSpectrum has converted,
+recording what the output was made from, by what, and what it was:
+
+  raw  rawSize  rawMTime  rawHash  version  output  outputSize  outputHash  options
+
+Fields are tab separated; rawMTime is in nanoseconds and the hashes are 16
+hex digits.  A run split by --demux has several outputs, so output,
+outputSize and outputHash are lists separated by '|', one item per output
+in the same order.  rawHash is ORSampledFileHash (a few MB, whatever the file
+size), outputHash is ORHashFile over the whole output.  The raw path is
+the key, made absolute so the same file is found from any directory.
+
+A raw file counts as unchanged if size and mtime match, or, when only the
+mtime differs (a copy, a touch), if the sampled hash still matches.  That
+check costs a stat() for an unchanged file, so getSpectrum
+--skip-up-to-date can go through a whole crystal's runs in milliseconds.
+
+Several getSpectrum processes (--jobs) update one manifest; each update
+re-reads the file under an flock() on <manifest>.lock and replaces it by
+rename, so nobody's entry is lost and readers never see half a file.
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* 64-bit hash over 8-byte words; the tail is zero-padded.  Meant for
+   spotting changed files, not for security. */
+inline uint64_t ORHashBytes(const void* data, size_t nBytes, uint64_t hash = 0x9E3779B97F4A7C15ULL)
+{
+  const unsigned char* p = (const unsigned char*) data;
+  for (; nBytes >= 8; nBytes -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 32;
+  }
+  if (nBytes > 0) {
+    uint64_t word = 0;
+    memcpy(&word, p, nBytes);
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+inline std::string ORHashString(uint64_t hash)
+{
+  char text[17];
+  snprintf(text, sizeof(text), "%016llx", (unsigned long long) hash);
+  return text;
+}
+
+/* Hash of a whole file.  False if it can't be read. */
+inline bool ORHashFile(const std::string& path, uint64_t& hash)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  std::vector<char> buffer(1 << 20);
+  hash = ORHashBytes(NULL, 0);
+  ssize_t n;
+  while ((n = read(fd, &(buffer[0]), buffer.size())) > 0) hash = ORHashBytes(&(buffer[0]), n, hash);
+  close(fd);
+  return n == 0;
+}
+
+/* Hash of the first and last MB, 16 evenly spread 64 kB blocks and the
+   size, so it stays cheap for multi-GB raw files. */
+inline bool ORSampledFileHash(const std::string& path, uint64_t& hash)
+{
+  static const size_t kEdgeBytes = 1 << 20;
+  static const size_t kBlockBytes = 1 << 16;
+  static const size_t kNBlocks = 16;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  uint64_t size = st.st_size;
+  hash = ORHashBytes(&size, sizeof(size));
+  std::vector<char> buffer(kEdgeBytes);
+  std::vector<std::pair<uint64_t, size_t> > ranges;
+  ranges.push_back(std::make_pair((uint64_t) 0, kEdgeBytes));
+  for (size_t i = 1; i <= kNBlocks; i++) ranges.push_back(std::make_pair(size * i / (kNBlocks + 1), kBlockBytes));
+  ranges.push_back(std::make_pair(size > kEdgeBytes ? size - kEdgeBytes : 0, kEdgeBytes));
+  bool ok = true;
+  for (size_t i = 0; i < ranges.size() && ok; i++) {
+    ssize_t n = pread(fd, &(buffer[0]), ranges[i].second, ranges[i].first);
+    if (n < 0) ok = false;
+    else hash = ORHashBytes(&(buffer[0]), n, hash);
+  }
+  close(fd);
+  return ok;
+}
+
+struct ORManifestEntry {
+  std::string raw;
+  uint64_t rawSize;
+  int64_t rawMTime;
+  std::string rawHash;
+  std::string version;
+  std::vector<std::string> outputs;
+  std::vector<uint64_t> outputSizes;
+  std::vector<std::string> outputHashes;
+  std::string options;
+
+  ORManifestEntry() : rawSize(0), rawMTime(0) {}
+
+  std::string ToLine() const
+  {
+    std::ostringstream line;
+    line << raw << "\t" << rawSize << "\t" << rawMTime << "\t" << rawHash << "\t" << version << "\t";
+    for (size_t i = 0; i < outputs.size(); i++) line << (i > 0 ? "|" : "") << outputs[i];
+    line << "\t";
+    for (size_t i = 0; i < outputSizes.size(); i++) line << (i > 0 ? "|" : "") << outputSizes[i];
+    line << "\t";
+    for (size_t i = 0; i < outputHashes.size(); i++) line << (i > 0 ? "|" : "") << outputHashes[i];
+    line << "\t" << options;
+    return line.str();
+  }
+
+  static std::vector<std::string> Split(const std::string& text, char separator)
+  {
+    std::vector<std::string> items;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, separator)) items.push_back(item);
+    return items;
+  }
+
+  bool FromLine(const std::string& line)
+  {
+    std::vector<std::string> fields = Split(line, '\t');
+    if (fields.size() != 9) return false;
+    raw = fields[0];
+    rawSize = strtoull(fields[1].c_str(), NULL, 10);
+    rawMTime = strtoll(fields[2].c_str(), NULL, 10);
+    rawHash = fields[3];
+    version = fields[4];
+    outputs = Split(fields[5], '|');
+    std::vector<std::string> sizes = Split(fields[6], '|');
+    outputHashes = Split(fields[7], '|');
+    if (outputs.empty() || sizes.size() != outputs.size() || outputHashes.size() != outputs.size()) {
+      return false;
+    }
+    outputSizes.clear();
+    for (size_t i = 0; i < sizes.size(); i++) outputSizes.push_back(strtoull(sizes[i].c_str(), NULL, 10));
+    options = fields[8];
+    return true;
+  }
+};
+
+class ORManifest
+{
+  public:
+    ORManifest(const std::string& path) : fPath(path) {}
+
+    /* Absolute form of a path, which is what entries are keyed on. */
+    static std::string Key(const std::string& path)
+    {
+      char resolved[PATH_MAX];
+      if (realpath(path.c_str(), resolved) == NULL) return path;
+      return resolved;
+    }
+
+    static int64_t MTimeOf(const struct stat& st)
+    {
+      return (int64_t) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+
+    /* A missing manifest is just an empty one. */
+    bool Read()
+    {
+      fEntries.clear();
+      std::ifstream in(fPath.c_str());
+      std::string line;
+      while (std::getline(in, line)) {
+        ORManifestEntry entry;
+        if (entry.FromLine(line)) fEntries[entry.raw] = entry;
+      }
+      return true;
+    }
+
+    const ORManifestEntry* Find(const std::string& raw) const
+    {
+      std::map<std::string, ORManifestEntry>::const_iterator it = fEntries.find(Key(raw));
+      return (it == fEntries.end()) ? NULL : &(it->second);
+    }
+
+    /* True if raw was converted by this version with these options, hasn't
+       changed since, and every output is still where the entry says. */
+    bool IsUpToDate(const std::string& raw, const std::string& version,
+                    const std::string& options) const
+    {
+      const ORManifestEntry* entry = Find(raw);
+      if (entry == NULL || entry->version != version || entry->options != options) return false;
+      struct stat st;
+      for (size_t i = 0; i < entry->outputs.size(); i++) {
+        if (stat(entry->outputs[i].c_str(), &st) != 0 || (uint64_t) st.st_size != entry->outputSizes[i]) {
+          return false;
+        }
+      }
+      if (stat(raw.c_str(), &st) != 0 || (uint64_t) st.st_size != entry->rawSize) return false;
+      if (MTimeOf(st) == entry->rawMTime) return true;
+      uint64_t hash;
+      return ORSampledFileHash(raw, hash) && ORHashString(hash) == entry->rawHash;
+    }
+
+    /* Fills in everything about raw and its outputs and stores the entry. */
+    bool Record(const std::string& raw, const std::vector<std::string>& outputs,
+                const std::string& version, const std::string& options)
+    {
+      if (outputs.empty()) return false;
+      ORManifestEntry entry;
+      entry.raw = Key(raw);
+      entry.version = version;
+      entry.options = options;
+      struct stat st;
+      uint64_t hash;
+      if (stat(raw.c_str(), &st) != 0 || !ORSampledFileHash(raw, hash)) return false;
+      entry.rawSize = st.st_size;
+      entry.rawMTime = MTimeOf(st);
+      entry.rawHash = ORHashString(hash);
+      for (size_t i = 0; i < outputs.size(); i++) {
+        if (stat(outputs[i].c_str(), &st) != 0 || !ORHashFile(outputs[i], hash)) return false;
+        entry.outputs.push_back(Key(outputs[i]));
+        entry.outputSizes.push_back(st.st_size);
+        entry.outputHashes.push_back(ORHashString(hash));
+      }
+      return Update(entry);
+    }
+
+    /* Adds or replaces one entry, keeping whatever others wrote meanwhile. */
+    bool Update(const ORManifestEntry& entry)
+    {
+      std::string lockPath = fPath + ".lock";
+      int lockFD = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+      if (lockFD < 0) return false;
+      if (flock(lockFD, LOCK_EX) != 0) {
+        close(lockFD);
+        return false;
+      }
+      Read();
+      fEntries[entry.raw] = entry;
+
+      std::string tmpPath = fPath + ".tmp";
+      bool ok;
+      {
+        std::ofstream out(tmpPath.c_str());
+        for (std::map<std::string, ORManifestEntry>::const_iterator it = fEntries.begin();
+             it != fEntries.end(); it++) {
+          out << it->second.ToLine() << "\n";
+        }
+        out.flush();
+        ok = out.good();
+      }
+      if (ok) ok = rename(tmpPath.c_str(), fPath.c_str()) == 0;
+      if (!ok) unlink(tmpPath.c_str());
+      flock(lockFD, LOCK_UN);
+      close(lockFD);
+      return ok;
+    }
+
+  protected:
+    std::string fPath;
+    std::map<std::string, ORManifestEntry> fEntries;
+};
+
+#endif
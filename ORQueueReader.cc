@@ -0,0 +1,53 @@
+#include "ORQueueReader.hh"
+
+#include <string.h>
+
+using namespace std;
+
+ORQueueReader::ORQueueReader(size_t maxChunks) : fQueue(maxChunks)
+{
+  fCurrentPos = 0;
+  fBytesRead = 0;
+}
+
+ORQueueReader::~ORQueueReader()
+{
+  fQueue.Cancel();
+}
+
+bool ORQueueReader::OKToRead()
+{
+  if (fCurrentPos < fCurrent.size()) return true;
+  return fQueue.WaitForData();
+}
+
+bool ORQueueReader::OpenDataStream()
+{
+  return OKToRead();
+}
+
+void ORQueueReader::CloseDataStream()
+{
+  fQueue.Cancel();
+  fCurrent.clear();
+  fCurrentPos = 0;
+}
+
+size_t ORQueueReader::Read(char* buffer, size_t nBytes)
+{
+  size_t nRead = 0;
+  while (nRead < nBytes) {
+    if (fCurrentPos == fCurrent.size()) {
+      if (!fQueue.Pop(fCurrent)) break;
+      fCurrentPos = 0;
+      continue;
+    }
+    size_t n = fCurrent.size() - fCurrentPos;
+    if (n > nBytes - nRead) n = nBytes - nRead;
+    memcpy(buffer + nRead, &(fCurrent[fCurrentPos]), n);
+    fCurrentPos += n;
+    nRead += n;
+  }
+  fBytesRead += nRead;
+  return nRead;
+}
@@ -0,0 +1,39 @@
+#ifndef _ORQueueReader_hh_
+#define _ORQueueReader_hh_
+
+#include <vector>
+
+#include "ORChunkQueue.hh"
+#include "ORVReader.hh"
+
+/*
+Reader whose bytes come from an ORChunkQueue filled by some other thread.
+Read() blocks until the producer delivers or closes the queue; record
+framing and byte swapping are left to ORVReader::ReadRecord.  Closing the
+data stream cancels the queue so the producer stops as well.
+*/
+
+class ORQueueReader : public ORVReader
+{
+  public:
+    ORQueueReader(size_t maxChunks = 8);
+    virtual ~ORQueueReader();
+
+    virtual bool OKToRead();
+    virtual bool OpenDataStream();
+    virtual void CloseDataStream();
+
+    virtual ORChunkQueue& GetQueue() { return fQueue; }
+    // Bytes handed to the decoder so far.
+    virtual size_t GetBytesRead() const { return fBytesRead; }
+
+  protected:
+    virtual size_t Read(char* buffer, size_t nBytes);
+
+    ORChunkQueue fQueue;
+    std::vector<char> fCurrent;
+    size_t fCurrentPos;
+    size_t fBytesRead;
+};
+
+#endif
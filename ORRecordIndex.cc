@@ -0,0 +1,235 @@
+#include "ORRecordIndex.hh"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+#include "ORMMapFileReader.hh"
+#include "ORSIS3302Decoder.hh"
+
+using namespace std;
+
+static int64_t MTimeOf(const struct stat& st)
+{
+  return (int64_t) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static bool OffsetLess(const ORRecordIndexEntry& entry, uint64_t offset)
+{
+  return entry.offset < offset;
+}
+
+ORRecordIndex::ORRecordIndex()
+{
+  memset(&fHeader, 0, sizeof(fHeader));
+  memcpy(fHeader.magic, kORRecordIndexMagic, sizeof(fHeader.magic));
+  fHeader.version = 1;
+}
+
+void ORRecordIndex::ParseHeaderIds(const char* xml, size_t nBytes, const string& sisPath,
+                                   set<uint32_t>& ids, uint32_t& sisId)
+{
+  static const string kDataIdKey = "<key>dataId</key>";
+  static const string kInteger = "<integer>";
+  string text(xml, nBytes);
+  size_t at = 0;
+  while ((at = text.find(kDataIdKey, at)) != string::npos) {
+    at = text.find(kInteger, at);
+    if (at == string::npos) break;
+    ids.insert(strtoul(text.c_str() + at + kInteger.size(), NULL, 10));
+  }
+
+  // Follow the decoder's path (e.g. ORSIS3302Model:Energy) down the
+  // dataDescription dictionary to its dataId.
+  at = text.find("<key>dataDescription</key>");
+  istringstream path(sisPath);
+  string key;
+  while (at != string::npos && getline(path, key, ':')) at = text.find("<key>" + key + "</key>", at);
+  if (at != string::npos) at = text.find(kDataIdKey, at);
+  if (at != string::npos) at = text.find(kInteger, at);
+  if (at != string::npos) sisId = strtoul(text.c_str() + at + kInteger.size(), NULL, 10);
+}
+
+bool ORRecordIndex::Build(const string& rawFile)
+{
+  *this = ORRecordIndex();
+  struct stat st;
+  if (stat(rawFile.c_str(), &st) != 0) {
+    fHeader.status = kORIndexUnreadable;
+    return false;
+  }
+  fHeader.rawSize = st.st_size;
+  fHeader.rawMTime = MTimeOf(st);
+
+  ORMMapFileReader reader(rawFile);
+  if (!reader.OKToRead()) {
+    fHeader.status = kORIndexUnreadable;
+    return false;
+  }
+  ORSIS3302Decoder decoder;
+  set<uint32_t> ids;
+  uint32_t sisId = 0xFFFFFFFF;
+  // Handed back by the reader at the end, as the manager's buffer would be.
+  vector<UInt_t> owned(2);
+  UInt_t* buffer = &(owned[0]);
+  size_t nLongs = owned.size();
+  while (true) {
+    uint64_t offset = reader.GetBytesRead();
+    if (!reader.ReadRecord(buffer, nLongs)) break;
+    ORRecordIndexEntry entry;
+    entry.offset = offset;
+    entry.timestamp = 0;
+    entry.dataId = ORBasicDataDecoder::DataIdOf(buffer);
+    entry.crate = entry.card = entry.channel = 0xFF;
+    entry.flags = 0;
+    if (fEntries.empty() && entry.dataId == 0) {
+      size_t nBytes = (nLongs > 2) ? (nLongs - 2) * sizeof(UInt_t) : 0;
+      if (nLongs >= 2 && buffer[1] < nBytes) nBytes = buffer[1];
+      ParseHeaderIds((const char*) (buffer + 2), nBytes, decoder.GetDataObjectPath(), ids, sisId);
+    } else if (entry.dataId == sisId) {
+      decoder.SetDataRecord(buffer);
+      entry.crate = decoder.CrateOf(buffer);
+      entry.card = decoder.CardOf(buffer);
+      entry.channel = decoder.GetChannelNum();
+      entry.timestamp = decoder.GetTimeStamp();
+      entry.flags = kORIndexSIS3302;
+    } else if (!ids.empty() && ids.count(entry.dataId) == 0) {
+      entry.flags = kORIndexUnknownId;
+      fHeader.nUnknown++;
+    }
+    fEntries.push_back(entry);
+  }
+  fHeader.nRecords = fEntries.size();
+  fHeader.endOffset = reader.GetBytesRead();
+  reader.CloseDataStream();
+
+  if (fHeader.nUnknown > 0) fHeader.status |= kORIndexUnknownIds;
+  if (fHeader.endOffset < fHeader.rawSize) {
+    // The reader gave up on the next record; look at it to say why.
+    UInt_t word = 0;
+    int fd = open(rawFile.c_str(), O_RDONLY);
+    bool haveWord = fd >= 0 && fHeader.rawSize - fHeader.endOffset >= sizeof(word) &&
+                    pread(fd, &word, sizeof(word), fHeader.endOffset) == (ssize_t) sizeof(word);
+    if (fd >= 0) close(fd);
+    if (haveWord && ORBasicDataDecoder::LengthOf(&word) == 0) fHeader.status |= kORIndexCorruptLength;
+    else fHeader.status |= kORIndexTruncated;
+  }
+  return true;
+}
+
+bool ORRecordIndex::Write(const string& path) const
+{
+  string tmpPath = path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == NULL) return false;
+  bool ok = fwrite(&fHeader, sizeof(fHeader), 1, file) == 1;
+  if (ok && !fEntries.empty()) {
+    ok = fwrite(&(fEntries[0]), sizeof(ORRecordIndexEntry), fEntries.size(), file) == fEntries.size();
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(tmpPath.c_str());
+  return ok;
+}
+
+bool ORRecordIndex::Read(const string& path)
+{
+  *this = ORRecordIndex();
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) return false;
+  ORRecordIndexHeader header;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, kORRecordIndexMagic, sizeof(header.magic)) == 0 &&
+            header.version == 1;
+  if (ok) {
+    fEntries.resize(header.nRecords);
+    ok = header.nRecords == 0 ||
+         fread(&(fEntries[0]), sizeof(ORRecordIndexEntry), header.nRecords, file) == header.nRecords;
+  }
+  fclose(file);
+  if (!ok) {
+    fEntries.clear();
+    return false;
+  }
+  fHeader = header;
+  return true;
+}
+
+bool ORRecordIndex::IsCurrent(const string& rawFile) const
+{
+  struct stat st;
+  return stat(rawFile.c_str(), &st) == 0 && (uint64_t) st.st_size == fHeader.rawSize &&
+         MTimeOf(st) == fHeader.rawMTime;
+}
+
+vector<pair<uint64_t, uint64_t> > ORRecordIndex::Split(size_t nParts) const
+{
+  vector<pair<uint64_t, uint64_t> > ranges;
+  if (fEntries.empty() || nParts == 0) return ranges;
+  uint64_t end = fHeader.endOffset;
+  uint64_t begin = 0;
+  for (size_t i = 1; i <= nParts; i++) {
+    uint64_t cut = end;
+    if (i < nParts) {
+      vector<ORRecordIndexEntry>::const_iterator it =
+        lower_bound(fEntries.begin(), fEntries.end(), end / nParts * i, OffsetLess);
+      if (it != fEntries.end()) cut = it->offset;
+    }
+    if (cut > begin) ranges.push_back(make_pair(begin, cut));
+    begin = cut;
+  }
+  return ranges;
+}
+
+void ORRecordIndex::PrintReport(ostream& out, const string& rawFile) const
+{
+  map<uint32_t, uint64_t> perId;
+  map<unsigned, uint64_t> perChannel;
+  uint64_t firstTime = 0, lastTime = 0, nSIS = 0;
+  const ORRecordIndexEntry* firstUnknown = NULL;
+  for (size_t i = 0; i < fEntries.size(); i++) {
+    const ORRecordIndexEntry& entry = fEntries[i];
+    perId[entry.dataId]++;
+    if (entry.flags & kORIndexSIS3302) {
+      if (nSIS == 0 || entry.timestamp < firstTime) firstTime = entry.timestamp;
+      if (nSIS == 0 || entry.timestamp > lastTime) lastTime = entry.timestamp;
+      perChannel[entry.crate * 10000 + entry.card * 100 + entry.channel]++;
+      nSIS++;
+    }
+    if ((entry.flags & kORIndexUnknownId) && firstUnknown == NULL) firstUnknown = &entry;
+  }
+
+  out << rawFile << ": " << fHeader.nRecords << " records, " << fHeader.endOffset << " of "
+      << fHeader.rawSize << " bytes" << endl;
+  for (map<uint32_t, uint64_t>::iterator it = perId.begin(); it != perId.end(); it++) {
+    out << "  data ID 0x" << hex << it->first << dec << ": " << it->second << " records" << endl;
+  }
+  if (nSIS > 0) {
+    out << "  SIS3302: " << nSIS << " hits, timestamps " << firstTime << " - " << lastTime << endl;
+    for (map<unsigned, uint64_t>::iterator it = perChannel.begin(); it != perChannel.end(); it++) {
+      out << "    crate " << it->first / 10000 << " card " << it->first / 100 % 100
+          << " channel " << it->first % 100 << ": " << it->second << endl;
+    }
+  }
+  if (fHeader.status & kORIndexUnreadable) out << "  UNREADABLE" << endl;
+  if (fHeader.status & kORIndexTruncated) {
+    out << "  TRUNCATED: last record incomplete, " << fHeader.rawSize - fHeader.endOffset
+        << " bytes at " << fHeader.endOffset << " not indexed" << endl;
+  }
+  if (fHeader.status & kORIndexCorruptLength) {
+    out << "  CORRUPT: zero record length at byte " << fHeader.endOffset << ", "
+        << fHeader.rawSize - fHeader.endOffset << " bytes not indexed" << endl;
+  }
+  if (firstUnknown != NULL) {
+    out << "  CORRUPT: " << fHeader.nUnknown << " records with data IDs the header doesn't "
+        << "declare, the first at byte " << firstUnknown->offset << endl;
+  }
+  if (fHeader.status == kORIndexOK) out << "  OK" << endl;
+}
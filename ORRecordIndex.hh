@@ -0,0 +1,105 @@
+#ifndef _ORRecordIndex_hh_
+#define _ORRecordIndex_hh_
+
+#include <stdint.h>
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+Index of the records in a raw ORCA file, built by walking only the record
+headers through ORMMapFileReader, and the integrity check that comes with
+the walk.  Nothing is decoded beyond the header words, so it runs at disk
+read speed.  Written next to the raw file as <raw>.idx (host byte order):
+
+  ORRecordIndexHeader                 64 bytes
+  ORRecordIndexEntry[nRecords]        24 bytes each
+
+Every entry has the record's byte offset and data ID; SIS3302 records also
+get crate, card, channel and timestamp (0xFF and 0 for other records).
+
+The walk stops at the first record whose length is zero (corrupt) or runs
+past the end of the file (truncated).  A length that is wrong but still
+fits throws the walk into the middle of data, which shows up as records
+with data IDs the XML header doesn't declare; those are flagged and
+counted.  The index remembers the size and mtime of the file it was made
+from, so a stale one is rebuilt rather than trusted.
+
+Split cuts the complete records into byte ranges on record boundaries, for
+handing one file to several workers; each worker still needs the header
+record (record 0, in the first range) to know the data IDs.
+*/
+
+static const char kORRecordIndexMagic[8] = { 'O', 'R', 'I', 'D', 'X', '1', '\0', '\0' };
+
+enum EORRecordIndexStatus {
+  kORIndexOK = 0,
+  kORIndexTruncated = 1,
+  kORIndexCorruptLength = 2,
+  kORIndexUnknownIds = 4,
+  kORIndexUnreadable = 8
+};
+
+enum EORRecordIndexFlags {
+  kORIndexSIS3302 = 1,
+  kORIndexUnknownId = 2
+};
+
+struct ORRecordIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t status;
+  uint64_t nRecords;
+  uint64_t rawSize;
+  int64_t rawMTime;
+  uint64_t endOffset;     // end of the last complete record
+  uint64_t nUnknown;      // records with undeclared data IDs
+  uint8_t reserved[8];
+};
+
+struct ORRecordIndexEntry {
+  uint64_t offset;
+  uint64_t timestamp;
+  uint32_t dataId;
+  uint8_t crate;
+  uint8_t card;
+  uint8_t channel;
+  uint8_t flags;
+};
+
+class ORRecordIndex
+{
+  public:
+    ORRecordIndex();
+
+    static std::string IndexPath(const std::string& rawFile) { return rawFile + ".idx"; }
+
+    // Walks rawFile.  False only if it couldn't be read at all; damage is
+    // reported through GetStatus.
+    bool Build(const std::string& rawFile);
+    bool Write(const std::string& path) const;
+    bool Read(const std::string& path);
+    // True if the index was made from rawFile as it is now.
+    bool IsCurrent(const std::string& rawFile) const;
+
+    // [begin, end) byte ranges of about equal size, on record boundaries.
+    std::vector<std::pair<uint64_t, uint64_t> > Split(size_t nParts) const;
+    void PrintReport(std::ostream& out, const std::string& rawFile) const;
+
+    uint32_t GetStatus() const { return fHeader.status; }
+    const ORRecordIndexHeader& GetHeader() const { return fHeader; }
+    const std::vector<ORRecordIndexEntry>& GetEntries() const { return fEntries; }
+
+  protected:
+    // Data IDs declared in the XML header, and the SIS3302 one among them.
+    static void ParseHeaderIds(const char* xml, size_t nBytes, const std::string& sisPath,
+                               std::set<uint32_t>& ids, uint32_t& sisId);
+
+    ORRecordIndexHeader fHeader;
+    std::vector<ORRecordIndexEntry> fEntries;
+};
+
+#endif
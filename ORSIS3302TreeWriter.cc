@@ -0,0 +1,870 @@
+#include "ORSIS3302TreeWriter.hh"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TH1.h"
+#include "TH2.h"
+#include "TParameter.h"
+
+#include "ORColumnarFile.hh"
+#include "ORLiveSpectra.hh"
+#include "ORLogger.hh"
+#include "ORWaveformCodec.hh"
+#include "ORWaveformKernels.hh"
+
+using namespace std;
+
+ORSIS3302TreeWriter::ORSIS3302TreeWriter(string treeName) :
+  ORVTreeWriter(new ORSIS3302Decoder, treeName)
+{
+  f3302Decoder = dynamic_cast<ORSIS3302Decoder*>(fDataDecoder);
+  fEnergy = 0;
+  fAmplitude = 0;
+  fTime = 0;
+  fStart = 0;
+  fPeakingTime = 0;
+  fNRecords = 0;
+  fPool = NULL;
+  fOwnsPool = false;
+  fCurrentBatch = NULL;
+  fBatchSize = 1024;
+  fMaxBatchesInFlight = 0;
+  fFillHistograms = false;
+  fStoreWaveforms = false;
+  fWaveformBytes = 0;
+  fNTraces = 0;
+  fRawTraceBytes = 0;
+  fPackedTraceBytes = 0;
+  fMetrics = NULL;
+  fBaselineSamples = 64;
+  fPulseShape = false;
+  fFillBusy = false;
+  fFillStop = false;
+  fTailStart = 20;
+  fPileUpThreshold = 0;
+  fPileUpLag = 10;
+  fPileUpFlag = 0;
+  fCheckpointInterval = 0;
+  fLastCheckpoint = 0;
+  fPosition = NULL;
+  fNSeen = 0;
+  fNSkip = 0;
+  fCoincidenceWindow = 0;
+  fEventTree = NULL;
+  fNTruncatedEvents = 0;
+  fTemperature = 0;
+  fEnergyCorr = 0;
+  fLive = NULL;
+  fSlim = false;
+  fCompression = -1;
+  fSlimEnergy = 0;
+  fSlimAmplitude = 0;
+  fSlimTime = 0;
+  fSlimChannel = 0;
+  SetDoNotAutoFillTree();
+}
+
+ORSIS3302TreeWriter::~ORSIS3302TreeWriter()
+{
+  if (fFillThread.joinable()) {
+    // Anything still queued never made it to EndRun; drop it.
+    {
+      lock_guard<mutex> lock(fFillMutex);
+      for (size_t i = 0; i < fFillBlocks.size(); i++) delete fFillBlocks[i];
+      fFillBlocks.clear();
+      fFillStop = true;
+    }
+    fFillReady.notify_all();
+    fFillThread.join();
+  }
+  // A shared pool outlives us; don't leave it working on our batches.
+  for (size_t i = 0; i < fBatches.size(); i++) fBatches[i]->done.wait();
+  if (fOwnsPool) delete fPool;
+  for (size_t i = 0; i < fBatches.size(); i++) delete fBatches[i];
+  delete fCurrentBatch;
+  for (size_t i = 0; i < fWorkerDecoders.size(); i++) delete fWorkerDecoders[i];
+  for (map<UShort_t, ORSpectrumAccumulator*>::iterator it = fSpectra.begin();
+       it != fSpectra.end(); it++) delete it->second;
+  for (map<UShort_t, ORSpectrumAccumulator*>::iterator it = fPileUpSpectra.begin();
+       it != fPileUpSpectra.end(); it++) delete it->second;
+  delete fEventTree;
+  delete f3302Decoder;
+}
+
+void ORSIS3302TreeWriter::SetNThreads(size_t nThreads)
+{
+  SetWorkerPool(NULL);
+  if (nThreads <= 1) return;
+  SetWorkerPool(new ORWorkerPool(nThreads));
+  fOwnsPool = true;
+}
+
+void ORSIS3302TreeWriter::SetWorkerPool(ORWorkerPool* pool)
+{
+  DrainBatches(0);
+  if (fOwnsPool) delete fPool;
+  fPool = pool;
+  fOwnsPool = false;
+  for (size_t i = 0; i < fWorkerDecoders.size(); i++) delete fWorkerDecoders[i];
+  fWorkerDecoders.clear();
+  fWorkerScratch.clear();
+  if (fPool == NULL) return;
+
+  // Decoders are per worker of the pool, so a shared pool never hands one
+  // decoder to two threads.
+  size_t nThreads = fPool->GetNWorkers();
+  for (size_t i = 0; i < nThreads; i++) fWorkerDecoders.push_back(new ORSIS3302Decoder);
+  fWorkerScratch.resize(nThreads);
+  // Two batches per worker keeps everyone busy while the oldest is filled.
+  fMaxBatchesInFlight = 2 * nThreads;
+}
+
+void ORSIS3302TreeWriter::SetTrapezoids(const vector<ORTrapezoidShaping>& shapings)
+{
+  fTrapezoids = shapings;
+  if (fTrapezoids.size() > kORMaxTrapezoids) {
+    ORLog(kWarning) << "Only the first " << kORMaxTrapezoids << " of "
+                    << fTrapezoids.size() << " trapezoid settings are used" << endl;
+    fTrapezoids.resize(kORMaxTrapezoids);
+  }
+}
+
+void ORSIS3302TreeWriter::SetCheckpoint(const string& path, double interval,
+                                        const ORTimedReader* position, const string& options)
+{
+  fCheckpointPath = path;
+  fCheckpointInterval = (position == NULL || interval <= 0) ? 0 : (uint64_t) (interval * 1e9);
+  fPosition = position;
+  fCheckpointOptions = options;
+}
+
+void ORSIS3302TreeWriter::SetResume(const string& partialFile, const ORCheckpoint& checkpoint)
+{
+  fResumeFile = partialFile;
+  fResume = checkpoint;
+}
+
+void ORSIS3302TreeWriter::DecodeRecord(ORSIS3302Decoder* decoder, ORSIS3302Scratch& scratch,
+                                       UInt_t* record, ORSIS3302Event& event) const
+{
+  vector<UShort_t>& waveform = scratch.waveform;
+  decoder->SetDataRecord(record);
+  event.energy = decoder->GetEnergyMax();
+  event.time = decoder->GetTimeStamp();
+  event.channel = decoder->GetChannelNum();
+
+  // Samples stay 16-bit in a buffer reused across records; the min/max
+  // kernel runs over them directly instead of a per-event vector<double>.
+  size_t nSamples = decoder->GetWaveformLen();
+  if (waveform.size() < nSamples) waveform.resize(nSamples);
+  size_t nBaseline = (fBaselineSamples < nSamples / 4) ? fBaselineSamples : nSamples / 4;
+  if (nSamples > 0) {
+    decoder->CopyWaveformData(&(waveform[0]), nSamples);
+    uint16_t min, max;
+    uint64_t sum;
+    if (fPileUpThreshold > 0) {
+      ORWaveformPileUpScan(&(waveform[0]), nSamples, fPileUpLag, fPileUpThreshold,
+                           min, max, sum, event.pileUp);
+    } else if (fPulseShape) {
+      ORWaveformMinMaxSum(&(waveform[0]), nSamples, min, max, sum);
+    } else {
+      ORWaveformMinMax(&(waveform[0]), nSamples, min, max);
+    }
+    if (fPulseShape) {
+      ORWaveformPulseShape(&(waveform[0]), nSamples, nBaseline, fTailStart, max, sum, event.shape);
+    }
+    event.amplitude = (double) max - (double) min;
+  } else {
+    event.amplitude = 0;
+    if (fPulseShape) ORWaveformPulseShape(NULL, 0, 0, 0, 0, 0, event.shape);
+    event.pileUp.nEdges = event.pileUp.firstTime = event.pileUp.secondTime = 0;
+  }
+  if (!fTrapezoids.empty()) {
+    // The prefix sums and baseline are shared by every shaping.
+    if (scratch.sums.size() < nSamples + 1) {
+      scratch.sums.resize(nSamples + 1);
+      scratch.filter.resize(nSamples + 1);
+    }
+    double baseline = 0;
+    if (nSamples > 0) ORWaveformPrefixSums(&(waveform[0]), nSamples, &(scratch.sums[0]));
+    if (nBaseline > 0) baseline = scratch.sums[nBaseline] / nBaseline;
+    for (size_t i = 0; i < fTrapezoids.size(); i++) {
+      event.trapEnergy[i] = (nSamples == 0) ? 0 :
+        ORTrapezoidMax(&(waveform[0]), &(scratch.sums[0]), nSamples, baseline,
+                       fTrapezoids[i], &(scratch.filter[0]));
+    }
+  }
+  if (fStoreWaveforms) {
+    OREncodeWaveform(nSamples > 0 ? &(waveform[0]) : NULL, nSamples, event.waveform);
+  }
+}
+
+ORDataProcessor::EReturnCode ORSIS3302TreeWriter::ProcessMyDataRecord(UInt_t* record)
+{
+  ORStageTimer timer(fMetrics, ORStageMetrics::kProcess);
+  // Checked before the record is handled, so the checkpoint covers exactly
+  // the records before this one.
+  if (fCheckpointInterval > 0 && fNSeen >= fNSkip && (fNSeen & 1023) == 0 &&
+      ORStageMetrics::Now() - fLastCheckpoint >= fCheckpointInterval) {
+    Checkpoint(record);
+  }
+  // Already in the tree, copied from the partial file we resumed from.
+  if (fNSeen++ < fNSkip) return kSuccess;
+
+  if (!fChannels.empty()) {
+    // Only the header is looked at for channels nobody asked for.
+    f3302Decoder->SetDataRecord(record);
+    UShort_t channel = f3302Decoder->GetChannelNum();
+    if (fChannels.count(channel) == 0) {
+      fNRejected[channel]++;
+      return kSuccess;
+    }
+  }
+
+  if (fPeakingTime == 0) {
+    f3302Decoder->SetDataRecord(record);
+    fPeakingTime = f3302Decoder->GetPeakingTime(f3302Decoder->CrateOf(record),
+                                                f3302Decoder->CardOf(record),
+                                                f3302Decoder->GetChannelNum());
+  }
+  fNRecords++;
+
+  if (fPool == NULL) {
+    {
+      ORStageTimer decodeTimer(fMetrics, ORStageMetrics::kDecode);
+      DecodeRecord(f3302Decoder, fScratch, record, fEvent);
+    }
+    StoreEvent(fEvent);
+    return kSuccess;
+  }
+
+  // The record buffer belongs to the reader, so keep a copy for the worker.
+  if (fCurrentBatch == NULL) {
+    fCurrentBatch = new Batch;
+    fCurrentBatch->offsets.reserve(fBatchSize);
+  }
+  size_t nLongs = f3302Decoder->LengthOf(record);
+  fCurrentBatch->offsets.push_back(fCurrentBatch->records.size());
+  fCurrentBatch->records.insert(fCurrentBatch->records.end(), record, record + nLongs);
+  if (fCurrentBatch->offsets.size() >= fBatchSize) SubmitBatch();
+  return kSuccess;
+}
+
+void ORSIS3302TreeWriter::DecodeBatch(Batch* batch, size_t iWorker)
+{
+  ORStageTimer timer(fMetrics, ORStageMetrics::kDecode, batch->offsets.size());
+  batch->events.resize(batch->offsets.size());
+  for (size_t i = 0; i < batch->offsets.size(); i++) {
+    DecodeRecord(fWorkerDecoders[iWorker], fWorkerScratch[iWorker],
+                 &(batch->records[batch->offsets[i]]), batch->events[i]);
+  }
+}
+
+void ORSIS3302TreeWriter::SubmitBatch()
+{
+  if (fCurrentBatch == NULL) return;
+  Batch* batch = fCurrentBatch;
+  fCurrentBatch = NULL;
+  batch->done = fPool->Submit(bind(&ORSIS3302TreeWriter::DecodeBatch, this, batch,
+                                   placeholders::_1));
+  fBatches.push_back(batch);
+  DrainBatches(fMaxBatchesInFlight);
+}
+
+void ORSIS3302TreeWriter::DrainBatches(size_t nKeep)
+{
+  if (nKeep == 0 && fCurrentBatch != NULL && fPool != NULL) {
+    SubmitBatch();
+  }
+  // Fill strictly in submission order; a later batch finishing first waits.
+  while (fBatches.size() > nKeep) {
+    Batch* batch = fBatches.front();
+    fBatches.pop_front();
+    batch->done.get();
+    if (fFillThread.joinable()) HandOffBlock(batch->events);
+    else for (size_t i = 0; i < batch->events.size(); i++) FillEvent(batch->events[i]);
+    delete batch;
+  }
+}
+
+void ORSIS3302TreeWriter::SetBackgroundFill(bool background)
+{
+  if (background == fFillThread.joinable()) return;
+  if (background) {
+    fFillStop = false;
+    fFillThread = thread(&ORSIS3302TreeWriter::FillLoop, this);
+    return;
+  }
+  FinishFills();
+  {
+    lock_guard<mutex> lock(fFillMutex);
+    fFillStop = true;
+  }
+  fFillReady.notify_all();
+  fFillThread.join();
+}
+
+void ORSIS3302TreeWriter::StoreEvent(const ORSIS3302Event& event)
+{
+  if (!fFillThread.joinable()) {
+    FillEvent(event);
+    return;
+  }
+  fFillBlock.push_back(event);
+  if (fFillBlock.size() >= fBatchSize) HandOffBlock(fFillBlock);
+}
+
+void ORSIS3302TreeWriter::HandOffBlock(vector<ORSIS3302Event>& events)
+{
+  if (events.empty()) return;
+  vector<ORSIS3302Event>* block = new vector<ORSIS3302Event>;
+  block->swap(events);
+  {
+    unique_lock<mutex> lock(fFillMutex);
+    while (fFillBlocks.size() >= kMaxFillBlocks) fFillSpace.wait(lock);
+    fFillBlocks.push_back(block);
+  }
+  fFillReady.notify_one();
+}
+
+void ORSIS3302TreeWriter::FinishFills()
+{
+  if (!fFillThread.joinable()) return;
+  HandOffBlock(fFillBlock);
+  unique_lock<mutex> lock(fFillMutex);
+  while (!fFillBlocks.empty() || fFillBusy) fFillSpace.wait(lock);
+}
+
+void ORSIS3302TreeWriter::FillLoop()
+{
+  unique_lock<mutex> lock(fFillMutex);
+  while (true) {
+    while (fFillBlocks.empty() && !fFillStop) fFillReady.wait(lock);
+    if (fFillBlocks.empty()) return;
+    vector<ORSIS3302Event>* block = fFillBlocks.front();
+    fFillBlocks.pop_front();
+    fFillBusy = true;
+    fFillSpace.notify_all();
+    lock.unlock();
+    for (size_t i = 0; i < block->size(); i++) FillEvent((*block)[i]);
+    delete block;
+    lock.lock();
+    fFillBusy = false;
+    fFillSpace.notify_all();
+  }
+}
+
+void ORSIS3302TreeWriter::FillEvent(const ORSIS3302Event& event)
+{
+  ORStageTimer timer(fMetrics, ORStageMetrics::kFill);
+  fEnergy = event.energy;
+  fTime = event.time;
+  fAmplitude = event.amplitude;
+  fChannel = event.channel;
+  fStart = fRunContext->GetStartTime();
+  if (fSlim) {
+    fSlimEnergy = (Int_t) llround(fEnergy);
+    fSlimAmplitude = (UShort_t) fAmplitude;
+    fSlimTime = (ULong64_t) fTime;
+    fSlimChannel = (UChar_t) fChannel;
+  }
+  for (size_t i = 0; i < fTrapezoids.size(); i++) fTrapEnergy[i] = event.trapEnergy[i];
+  if (fPulseShape) fShape = event.shape;
+  if (fPileUpThreshold > 0) {
+    fPileUp = event.pileUp;
+    fPileUpFlag = (fPileUp.nEdges > 1);
+  }
+  if (fTemperatureDir != "") {
+    fTemperature = fTemperatureLog.At(fStart + fTime * kORSIS3302ClockPeriod);
+    fEnergyCorr = fGainTable.Correct(fChannel, fEnergy, fTemperature);
+  }
+  if (fStoreWaveforms) {
+    fWaveformBytes = event.waveform.size();
+    if (fWaveformBytes > fWaveformBuffer.size()) fWaveformBytes = 0;
+    else if (fWaveformBytes > 0) memcpy(&(fWaveformBuffer[0]), &(event.waveform[0]), fWaveformBytes);
+    fNTraces++;
+    fRawTraceBytes += 2 * ORWaveformEncodedLength(&(event.waveform[0]), event.waveform.size());
+    fPackedTraceBytes += fWaveformBytes;
+  }
+  fTree->Fill();
+  AccumulateEvent();
+}
+
+void ORSIS3302TreeWriter::AccumulateEvent()
+{
+  if (fFillHistograms) {
+    ORSpectrumAccumulator*& spectrum = fPileUpFlag ? fPileUpSpectra[fChannel] : fSpectra[fChannel];
+    if (spectrum == NULL) spectrum = new ORSpectrumAccumulator;
+    spectrum->Fill(fEnergy, fAmplitude);
+  }
+
+  if (fColumnarLabel != "") {
+    fColEnergy.push_back(fEnergy);
+    fColAmplitude.push_back(fAmplitude);
+    fColTime.push_back(fTime);
+    fColChannel.push_back(fChannel);
+    if (fPileUpThreshold > 0) fColPileUp.push_back(fPileUpFlag);
+  }
+
+  if (fEventTree != NULL) {
+    ORHit hit = { fTime, fEnergy, fAmplitude, fChannel };
+    fEventBuilder.AddHit(hit);
+    if (!fEventBuilder.GetReadyEnds().empty()) FillEvents();
+  }
+
+  if (fLive != NULL) {
+    ORHit hit = { fTime, fEnergy, fAmplitude, fChannel };
+    fLiveHits.push_back(hit);
+    if (fLiveHits.size() >= kLiveBlock || fLive->IsDue()) {
+      fLive->Add(fLiveHits);
+      fLiveHits.clear();
+    }
+  }
+}
+
+void ORSIS3302TreeWriter::InitializeEventTree()
+{
+  delete fEventTree;
+  fEventTree = NULL;
+  fEventBuilder.Reset();
+  fEventBuilder.SetWindow(fCoincidenceWindow);
+  fNTruncatedEvents = 0;
+  if (fCoincidenceWindow <= 0) return;
+  fEventTree = new TTree("events", "Coincidence events");
+  fEventTree->SetDirectory(fTree->GetDirectory());
+  fEventTree->Branch("time", &fEventTime, "time/D");
+  fEventTree->Branch("multiplicity", &fMultiplicity, "nHits/i");
+  fEventTree->Branch("channelMask", &fChannelMask, "mask/i");
+  fEventTree->Branch("channel", fEventChannel, "channel[nHits]/s");
+  fEventTree->Branch("energy", fEventEnergy, "energy[nHits]/D");
+  fEventTree->Branch("amplitude", fEventAmplitude, "amp[nHits]/D");
+  fEventTree->Branch("dt", fEventDt, "dt[nHits]/D");
+}
+
+void ORSIS3302TreeWriter::FillEvents()
+{
+  const vector<ORHit>& hits = fEventBuilder.GetReadyHits();
+  const vector<size_t>& ends = fEventBuilder.GetReadyEnds();
+  size_t begin = 0;
+  for (size_t i = 0; i < ends.size(); i++) {
+    size_t nHits = ends[i] - begin;
+    if (nHits > kORMaxEventHits) {
+      nHits = kORMaxEventHits;
+      fNTruncatedEvents++;
+    }
+    fEventTime = hits[begin].time;
+    fMultiplicity = nHits;
+    fChannelMask = 0;
+    for (size_t j = 0; j < nHits; j++) {
+      const ORHit& hit = hits[begin + j];
+      fEventChannel[j] = hit.channel;
+      fEventEnergy[j] = hit.energy;
+      fEventAmplitude[j] = hit.amplitude;
+      fEventDt[j] = hit.time - fEventTime;
+      if (hit.channel < 32) fChannelMask |= 1U << hit.channel;
+    }
+    fEventTree->Fill();
+    begin = ends[i];
+  }
+  fEventBuilder.ClearReady();
+}
+
+void ORSIS3302TreeWriter::WriteEventTree()
+{
+  if (fEventTree == NULL) return;
+  fEventBuilder.Flush();
+  FillEvents();
+  TDirectory* dir = fEventTree->GetDirectory();
+  if (dir == NULL) {
+    ORLog(kError) << "Event tree has no directory; events not written" << endl;
+  } else {
+    fEventTree->FlushBaskets();
+    dir->WriteTObject(fEventTree);
+  }
+  ORLog(kRoutine) << "Built " << fEventBuilder.GetNEvents() << " events from "
+                  << fEventBuilder.GetNHits() << " hits" << endl;
+  if (fEventBuilder.GetNLate() > 0) {
+    ORLog(kWarning) << fEventBuilder.GetNLate() << " hits came too late to be merged "
+                    << "in time order" << endl;
+  }
+  if (fNTruncatedEvents > 0) {
+    ORLog(kWarning) << fNTruncatedEvents << " events had more than " << kORMaxEventHits
+                    << " hits; only the first " << kORMaxEventHits << " were stored" << endl;
+  }
+  delete fEventTree;
+  fEventTree = NULL;
+}
+
+void ORSIS3302TreeWriter::WriteColumnarFile()
+{
+  if (fColumnarLabel == "") return;
+  ostringstream path;
+  path << fColumnarLabel << "_run" << fRunContext->GetRunNumber() << ".cols";
+
+  vector<ORColumnSource> columns(fPileUpThreshold > 0 ? 5 : 4);
+  columns[0].name = "energy";
+  columns[0].type = kORColFloat64;
+  columns[0].data = fColEnergy.empty() ? NULL : &(fColEnergy[0]);
+  columns[1].name = "amp";
+  columns[1].type = kORColFloat64;
+  columns[1].data = fColAmplitude.empty() ? NULL : &(fColAmplitude[0]);
+  columns[2].name = "time";
+  columns[2].type = kORColFloat64;
+  columns[2].data = fColTime.empty() ? NULL : &(fColTime[0]);
+  columns[3].name = "channel";
+  columns[3].type = kORColUInt16;
+  columns[3].data = fColChannel.empty() ? NULL : &(fColChannel[0]);
+  if (fPileUpThreshold > 0) {
+    columns[4].name = "pileUp";
+    columns[4].type = kORColUInt8;
+    columns[4].data = fColPileUp.empty() ? NULL : &(fColPileUp[0]);
+  }
+
+  if (!ORWriteColumnarFile(path.str(), fColEnergy.size(), fRunContext->GetStartTime(),
+                           fRunContext->GetRunNumber(), columns)) {
+    ORLog(kError) << "Couldn't write columnar file " << path.str() << endl;
+  } else {
+    ORLog(kRoutine) << "Wrote " << fColEnergy.size() << " entries to " << path.str() << endl;
+  }
+  fColEnergy.clear();
+  fColAmplitude.clear();
+  fColTime.clear();
+  fColChannel.clear();
+  fColPileUp.clear();
+}
+
+void ORSIS3302TreeWriter::WriteHistograms()
+{
+  if (!fFillHistograms) return;
+  TDirectory* dir = fTree->GetDirectory();
+  if (dir == NULL) {
+    ORLog(kError) << "Tree has no directory; histograms not written" << endl;
+    return;
+  }
+
+  double energyMax = 0;
+  WriteSpectra(dir, fSpectra, "", energyMax);
+  WriteSpectra(dir, fPileUpSpectra, "PileUp", energyMax);
+
+  TParameter<double> maxPar("energyMax", energyMax);
+  dir->WriteTObject(&maxPar);
+  // Lets Calibration tell "no pile-up found" from "not looked for".
+  if (fPileUpThreshold > 0) {
+    TParameter<int> thresholdPar("pileUpThreshold", fPileUpThreshold);
+    dir->WriteTObject(&thresholdPar);
+  }
+}
+
+void ORSIS3302TreeWriter::WriteSpectra(TDirectory* dir, map<UShort_t, ORSpectrumAccumulator*>& spectra,
+                                       const string& tag, double& energyMax)
+{
+  string title = (tag == "") ? "" : " (" + tag + ")";
+  for (map<UShort_t, ORSpectrumAccumulator*>::iterator it = spectra.begin();
+       it != spectra.end(); it++) {
+    const ORSpectrumAccumulator* spectrum = it->second;
+    ostringstream suffix;
+    suffix << tag << "_ch" << it->first;
+    ostringstream channel;
+    channel << it->first;
+
+    const size_t nE = ORSpectrumAccumulator::kNEnergyBins;
+    TH1I hEnergy(("hEnergy" + suffix.str()).c_str(), ("Energy, channel " + channel.str() + title).c_str(),
+                 nE, 0, nE * spectrum->GetEnergyBinWidth());
+    const vector<uint32_t>& energy = spectrum->GetEnergyCounts();
+    for (size_t i = 0; i <= nE; i++) {
+      if (energy[i] != 0) hEnergy.SetBinContent(i, energy[i]);
+    }
+    hEnergy.SetEntries(spectrum->GetNEntries());
+
+    const size_t nM = ORSpectrumAccumulator::kNMapBins;
+    TH2I hMap(("hAmpVsEnergy" + suffix.str()).c_str(), ("Amplitude vs energy, channel " + channel.str() + title).c_str(),
+              nM, 0, nM * spectrum->GetMapEnergyBinWidth(), nM, 0, nM * ORSpectrumAccumulator::kAmpBinWidth);
+    const vector<uint32_t>& counts = spectrum->GetMapCounts();
+    for (size_t iE = 0; iE < nM; iE++) {
+      for (size_t iA = 0; iA < nM; iA++) {
+        uint32_t n = counts[iE * nM + iA];
+        if (n != 0) hMap.SetBinContent(hMap.GetBin(iE + 1, iA + 1), n);
+      }
+    }
+    hMap.SetEntries(spectrum->GetNEntries());
+
+    TParameter<double> maxPar(("energyMax" + suffix.str()).c_str(), spectrum->GetMaxEnergy());
+    if (spectrum->GetMaxEnergy() > energyMax) energyMax = spectrum->GetMaxEnergy();
+
+    dir->WriteTObject(&hEnergy);
+    dir->WriteTObject(&hMap);
+    dir->WriteTObject(&maxPar);
+    delete it->second;
+  }
+  spectra.clear();
+}
+
+void ORSIS3302TreeWriter::WriteRejectedCounts()
+{
+  if (fNRejected.empty()) return;
+  TDirectory* dir = fTree->GetDirectory();
+  for (map<UShort_t, Long64_t>::iterator it = fNRejected.begin(); it != fNRejected.end(); it++) {
+    ostringstream name;
+    name << "rejectedHits_ch" << it->first;
+    ORLog(kRoutine) << "Skipped " << it->second << " hits on channel " << it->first << endl;
+    if (dir != NULL) {
+      TParameter<Long64_t> count(name.str().c_str(), it->second);
+      dir->WriteTObject(&count);
+    }
+  }
+  fNRejected.clear();
+}
+
+void ORSIS3302TreeWriter::WriteRunConstants()
+{
+  if (!fSlim) return;
+  TDirectory* dir = fTree->GetDirectory();
+  if (dir == NULL) return;
+  double start = fRunContext->GetStartTime();
+  TParameter<double> startPar("t0", start);
+  TParameter<int> peakingPar("peakingTime", fPeakingTime);
+  dir->WriteTObject(&startPar);
+  dir->WriteTObject(&peakingPar);
+  // Written with the tree at the end of the run, so Draw("time*1e-8 + t0") still works.
+  ostringstream startValue, peakingValue;
+  startValue << setprecision(17) << start;
+  peakingValue << fPeakingTime;
+  fTree->SetAlias("t0", startValue.str().c_str());
+  fTree->SetAlias("peaktime", peakingValue.str().c_str());
+}
+
+void ORSIS3302TreeWriter::Checkpoint(UInt_t* record)
+{
+  // Everything before this record goes into the tree, and the tree to disk.
+  DrainBatches(0);
+  FinishFills();
+  fLastCheckpoint = ORStageMetrics::Now();
+  TFile* file = fTree->GetCurrentFile();
+  if (file == NULL) return;
+  fTree->AutoSave("SaveSelf");
+
+  ORCheckpoint checkpoint;
+  checkpoint.run = fRunContext->GetRunNumber();
+  checkpoint.partialFile = file->GetName();
+  checkpoint.options = fCheckpointOptions;
+  // The reader has already counted the record we haven't handled yet.
+  checkpoint.rawOffset = fPosition->GetBytesRead() - f3302Decoder->LengthOf(record) * sizeof(UInt_t);
+  checkpoint.rawRecords = fPosition->GetNRecordsRead() - 1;
+  checkpoint.sisRecords = fNSeen;
+  checkpoint.entries = fTree->GetEntries();
+  for (map<UShort_t, Long64_t>::iterator it = fNRejected.begin(); it != fNRejected.end(); it++) {
+    checkpoint.rejected[it->first] = it->second;
+  }
+  if (!checkpoint.Write(fCheckpointPath)) {
+    ORLog(kWarning) << "Couldn't write checkpoint " << fCheckpointPath << endl;
+    return;
+  }
+  // Everything the old partial file held is in this one now.
+  if (fResumeFile != "") {
+    unlink(fResumeFile.c_str());
+    fResumeFile = "";
+  }
+}
+
+bool ORSIS3302TreeWriter::CopyPartialRun()
+{
+  TDirectory* saved = gDirectory;
+  TFile* partial = TFile::Open(fResumeFile.c_str(), "READ");
+  TTree* tree = NULL;
+  if (partial != NULL && !partial->IsZombie()) {
+    tree = dynamic_cast<TTree*>(partial->Get(fTree->GetName()));
+  }
+  // Checkpointing turns ROOT's own autosaves off, so the saved tree ends
+  // exactly at the checkpoint.
+  bool ok = (tree != NULL && tree->GetEntries() == fResume.entries);
+  if (ok) ok = (fTree->CopyEntries(tree, -1, "fast") >= 0 && fTree->GetEntries() == fResume.entries);
+  if (!ok && fTree->GetEntries() > 0) fTree->Reset();
+  if (ok && (fFillHistograms || fColumnarLabel != "" || fEventTree != NULL)) {
+    tree->SetBranchStatus("*", false);
+    tree->SetBranchStatus("energy", true);
+    tree->SetBranchStatus("amplitude", true);
+    tree->SetBranchStatus("time", true);
+    tree->SetBranchStatus("ChannelNumber", true);
+    if (fSlim) {
+      tree->SetBranchAddress("energy", &fSlimEnergy);
+      tree->SetBranchAddress("amplitude", &fSlimAmplitude);
+      tree->SetBranchAddress("time", &fSlimTime);
+      tree->SetBranchAddress("ChannelNumber", &fSlimChannel);
+    } else {
+      tree->SetBranchAddress("energy", &fEnergy);
+      tree->SetBranchAddress("amplitude", &fAmplitude);
+      tree->SetBranchAddress("time", &fTime);
+      tree->SetBranchAddress("ChannelNumber", &fChannel);
+    }
+    if (fPileUpThreshold > 0) {
+      tree->SetBranchStatus("pileUp", true);
+      tree->SetBranchAddress("pileUp", &fPileUpFlag);
+    }
+    for (Long64_t i = 0; i < fResume.entries; i++) {
+      tree->GetEntry(i);
+      if (fSlim) {
+        fEnergy = fSlimEnergy;
+        fAmplitude = fSlimAmplitude;
+        fTime = fSlimTime;
+        fChannel = fSlimChannel;
+      }
+      AccumulateEvent();
+    }
+  }
+  delete partial;
+  if (saved != NULL) saved->cd();
+  return ok;
+}
+
+void ORSIS3302TreeWriter::ReadTemperatureLog()
+{
+  if (fTemperatureDir == "") return;
+  unsigned run = fRunContext->GetRunNumber();
+  string path = ORTemperatureLog::LogPath(fTemperatureDir, run);
+  if (!fTemperatureLog.Read(path)) {
+    ORLog(kWarning) << "No temperature readings in " << path << "; temperature of run " << run
+                    << " left as NaN" << endl;
+    return;
+  }
+  double start = fRunContext->GetStartTime();
+  ORLog(kRoutine) << "Read " << fTemperatureLog.GetNReadings() << " temperature readings from "
+                  << path << endl;
+  if (start < fTemperatureLog.GetStartTime() || start > fTemperatureLog.GetEndTime()) {
+    ORLog(kWarning) << "Run " << run << " starts at " << (long) start << ", outside the "
+                    << "temperature log (" << (long) fTemperatureLog.GetStartTime() << " - "
+                    << (long) fTemperatureLog.GetEndTime() << ")" << endl;
+  }
+}
+
+ORDataProcessor::EReturnCode ORSIS3302TreeWriter::StartRun()
+{
+  fColEnergy.clear();
+  fColAmplitude.clear();
+  fColTime.clear();
+  fColChannel.clear();
+  fColPileUp.clear();
+  fNRejected.clear();
+  fNSeen = 0;
+  fNSkip = 0;
+  fLastCheckpoint = ORStageMetrics::Now();
+  EReturnCode code = ORVTreeWriter::StartRun();
+  if (code != kSuccess) return code;
+  if (fCheckpointInterval > 0) fTree->SetAutoSave(0);
+  ReadTemperatureLog();
+  // Before resuming, so the copied hits go into events too.
+  InitializeEventTree();
+  if (fResumeFile == "" || fResume.run != fRunContext->GetRunNumber()) return code;
+
+  if (CopyPartialRun()) {
+    fNSkip = fResume.sisRecords;
+    for (map<unsigned short, int64_t>::iterator it = fResume.rejected.begin();
+         it != fResume.rejected.end(); it++) {
+      fNRejected[it->first] = it->second;
+    }
+    ORLog(kRoutine) << "Resuming run " << fResume.run << " at raw offset " << fResume.rawOffset
+                    << ": " << fResume.entries << " entries copied from " << fResumeFile << endl;
+  } else {
+    ORLog(kError) << "Couldn't resume from " << fResumeFile << "; converting run "
+                  << fResume.run << " from the start" << endl;
+    unlink(fResumeFile.c_str());
+    fResumeFile = "";
+  }
+  return code;
+}
+
+ORDataProcessor::EReturnCode ORSIS3302TreeWriter::EndRun()
+{
+  DrainBatches(0);
+  FinishFills();
+  if (fLive != NULL) {
+    fLive->Add(fLiveHits, true);
+    fLiveHits.clear();
+  }
+  ORStageTimer timer(fMetrics, ORStageMetrics::kFlush);
+  WriteColumnarFile();
+  WriteHistograms();
+  WriteRejectedCounts();
+  WriteRunConstants();
+  WriteEventTree();
+  if (fNTraces > 0) {
+    ORLog(kRoutine) << "Stored " << fNTraces << " waveforms: "
+                    << (double) fPackedTraceBytes / fNTraces << " bytes/trace packed vs "
+                    << (double) fRawTraceBytes / fNTraces << " as UShort_t" << endl;
+    fNTraces = 0;
+    fRawTraceBytes = 0;
+    fPackedTraceBytes = 0;
+  }
+  EReturnCode code = ORVTreeWriter::EndRun();
+  if (code != kFailure) {
+    if (fCheckpointPath != "") unlink(fCheckpointPath.c_str());
+    if (fResumeFile != "") unlink(fResumeFile.c_str());
+    fResumeFile = "";
+  }
+  return code;
+}
+
+ORDataProcessor::EReturnCode ORSIS3302TreeWriter::EndProcessing()
+{
+  DrainBatches(0);
+  FinishFills();
+  return ORVTreeWriter::EndProcessing();
+}
+
+ORDataProcessor::EReturnCode ORSIS3302TreeWriter::InitializeBranches()
+{
+  // Branches take the file's compression when they are made.
+  TFile* file = fTree->GetCurrentFile();
+  if (fCompression >= 0 && file != NULL) file->SetCompressionSettings(fCompression);
+  if (fSlim) {
+    fTree->Branch("energy", &fSlimEnergy, "energy/I");
+    fTree->Branch("amplitude", &fSlimAmplitude, "amp/s");
+    fTree->Branch("time", &fSlimTime, "time/l");
+    fTree->Branch("ChannelNumber", &fSlimChannel, "channel/b");
+  } else {
+    fTree->Branch("energy", &fEnergy, "energy/D");
+    fTree->Branch("amplitude", &fAmplitude, "amp/D");
+    fTree->Branch("time", &fTime, "time/D");
+    fTree->Branch("t0", &fStart, "t0/D");
+    fTree->Branch("ChannelNumber", &fChannel, "channel/s");
+    fTree->Branch("peakingTime", &fPeakingTime, "peaktime/s");
+  }
+  for (size_t i = 0; i < fTrapezoids.size(); i++) {
+    ostringstream name;
+    name << "trapE_" << fTrapezoids[i].rise << "_" << fTrapezoids[i].flat << "_"
+         << fTrapezoids[i].decay;
+    // No dots in branch names; TTree::Draw would take them for members.
+    string branch = name.str();
+    for (size_t j = 0; j < branch.size(); j++) if (branch[j] == '.') branch[j] = 'p';
+    fTree->Branch(branch.c_str(), &(fTrapEnergy[i]), (branch + "/D").c_str());
+  }
+  if (fPulseShape) {
+    fTree->Branch("baseline", &fShape.baselineMean, "bl/D");
+    fTree->Branch("baselineRMS", &fShape.baselineRMS, "blRMS/D");
+    fTree->Branch("riseTime", &fShape.riseTime, "riseTime/D");
+    fTree->Branch("tailRatio", &fShape.tailRatio, "tailRatio/D");
+    fTree->Branch("maxTime", &fShape.maxTime, "tMax/s");
+  }
+  if (fPileUpThreshold > 0) {
+    fTree->Branch("pileUp", &fPileUpFlag, "pileUp/b");
+    fTree->Branch("nEdges", &fPileUp.nEdges, "nEdges/s");
+    fTree->Branch("pileUpTime", &fPileUp.secondTime, "tPileUp/s");
+  }
+  if (fTemperatureDir != "") {
+    fTree->Branch("temperature", &fTemperature, "temperature/D");
+    if (!fGainTable.IsEmpty()) fTree->Branch("energyCorr", &fEnergyCorr, "energyCorr/D");
+  }
+  if (fStoreWaveforms) {
+    // Sized for the longest trace the codec handles, so the address never moves.
+    fWaveformBuffer.resize(ORWaveformMaxEncodedSize(0xFFFF));
+    fTree->Branch("waveformBytes", &fWaveformBytes, "wfBytes/i");
+    fTree->Branch("waveform", &(fWaveformBuffer[0]), "wf[wfBytes]/b");
+  }
+  if (fSlim) fTree->SetBasketSize("*", kSlimBasketSize);
+  return kSuccess;
+}
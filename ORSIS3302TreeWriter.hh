@@ -0,0 +1,334 @@
+#ifndef _ORSIS3302TreeWriter_hh_
+#define _ORSIS3302TreeWriter_hh_
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ORVTreeWriter.hh"
+#include "ORSIS3302Decoder.hh"
+#include "ORCheckpoint.hh"
+#include "OREventBuilder.hh"
+#include "ORTimedReader.hh"
+#include "ORWorkerPool.hh"
+#include "ORSpectrumAccumulator.hh"
+#include "ORStageMetrics.hh"
+#include "ORTemperatureLog.hh"
+#include "ORWaveformKernels.hh"
+
+class TDirectory;
+class ORLiveSpectra;
+
+/*
+Writes one "st" entry per SIS3302 hit.  Decoding and the waveform scan can
+run on a pool of worker threads (SetNThreads): records are copied into
+batches, each batch is decoded by one worker with its own decoder, and the
+batches are filled into the tree here in the order they were read, so the
+output is the same as a serial run.  Several writers (one per stream in the
+event-loop daemon) can share one pool through SetWorkerPool.
+
+SetBackgroundFill moves TTree::Fill (and the basket compression and disk
+writes it triggers) off the decoding thread: decoded events are handed
+over in blocks to a dedicated fill thread, with at most kMaxFillBlocks
+blocks waiting, so the decoding side stalls instead of growing without
+bound.  Everything FillEvent touches belongs to that thread until
+FinishFills returns.
+
+With SetColumnarOutput the writer also keeps every filled entry in flat
+arrays and dumps them at the end of the run as <label>_run<N>.cols (see
+ORColumnarFile.hh), which Calibration can read instead of the tree.
+
+With SetFillHistograms the writer fills per-channel energy spectra and
+amplitude-vs-energy maps as it goes and writes them next to the tree as
+hEnergy_ch<N> (TH1I), hAmpVsEnergy_ch<N> (TH2I) and energyMax_ch<N> /
+energyMax (TParameter<double>), so Calibration can skip the event data.
+
+With SetStoreWaveforms each trace is also kept, losslessly packed with
+OREncodeWaveform (ORWaveformCodec.hh), in the "waveform" branch.
+
+SetTrapezoids re-shapes every trace offline with a trapezoidal filter
+(ORTrapezoidMax in ORWaveformKernels.hh), one "trapE_<rise>_<flat>_<decay>"
+branch per setting (all in samples), so shaping can be re-optimised without
+new data.  The baseline under the filter is the mean of the first
+SetBaselineSamples samples (at most a quarter of the trace).
+
+SetPulseShape adds baseline mean/RMS, 10-90% rise time, tail/total
+integral ratio and time of maximum (ORWaveformPulseShape) as branches.  The
+sum it needs comes out of the same SIMD pass as the amplitude; the tail
+integral starts SetTailStart samples after the maximum.
+
+SetPileUp flags traces with more than one pulse edge (ORWaveformPileUpScan:
+rises of more than the threshold over SetPileUpLag samples), found in the
+same SIMD pass as the amplitude.  The "pileUp" branch is the flag,
+"nEdges" the number of edges and "pileUpTime" the sample where the second
+one starts.  Flagged hits also go to the columnar file ("pileUp") and to
+their own histograms (hEnergyPileUp_ch<N>, hAmpVsEnergyPileUp_ch<N>, next
+to a "pileUpThreshold" parameter), so Calibration can leave them out
+without the trees.
+
+SetTemperatureLogs joins each run's temperature log
+(run<N>_temperature_data.txt in that directory, see ORTemperatureLog.hh)
+onto the hits: "temperature" is interpolated at t0 + time, with time in
+kORSIS3302ClockPeriod ticks.  With SetGainTable as well, "energyCorr" is
+the energy corrected back to each channel's reference temperature.
+Without a log for the run the temperature is NaN and energyCorr equals
+energy.
+
+SetLiveSpectra hands every filled hit, in blocks of kLiveBlock, to an
+ORLiveSpectra that publishes live spectra in shared memory.  A block goes
+early when the publishing interval is up, so at full rate snapshots are
+no older than the interval; the rest goes at the end of the run.
+
+SetSlimSchema writes the per-hit branches in their natural sizes instead
+of as doubles: "energy" as Int_t, "amplitude" as UShort_t (max - min of
+16-bit samples), "time" as the ULong64_t timestamp and "ChannelNumber" as
+a byte, under the same leaf names (energy, amp, time, channel), so
+TTree::Draw cuts work unchanged.  The run constants t0 and peakingTime
+are not repeated on every entry: they are written once next to the tree
+as TParameters, and as tree aliases of the same leaf names (t0,
+peaktime).  Baskets are kSlimBasketSize bytes, so the compressor works
+on larger runs of similar values.  SetCompression picks the algorithm and
+level (ROOT's algorithm * 100 + level, e.g. 505 for ZSTD 5) for
+everything the output file gets.
+
+SetChannels restricts all of the above to a set of channels.  Other
+channels are rejected from the record header before anything is copied or
+decoded; they are only counted, and the counts are written as
+rejectedHits_ch<N> (TParameter<Long64_t>) so rates can still be worked out.
+
+SetCheckpoint makes the writer save the tree (TTree::AutoSave) every so
+often and then record in an ORCheckpoint how far the raw stream has been
+processed.  SetResume continues from such a checkpoint: at the start of
+the run the saved entries are copied, baskets as they are, out of the
+partial file, the histograms and columns are rebuilt from them, and the
+SIS3302 records they came from are skipped without being decoded.
+
+SetCoincidenceWindow builds events across channels (OREventBuilder.hh):
+hits are merged into time order and every hit within the window (in
+units of the time branch) after the first one of an event joins it.
+Events go to a second tree, "events", with the event time, the number of
+hits, a bit mask of the channels hit (channels below 32) and, per hit,
+channel, energy, amplitude and time after the first hit.  At most
+kORMaxEventHits hits of an event are stored.
+*/
+
+static const size_t kORMaxTrapezoids = 8;
+static const size_t kORMaxEventHits = 64;
+// Seconds per tick of the SIS3302 timestamp (100 MHz).
+static const double kORSIS3302ClockPeriod = 1e-8;
+
+struct ORSIS3302Event {
+  double energy;
+  double time;
+  double amplitude;
+  UShort_t channel;
+  double trapEnergy[kORMaxTrapezoids];
+  ORPulseShape shape;
+  ORPileUp pileUp;
+  std::vector<uint8_t> waveform;
+};
+
+// Per-thread buffers for DecodeRecord, reused from record to record.
+struct ORSIS3302Scratch {
+  std::vector<UShort_t> waveform;
+  std::vector<double> sums;
+  std::vector<double> filter;
+};
+
+class ORSIS3302TreeWriter : public ORVTreeWriter
+{
+  public:
+    ORSIS3302TreeWriter(std::string treeName = "");
+    virtual ~ORSIS3302TreeWriter();
+
+    virtual EReturnCode ProcessMyDataRecord(UInt_t* record);
+    virtual EReturnCode StartRun();
+    virtual EReturnCode EndRun();
+    virtual EReturnCode EndProcessing();
+
+    virtual inline void Clear() { fEnergy = 0; fTime = 0; fStart = 0; fAmplitude = 0; }
+
+    // 0 or 1 decodes inline on the calling thread.
+    virtual void SetNThreads(size_t nThreads);
+    // Use a pool owned by the caller instead of one of our own.
+    virtual void SetWorkerPool(ORWorkerPool* pool);
+    virtual void SetColumnarOutput(const std::string& label)
+      { fColumnarLabel = label; }
+    virtual void SetFillHistograms(bool fill = true) { fFillHistograms = fill; }
+    virtual void SetStoreWaveforms(bool store = true) { fStoreWaveforms = store; }
+    // Empty set (the default) keeps every channel.
+    virtual void SetChannels(const std::set<UShort_t>& channels) { fChannels = channels; }
+    // At most kORMaxTrapezoids settings; set before the run starts.
+    virtual void SetTrapezoids(const std::vector<ORTrapezoidShaping>& shapings);
+    virtual void SetBaselineSamples(size_t nSamples) { fBaselineSamples = nSamples; }
+    virtual void SetPulseShape(bool compute = true) { fPulseShape = compute; }
+    virtual void SetTailStart(size_t nSamples) { fTailStart = nSamples; }
+    // Threshold in ADC units; 0 (the default) turns pile-up detection off.
+    virtual void SetPileUp(uint16_t threshold) { fPileUpThreshold = threshold; }
+    virtual void SetPileUpLag(size_t nSamples) { fPileUpLag = nSamples ? nSamples : 1; }
+    virtual void SetBackgroundFill(bool background = true);
+    // Charge time to the process/decode/fill/flush stages; NULL turns it off.
+    virtual void SetMetrics(ORStageMetrics* metrics) { fMetrics = metrics; }
+    // Checkpoint to path every interval seconds.  position is the reader
+    // the manager reads through; options identify the output settings.
+    virtual void SetCheckpoint(const std::string& path, double interval,
+                               const ORTimedReader* position, const std::string& options);
+    // Continue the checkpointed run from the entries saved in partialFile.
+    virtual void SetResume(const std::string& partialFile, const ORCheckpoint& checkpoint);
+    // 0 (the default) builds no events.
+    virtual void SetCoincidenceWindow(double window) { fCoincidenceWindow = window; }
+    // Directory with the run<N>_temperature_data.txt logs; "" (the default)
+    // adds no temperature.
+    virtual void SetTemperatureLogs(const std::string& dir) { fTemperatureDir = dir; }
+    virtual void SetGainTable(const ORGainTable& table) { fGainTable = table; }
+    // Shared between writers and owned by the caller; NULL (the default)
+    // publishes nothing.
+    virtual void SetLiveSpectra(ORLiveSpectra* live) { fLive = live; }
+    virtual void SetSlimSchema(bool slim = true) { fSlim = slim; }
+    // -1 (the default) keeps the output file's own setting.
+    virtual void SetCompression(int settings) { fCompression = settings; }
+    size_t GetNRecords() const { return fNRecords; }
+
+  protected:
+    struct Batch {
+      std::vector<UInt_t> records;
+      std::vector<size_t> offsets;
+      std::vector<ORSIS3302Event> events;
+      std::future<void> done;
+    };
+
+    virtual EReturnCode InitializeBranches();
+    virtual void DecodeRecord(ORSIS3302Decoder* decoder, ORSIS3302Scratch& scratch,
+                              UInt_t* record, ORSIS3302Event& event) const;
+    virtual void DecodeBatch(Batch* batch, size_t iWorker);
+    virtual void FillEvent(const ORSIS3302Event& event);
+    virtual void AccumulateEvent();
+    virtual void StoreEvent(const ORSIS3302Event& event);
+    virtual void HandOffBlock(std::vector<ORSIS3302Event>& events);
+    virtual void FinishFills();
+    virtual void FillLoop();
+    virtual void SubmitBatch();
+    virtual void DrainBatches(size_t nKeep);
+    virtual void WriteColumnarFile();
+    virtual void WriteHistograms();
+    virtual void WriteSpectra(TDirectory* dir, std::map<UShort_t, ORSpectrumAccumulator*>& spectra,
+                              const std::string& tag, double& energyMax);
+    virtual void WriteRejectedCounts();
+    virtual void WriteRunConstants();
+    virtual void Checkpoint(UInt_t* record);
+    virtual bool CopyPartialRun();
+    virtual void ReadTemperatureLog();
+    virtual void InitializeEventTree();
+    virtual void FillEvents();
+    virtual void WriteEventTree();
+
+  protected:
+    ORSIS3302Decoder* f3302Decoder;
+    double fEnergy, fTime, fStart, fAmplitude;
+    UShort_t fChannel;
+    UInt_t fPeakingTime;
+    ORSIS3302Scratch fScratch;
+    ORSIS3302Event fEvent;
+    size_t fNRecords;
+    std::set<UShort_t> fChannels;
+    ORStageMetrics* fMetrics;
+    std::map<UShort_t, Long64_t> fNRejected;
+
+    ORWorkerPool* fPool;
+    bool fOwnsPool;
+    std::vector<ORSIS3302Decoder*> fWorkerDecoders;
+    std::vector<ORSIS3302Scratch> fWorkerScratch;
+    std::deque<Batch*> fBatches;
+    Batch* fCurrentBatch;
+    size_t fBatchSize;
+    size_t fMaxBatchesInFlight;
+
+    std::string fColumnarLabel;
+    std::vector<double> fColEnergy;
+    std::vector<double> fColAmplitude;
+    std::vector<double> fColTime;
+    std::vector<UShort_t> fColChannel;
+
+    bool fFillHistograms;
+    std::map<UShort_t, ORSpectrumAccumulator*> fSpectra;
+    std::map<UShort_t, ORSpectrumAccumulator*> fPileUpSpectra;
+
+    bool fStoreWaveforms;
+    UInt_t fWaveformBytes;
+    std::vector<UChar_t> fWaveformBuffer;
+    size_t fNTraces;
+    size_t fRawTraceBytes;
+    size_t fPackedTraceBytes;
+
+    std::vector<ORTrapezoidShaping> fTrapezoids;
+    size_t fBaselineSamples;
+    double fTrapEnergy[kORMaxTrapezoids];
+
+    static const size_t kMaxFillBlocks = 2;
+    std::thread fFillThread;
+    std::mutex fFillMutex;
+    std::condition_variable fFillReady;
+    std::condition_variable fFillSpace;
+    std::deque<std::vector<ORSIS3302Event>*> fFillBlocks;
+    std::vector<ORSIS3302Event> fFillBlock;
+    bool fFillBusy;
+    bool fFillStop;
+
+    bool fPulseShape;
+    size_t fTailStart;
+    ORPulseShape fShape;
+
+    uint16_t fPileUpThreshold;
+    size_t fPileUpLag;
+    ORPileUp fPileUp;
+    UChar_t fPileUpFlag;
+    std::vector<UChar_t> fColPileUp;
+
+    std::string fCheckpointPath;
+    std::string fCheckpointOptions;
+    uint64_t fCheckpointInterval;
+    uint64_t fLastCheckpoint;
+    const ORTimedReader* fPosition;
+    uint64_t fNSeen;
+    std::string fResumeFile;
+    ORCheckpoint fResume;
+    uint64_t fNSkip;
+
+    double fCoincidenceWindow;
+    OREventBuilder fEventBuilder;
+    TTree* fEventTree;
+    double fEventTime;
+    UInt_t fMultiplicity;
+    UInt_t fChannelMask;
+    UShort_t fEventChannel[kORMaxEventHits];
+    double fEventEnergy[kORMaxEventHits];
+    double fEventAmplitude[kORMaxEventHits];
+    double fEventDt[kORMaxEventHits];
+    uint64_t fNTruncatedEvents;
+
+    std::string fTemperatureDir;
+    ORTemperatureLog fTemperatureLog;
+    ORGainTable fGainTable;
+    double fTemperature;
+    double fEnergyCorr;
+
+    static const size_t kLiveBlock = 4096;
+    ORLiveSpectra* fLive;
+    std::vector<ORHit> fLiveHits;
+
+    static const Int_t kSlimBasketSize = 256000;
+    bool fSlim;
+    int fCompression;
+    Int_t fSlimEnergy;
+    UShort_t fSlimAmplitude;
+    ULong64_t fSlimTime;
+    UChar_t fSlimChannel;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _ORSpectrumAccumulator_hh_
+#define _ORSpectrumAccumulator_hh_
+
+#include <stdint.h>
+#include <vector>
+
+/*
+Fixed-size count arrays for one channel's energy spectrum and
+amplitude-vs-energy map, filled during conversion.  The energy range isn't
+known up front, so bins start one ADC unit wide and every bin pair is
+merged (width doubled) whenever a value lands past the end.  Amplitude is
+max - min of 16-bit samples and always fits [0, 65536).
+
+Bin 0 of the energy array counts everything below 0, like a ROOT underflow
+bin; value bins are 1..kNEnergyBins.
+*/
+
+class ORSpectrumAccumulator
+{
+  public:
+    static const size_t kNEnergyBins = 65536;
+    static const size_t kNMapBins = 1024;
+    static const size_t kAmpBinWidth = 65536 / kNMapBins;
+
+    ORSpectrumAccumulator() :
+      fEnergy(kNEnergyBins + 1, 0), fEnergyWidth(1),
+      fMap(kNMapBins * kNMapBins, 0), fMapEnergyWidth(64),
+      fMaxEnergy(0), fNEntries(0) {}
+
+    void Fill(double energy, double amplitude)
+    {
+      fNEntries++;
+      if (energy > fMaxEnergy) fMaxEnergy = energy;
+      if (energy < 0) {
+        fEnergy[0]++;
+        return;
+      }
+      while (energy >= kNEnergyBins * fEnergyWidth) Merge(fEnergy, 1, kNEnergyBins, 1, fEnergyWidth);
+      fEnergy[1 + (size_t) (energy / fEnergyWidth)]++;
+
+      while (energy >= kNMapBins * fMapEnergyWidth) Merge(fMap, 0, kNMapBins, kNMapBins, fMapEnergyWidth);
+      size_t iAmp = (amplitude <= 0) ? 0 : (size_t) amplitude / kAmpBinWidth;
+      if (iAmp >= kNMapBins) iAmp = kNMapBins - 1;
+      fMap[(size_t) (energy / fMapEnergyWidth) * kNMapBins + iAmp]++;
+    }
+
+    const std::vector<uint32_t>& GetEnergyCounts() const { return fEnergy; }
+    double GetEnergyBinWidth() const { return fEnergyWidth; }
+    // Row-major: index = energyBin * kNMapBins + ampBin.
+    const std::vector<uint32_t>& GetMapCounts() const { return fMap; }
+    double GetMapEnergyBinWidth() const { return fMapEnergyWidth; }
+    double GetMaxEnergy() const { return fMaxEnergy; }
+    uint64_t GetNEntries() const { return fNEntries; }
+
+  protected:
+    // Halve the number of used bins along an axis of nBins rows, each row
+    // stride counts long, starting at first.
+    static void Merge(std::vector<uint32_t>& counts, size_t first, size_t nBins,
+                      size_t stride, double& width)
+    {
+      for (size_t i = 0; i < nBins / 2; i++) {
+        for (size_t j = 0; j < stride; j++) {
+          counts[first + i * stride + j] = counts[first + 2 * i * stride + j] +
+                                           counts[first + (2 * i + 1) * stride + j];
+        }
+      }
+      for (size_t i = nBins / 2; i < nBins; i++) {
+        for (size_t j = 0; j < stride; j++) counts[first + i * stride + j] = 0;
+      }
+      width *= 2;
+    }
+
+    std::vector<uint32_t> fEnergy;
+    double fEnergyWidth;
+    std::vector<uint32_t> fMap;
+    double fMapEnergyWidth;
+    double fMaxEnergy;
+    uint64_t fNEntries;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef _ORStageMetrics_hh_
+#define _ORStageMetrics_hh_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+Counters and timers for the stages of a conversion, so a slow run shows
+whether reading, decoding, tree filling or writing dominates.  Stages are
+inclusive: "process" (ProcessMyDataRecord) contains "decode" and "fill" on
+the serial path; with worker threads "decode" is summed over all workers
+and can exceed the wall time.
+
+Nothing is measured unless a processor is handed a metrics object: timers
+are ORStageTimer, which does nothing for a NULL pointer.  Counters are
+relaxed atomics so the optional reporting thread can read them mid-run.
+*/
+
+class ORStageMetrics
+{
+  public:
+    enum EStage { kRead, kProcess, kDecode, kFill, kFlush, kNStages };
+
+    ORStageMetrics() : fStart(Now()), fNRecords(0), fNBytes(0),
+                       fReportStop(false), fReportFile(NULL)
+    {
+      for (int i = 0; i < kNStages; i++) {
+        fCalls[i] = 0;
+        fNanoseconds[i] = 0;
+      }
+    }
+
+    virtual ~ORStageMetrics() { StopReporting(); }
+
+    static const char* StageName(int stage)
+    {
+      static const char* names[kNStages] = { "read", "process", "decode", "fill", "flush" };
+      return (stage >= 0 && stage < kNStages) ? names[stage] : "?";
+    }
+
+    static uint64_t Now()
+    {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Peak resident set size of this process, in kB.
+    static long PeakRSS()
+    {
+      struct rusage usage;
+      if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+      return usage.ru_maxrss;
+    }
+
+    void AddTime(EStage stage, uint64_t ns, uint64_t nCalls = 1)
+    {
+      fCalls[stage].fetch_add(nCalls, std::memory_order_relaxed);
+      fNanoseconds[stage].fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    void AddRecord(uint64_t nBytes)
+    {
+      fNRecords.fetch_add(1, std::memory_order_relaxed);
+      fNBytes.fetch_add(nBytes, std::memory_order_relaxed);
+    }
+
+    uint64_t GetNRecords() const { return fNRecords.load(std::memory_order_relaxed); }
+    uint64_t GetNBytes() const { return fNBytes.load(std::memory_order_relaxed); }
+    uint64_t GetCalls(EStage stage) const { return fCalls[stage].load(std::memory_order_relaxed); }
+    double GetSeconds(EStage stage) const
+      { return 1e-9 * fNanoseconds[stage].load(std::memory_order_relaxed); }
+    double GetElapsed() const { return 1e-9 * (Now() - fStart); }
+
+    // One line, no trailing newline.
+    std::string JSON(const std::string& label = "") const
+    {
+      char buf[256];
+      std::string json = "{";
+      if (label != "") json += "\"input\":\"" + label + "\",";
+      snprintf(buf, sizeof(buf), "\"elapsed\":%.3f,\"records\":%llu,\"bytes\":%llu,\"peakRSSkB\":%ld",
+               GetElapsed(), (unsigned long long) GetNRecords(),
+               (unsigned long long) GetNBytes(), PeakRSS());
+      json += buf;
+      for (int i = 0; i < kNStages; i++) {
+        snprintf(buf, sizeof(buf), ",\"%s\":{\"calls\":%llu,\"seconds\":%.6f}", StageName(i),
+                 (unsigned long long) GetCalls((EStage) i), GetSeconds((EStage) i));
+        json += buf;
+      }
+      return json + "}";
+    }
+
+    void PrintSummary(FILE* file) const
+    {
+      double elapsed = GetElapsed();
+      fprintf(file, "Stage metrics: %llu records, %.1f MB in %.2f s (%.0f records/s, %.1f MB/s), "
+              "peak RSS %.1f MB\n", (unsigned long long) GetNRecords(), GetNBytes() / 1e6, elapsed,
+              elapsed > 0 ? GetNRecords() / elapsed : 0., elapsed > 0 ? GetNBytes() / 1e6 / elapsed : 0.,
+              PeakRSS() / 1024.);
+      fprintf(file, "  %-8s %12s %10s %8s %12s\n", "stage", "calls", "seconds", "% wall", "ns/call");
+      for (int i = 0; i < kNStages; i++) {
+        uint64_t calls = GetCalls((EStage) i);
+        double seconds = GetSeconds((EStage) i);
+        fprintf(file, "  %-8s %12llu %10.3f %8.1f %12.0f\n", StageName(i), (unsigned long long) calls,
+                seconds, elapsed > 0 ? 100 * seconds / elapsed : 0., calls > 0 ? 1e9 * seconds / calls : 0.);
+      }
+      fflush(file);
+    }
+
+    // Writes JSON() as its own line to file every interval seconds until
+    // StopReporting.
+    void StartReporting(double interval, FILE* file, const std::string& label = "")
+    {
+      StopReporting();
+      fReportStop = false;
+      fReportFile = file;
+      fReportThread = std::thread(&ORStageMetrics::Report, this, interval, label);
+    }
+
+    void StopReporting()
+    {
+      {
+        std::lock_guard<std::mutex> lock(fReportMutex);
+        fReportStop = true;
+      }
+      fReportWakeUp.notify_all();
+      if (fReportThread.joinable()) fReportThread.join();
+    }
+
+  protected:
+    void Report(double interval, std::string label)
+    {
+      std::unique_lock<std::mutex> lock(fReportMutex);
+      while (!fReportStop) {
+        fReportWakeUp.wait_for(lock, std::chrono::milliseconds((long) (1000 * interval)));
+        if (fReportStop) break;
+        // A single write so lines from several --jobs children don't interleave.
+        std::string line = JSON(label) + "\n";
+        fwrite(line.data(), 1, line.size(), fReportFile);
+        fflush(fReportFile);
+      }
+    }
+
+    uint64_t fStart;
+    std::atomic<uint64_t> fNRecords;
+    std::atomic<uint64_t> fNBytes;
+    std::atomic<uint64_t> fCalls[kNStages];
+    std::atomic<uint64_t> fNanoseconds[kNStages];
+
+    std::thread fReportThread;
+    std::mutex fReportMutex;
+    std::condition_variable fReportWakeUp;
+    bool fReportStop;
+    FILE* fReportFile;
+};
+
+/* Adds the time from construction to destruction to a stage; free when
+   metrics is NULL. */
+class ORStageTimer
+{
+  public:
+    ORStageTimer(ORStageMetrics* metrics, ORStageMetrics::EStage stage, uint64_t nCalls = 1) :
+      fMetrics(metrics), fStage(stage), fNCalls(nCalls),
+      fStart(metrics ? ORStageMetrics::Now() : 0) {}
+    ~ORStageTimer()
+      { if (fMetrics) fMetrics->AddTime(fStage, ORStageMetrics::Now() - fStart, fNCalls); }
+
+  private:
+    ORStageMetrics* fMetrics;
+    ORStageMetrics::EStage fStage;
+    uint64_t fNCalls;
+    uint64_t fStart;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#include "ORStreamServer.hh"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "ORLogger.hh"
+
+using namespace std;
+
+static const uint64_t kListenId = 0;
+static const uint64_t kWakeId = ~0ULL;
+
+ORStreamServer::ORStreamServer(unsigned int port, size_t maxConnections, const Session& session) :
+  fSession(session), fMaxConnections(maxConnections ? maxConnections : 1), fPort(port),
+  fListenFd(-1), fEpollFd(-1), fWakeFd(-1), fListening(false), fStop(false),
+  fNextId(1), fBytesReceived(0), fNAccepted(0), fNFailed(0)
+{
+  fEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  fWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  fListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fEpollFd < 0 || fWakeFd < 0 || fListenFd < 0) {
+    ORLog(kError) << "Couldn't set up event loop: " << strerror(errno) << endl;
+    return;
+  }
+  int yes = 1;
+  setsockopt(fListenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(fListenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+      listen(fListenFd, 128) != 0 ||
+      getsockname(fListenFd, (struct sockaddr*) &addr, &addrLen) != 0) {
+    ORLog(kError) << "Couldn't listen on port " << port << ": " << strerror(errno) << endl;
+    close(fListenFd);
+    fListenFd = -1;
+    return;
+  }
+  fPort = ntohs(addr.sin_port);
+  Watch(fWakeFd, kWakeId, EPOLLIN, EPOLL_CTL_ADD);
+  Watch(fListenFd, kListenId, EPOLLIN, EPOLL_CTL_ADD);
+  fListening = true;
+}
+
+ORStreamServer::~ORStreamServer()
+{
+  Stop();
+  for (map<size_t, Connection*>::iterator it = fConnections.begin(); it != fConnections.end(); it++) {
+    Hangup(it->second);
+  }
+  Reap(true);
+  if (fListenFd >= 0) close(fListenFd);
+  if (fWakeFd >= 0) close(fWakeFd);
+  if (fEpollFd >= 0) close(fEpollFd);
+}
+
+void ORStreamServer::Watch(int fd, uint64_t id, uint32_t events, int op)
+{
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.u64 = id;
+  if (epoll_ctl(fEpollFd, op, fd, &event) != 0) {
+    ORLog(kError) << "epoll_ctl failed: " << strerror(errno) << endl;
+  }
+}
+
+void ORStreamServer::Wake()
+{
+  uint64_t one = 1;
+  ssize_t ignored = write(fWakeFd, &one, sizeof(one));
+  (void) ignored;
+}
+
+void ORStreamServer::Stop()
+{
+  fStop = true;
+  if (fWakeFd >= 0) Wake();
+}
+
+void ORStreamServer::Run()
+{
+  if (!IsValid()) return;
+  ORLog(kRoutine) << "Event loop listening on port " << fPort << ", up to "
+                  << fMaxConnections << " streams" << endl;
+  vector<struct epoll_event> events(64);
+  while (!fStop) {
+    // Paused connections are retried on a short timer rather than waking
+    // the loop from every session thread.
+    bool anyPaused = false;
+    for (map<size_t, Connection*>::iterator it = fConnections.begin(); it != fConnections.end(); it++) {
+      Connection* connection = it->second;
+      if (connection->paused && !Resume(connection)) anyPaused = true;
+    }
+
+    int n = epoll_wait(fEpollFd, &(events[0]), events.size(), anyPaused ? 10 : -1);
+    if (n < 0 && errno != EINTR) {
+      ORLog(kError) << "epoll_wait failed: " << strerror(errno) << endl;
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kWakeId) {
+        uint64_t count;
+        ssize_t ignored = read(fWakeFd, &count, sizeof(count));
+        (void) ignored;
+      } else if (id == kListenId) {
+        Accept();
+      } else {
+        map<size_t, Connection*>::iterator it = fConnections.find(id);
+        if (it != fConnections.end()) Receive(it->second);
+      }
+    }
+    Reap(false);
+  }
+
+  // Let every session finish what it has already been sent.
+  for (map<size_t, Connection*>::iterator it = fConnections.begin(); it != fConnections.end(); it++) {
+    Connection* connection = it->second;
+    Hangup(connection);
+  }
+  Reap(true);
+  ORLog(kRoutine) << "Event loop stopped after " << fNAccepted << " connections, "
+                  << fBytesReceived << " bytes" << endl;
+}
+
+void ORStreamServer::Accept()
+{
+  while (fConnections.size() < fMaxConnections) {
+    int fd = accept4(fListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        ORLog(kWarning) << "accept failed: " << strerror(errno) << endl;
+      }
+      return;
+    }
+    Connection* connection = new Connection;
+    connection->id = fNextId++;
+    connection->fd = fd;
+    connection->paused = false;
+    connection->reader = new ORQueueReader(kMaxChunks);
+    connection->finished = false;
+    connection->status = 0;
+    connection->nBytes = 0;
+    fConnections[connection->id] = connection;
+    fNAccepted++;
+    Watch(fd, connection->id, EPOLLIN, EPOLL_CTL_ADD);
+    connection->thread = thread(&ORStreamServer::RunSession, this, connection);
+    ORLog(kRoutine) << "Stream " << connection->id << " accepted, "
+                    << fConnections.size() << " running" << endl;
+  }
+  // Full: leave further connections in the backlog until one ends.
+  if (fListening) {
+    Watch(fListenFd, kListenId, 0, EPOLL_CTL_MOD);
+    fListening = false;
+  }
+}
+
+void ORStreamServer::RunSession(Connection* connection)
+{
+  connection->status = fSession(connection->reader, connection->id);
+  // Whatever the session left unread is dropped, and the event loop sees
+  // the cancelled queue and closes the socket.
+  connection->reader->GetQueue().Cancel();
+  connection->finished = true;
+  Wake();
+}
+
+bool ORStreamServer::PushPending(Connection* connection)
+{
+  if (connection->pending.empty()) return true;
+  return connection->reader->GetQueue().TryPush(connection->pending);
+}
+
+bool ORStreamServer::Resume(Connection* connection)
+{
+  if (!PushPending(connection)) return false;
+  connection->paused = false;
+  if (connection->fd >= 0) Watch(connection->fd, connection->id, EPOLLIN, EPOLL_CTL_MOD);
+  else connection->reader->GetQueue().Close();
+  return true;
+}
+
+void ORStreamServer::Receive(Connection* connection)
+{
+  for (size_t i = 0; i < kReadsPerWakeup && connection->fd >= 0; i++) {
+    if (!PushPending(connection)) {
+      if (connection->reader->GetQueue().IsCancelled()) {
+        Hangup(connection);
+      } else {
+        // Stop reading this socket until its session catches up.
+        connection->paused = true;
+        Watch(connection->fd, connection->id, 0, EPOLL_CTL_MOD);
+      }
+      return;
+    }
+    connection->pending.resize(kChunkSize);
+    ssize_t n = recv(connection->fd, &(connection->pending[0]), kChunkSize, 0);
+    if (n > 0) {
+      connection->pending.resize(n);
+      connection->nBytes += n;
+      fBytesReceived += n;
+      continue;
+    }
+    connection->pending.clear();
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n < 0) {
+      ORLog(kWarning) << "Stream " << connection->id << ": " << strerror(errno) << endl;
+    }
+    Hangup(connection);
+  }
+  // Don't sit on a full chunk until the next read event.
+  if (connection->fd >= 0 && !PushPending(connection)) {
+    connection->paused = true;
+    Watch(connection->fd, connection->id, 0, EPOLL_CTL_MOD);
+  }
+}
+
+void ORStreamServer::Hangup(Connection* connection)
+{
+  if (connection->fd < 0) return;
+  epoll_ctl(fEpollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+  close(connection->fd);
+  connection->fd = -1;
+  // A chunk still waiting for room goes in before the queue is closed.
+  if (connection->reader->GetQueue().IsCancelled()) connection->pending.clear();
+  connection->paused = !connection->pending.empty();
+  if (!connection->paused) connection->reader->GetQueue().Close();
+}
+
+void ORStreamServer::Reap(bool wait)
+{
+  map<size_t, Connection*>::iterator it = fConnections.begin();
+  while (it != fConnections.end()) {
+    Connection* connection = it->second;
+    if (!connection->finished && !wait) {
+      it++;
+      continue;
+    }
+    if (connection->paused && connection->fd < 0) {
+      // Hung up with a chunk still to deliver; the session will take it.
+      connection->reader->GetQueue().Push(connection->pending);
+      connection->reader->GetQueue().Close();
+      connection->paused = false;
+    }
+    connection->thread.join();
+    Hangup(connection);
+    if (connection->status != 0) fNFailed++;
+    ORLog(kRoutine) << "Stream " << connection->id << " finished with status "
+                    << connection->status << " after " << connection->nBytes << " bytes" << endl;
+    delete connection->reader;
+    delete connection;
+    fConnections.erase(it++);
+  }
+  if (!fListening && !fStop && fConnections.size() < fMaxConnections) {
+    Watch(fListenFd, kListenId, EPOLLIN, EPOLL_CTL_MOD);
+    fListening = true;
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef _ORStreamServer_hh_
+#define _ORStreamServer_hh_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "ORQueueReader.hh"
+
+/*
+Daemon that takes many ORCA socket streams in one process.  A single epoll
+loop accepts connections and reads from every socket into that connection's
+ORQueueReader; each connection's session (normally an ORDataProcManager
+pulling from the reader) runs on its own thread.  Decoding work can be
+shared between sessions by giving their tree writers one ORWorkerPool.
+
+Connections are isolated: if a session falls behind, its queue fills and
+only that socket stops being read (the sender sees TCP back-pressure);
+the other streams keep going.  When a session ends or fails, its queue is
+cancelled and its socket closed without touching the rest.
+*/
+
+class ORStreamServer
+{
+  public:
+    // Called on a fresh thread per connection; the return value is logged
+    // as the connection's status.
+    typedef std::function<int(ORVReader*, size_t)> Session;
+
+    // Port 0 picks a free port; see GetPort.
+    ORStreamServer(unsigned int port, size_t maxConnections, const Session& session);
+    virtual ~ORStreamServer();
+
+    virtual bool IsValid() const { return fListenFd >= 0 && fEpollFd >= 0 && fWakeFd >= 0; }
+    virtual unsigned int GetPort() const { return fPort; }
+
+    // Serves until Stop(), then lets the running sessions finish what they
+    // have received.
+    virtual void Run();
+    // Safe to call from any thread or a signal handler.
+    virtual void Stop();
+
+    uint64_t GetBytesReceived() const { return fBytesReceived; }
+    size_t GetNAccepted() const { return fNAccepted; }
+    size_t GetNFailed() const { return fNFailed; }
+
+  protected:
+    struct Connection {
+      size_t id;
+      int fd;
+      bool paused;
+      ORQueueReader* reader;
+      std::vector<char> pending;
+      std::thread thread;
+      std::atomic<bool> finished;
+      int status;
+      uint64_t nBytes;
+    };
+
+    virtual void Accept();
+    virtual void Receive(Connection* connection);
+    virtual bool PushPending(Connection* connection);
+    virtual bool Resume(Connection* connection);
+    virtual void Hangup(Connection* connection);
+    virtual void Reap(bool wait);
+    virtual void RunSession(Connection* connection);
+    virtual void Watch(int fd, uint64_t id, uint32_t events, int op);
+    virtual void Wake();
+
+    static const size_t kChunkSize = 256 * 1024;
+    static const size_t kMaxChunks = 16;
+    // Chunks read from one socket before looking at the others.
+    static const size_t kReadsPerWakeup = 4;
+
+    Session fSession;
+    size_t fMaxConnections;
+    unsigned int fPort;
+    int fListenFd;
+    int fEpollFd;
+    int fWakeFd;
+    bool fListening;
+    std::atomic<bool> fStop;
+
+    std::map<size_t, Connection*> fConnections;
+    size_t fNextId;
+    uint64_t fBytesReceived;
+    size_t fNAccepted;
+    size_t fNFailed;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef _ORTemperatureLog_hh_
+#define _ORTemperatureLog_hh_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+A run's temperature log, as characterization_run.py writes it: one
+"unix-time temperature" line about every second, in
+run<N>_temperature_data.txt.
+
+ORTemperatureLog::At joins the log onto hits.  Hits come nearly in time
+order (in order within a channel, channels interleaved in readout blocks),
+so rather than searching the log for every hit, a cursor is walked to the
+two readings around the hit and the temperature is interpolated linearly
+between them.  The cursor only steps back over the few readings a block
+boundary jumps, so a whole run costs O(hits + readings).  Before the first
+reading or after the last, the nearest reading is used.
+
+ORGainTable holds per-channel temperature coefficients of the gain, read
+from a text file of "channel coefficient reference" lines ('#' starts a
+comment).  The gain relative to that at the reference temperature is
+1 + coefficient * (T - reference), and Correct divides it out.
+*/
+
+class ORTemperatureLog
+{
+  public:
+    ORTemperatureLog() : fCursor(0) {}
+
+    static std::string LogPath(const std::string& dir, unsigned runNumber)
+    {
+      std::ostringstream path;
+      path << dir << "/run" << runNumber << "_temperature_data.txt";
+      return path.str();
+    }
+
+    // False if the file can't be read or has no readings.
+    bool Read(const std::string& path)
+    {
+      fReadings.clear();
+      fCursor = 0;
+      std::ifstream file(path.c_str());
+      std::string line;
+      while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::pair<double, double> reading;
+        if (fields >> reading.first >> reading.second) fReadings.push_back(reading);
+      }
+      // The logger appends in time order; only a hand-edited file needs this.
+      if (!std::is_sorted(fReadings.begin(), fReadings.end())) {
+        std::stable_sort(fReadings.begin(), fReadings.end());
+      }
+      return !fReadings.empty();
+    }
+
+    size_t GetNReadings() const { return fReadings.size(); }
+    double GetStartTime() const { return fReadings.empty() ? 0 : fReadings.front().first; }
+    double GetEndTime() const { return fReadings.empty() ? 0 : fReadings.back().first; }
+
+    // Temperature at unix time t; NaN without readings.
+    double At(double t)
+    {
+      if (fReadings.empty()) return NAN;
+      size_t n = fReadings.size();
+      while (fCursor + 1 < n && fReadings[fCursor + 1].first <= t) fCursor++;
+      while (fCursor > 0 && fReadings[fCursor].first > t) fCursor--;
+      const std::pair<double, double>& before = fReadings[fCursor];
+      if (t <= before.first || fCursor + 1 == n) return before.second;
+      const std::pair<double, double>& after = fReadings[fCursor + 1];
+      return before.second + (t - before.first) / (after.first - before.first) *
+                             (after.second - before.second);
+    }
+
+  protected:
+    std::vector<std::pair<double, double> > fReadings;
+    size_t fCursor;
+};
+
+class ORGainTable
+{
+  public:
+    // False if the file can't be read or a line doesn't parse.
+    bool Read(const std::string& path)
+    {
+      fCoefficients.clear();
+      std::ifstream file(path.c_str());
+      if (!file) return false;
+      std::string line;
+      while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        unsigned channel;
+        std::pair<double, double> entry;
+        if (!(fields >> channel)) {
+          if (line.find_first_not_of(" \t\r") != std::string::npos) return false;
+          continue;
+        }
+        if (!(fields >> entry.first >> entry.second)) return false;
+        fCoefficients[channel] = entry;
+      }
+      return true;
+    }
+
+    bool IsEmpty() const { return fCoefficients.empty(); }
+
+    // energy as it would read at the channel's reference temperature;
+    // unchanged for channels not in the table or without a temperature.
+    double Correct(unsigned channel, double energy, double temperature) const
+    {
+      std::map<unsigned, std::pair<double, double> >::const_iterator it = fCoefficients.find(channel);
+      if (it == fCoefficients.end() || std::isnan(temperature)) return energy;
+      return energy / (1 + it->second.first * (temperature - it->second.second));
+    }
+
+  protected:
+    // channel -> (coefficient per degree, reference temperature)
+    std::map<unsigned, std::pair<double, double> > fCoefficients;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#include "ORTimedReader.hh"
+
+bool ORTimedReader::ReadRecord(UInt_t*& buffer, size_t& nLongsMax)
+{
+  uint64_t start = fMetrics ? ORStageMetrics::Now() : 0;
+  bool ok = fReader->ReadRecord(buffer, nLongsMax);
+  if (fMetrics) fMetrics->AddTime(ORStageMetrics::kRead, ORStageMetrics::Now() - start);
+  if (!ok) return false;
+  uint64_t nBytes = LengthOf(buffer) * sizeof(UInt_t);
+  if (fMetrics) fMetrics->AddRecord(nBytes);
+  fNRecords.fetch_add(1, std::memory_order_relaxed);
+  fNBytes.fetch_add(nBytes, std::memory_order_relaxed);
+  return true;
+}
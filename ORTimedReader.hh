@@ -0,0 +1,47 @@
+#ifndef _ORTimedReader_hh_
+#define _ORTimedReader_hh_
+
+#include <atomic>
+
+#include "ORStageMetrics.hh"
+#include "ORVReader.hh"
+
+/*
+Wraps another reader and charges every ReadRecord call to the "read" stage
+of an ORStageMetrics, counting records and bytes on the way.  The wrapped
+reader keeps doing the real work (and keeps ownership of its buffers); it
+is not deleted here.
+
+The record and byte counts are kept even without metrics (NULL), so the
+wrapper also tells the checkpointing code how far into the raw stream the
+processors have got.
+*/
+
+class ORTimedReader : public ORVReader
+{
+  public:
+    ORTimedReader(ORVReader* reader, ORStageMetrics* metrics) :
+      fReader(reader), fMetrics(metrics), fNRecords(0), fNBytes(0) {}
+    virtual ~ORTimedReader() {}
+
+    virtual bool OKToRead() { return fReader->OKToRead(); }
+    virtual bool OpenDataStream() { return fReader->OpenDataStream(); }
+    virtual void CloseDataStream() { fReader->CloseDataStream(); }
+    virtual bool MustSwap() { return fReader->MustSwap(); }
+    virtual bool ReadRecord(UInt_t*& buffer, size_t& nLongsMax);
+
+    // Records and bytes returned so far, the current record included.
+    uint64_t GetNRecordsRead() const { return fNRecords.load(std::memory_order_relaxed); }
+    uint64_t GetBytesRead() const { return fNBytes.load(std::memory_order_relaxed); }
+
+  protected:
+    // Everything goes through the wrapped reader's ReadRecord.
+    virtual size_t Read(char*, size_t) { return 0; }
+
+    ORVReader* fReader;
+    ORStageMetrics* fMetrics;
+    std::atomic<uint64_t> fNRecords;
+    std::atomic<uint64_t> fNBytes;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef _ORWaveformCodec_hh_
+#define _ORWaveformCodec_hh_
+
+/*
+Lossless compact encoding for 16-bit SIS3302 traces.
+
+Each sample is replaced by its difference from the previous one (the first
+by its difference from zero), zigzag-mapped so small negative steps become
+small unsigned numbers, and the results are bit-packed in blocks of
+kORWaveformBlock values.  Each block starts with one byte giving the bit
+width of that block (0-17); the packed bits follow, least significant bit
+first.  A trace is:
+
+  uint16 nSamples (little endian)
+  blocks...
+
+Baseline noise of a few ADC counts packs into 3-5 bits per sample instead
+of 16.  Pure C++, so ROOT macros can include this file to decode the
+"waveform" branch.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+static const size_t kORWaveformBlock = 32;
+
+inline uint32_t ORZigZag(int32_t d) { return ((uint32_t) d << 1) ^ (uint32_t) (d >> 31); }
+inline int32_t ORUnZigZag(uint32_t z) { return (int32_t) (z >> 1) ^ -(int32_t) (z & 1); }
+
+/* Upper bound on the encoded size of an n-sample trace. */
+inline size_t ORWaveformMaxEncodedSize(size_t n)
+{
+  size_t nBlocks = (n + kORWaveformBlock - 1) / kORWaveformBlock;
+  return 2 + nBlocks * (1 + (kORWaveformBlock * 17 + 7) / 8);
+}
+
+/* Encodes n samples, replacing the contents of out.  Returns out.size(). */
+inline size_t OREncodeWaveform(const uint16_t* samples, size_t n, std::vector<uint8_t>& out)
+{
+  if (n > 0xFFFF) n = 0xFFFF;
+  out.resize(ORWaveformMaxEncodedSize(n));
+  uint8_t* p = &(out[0]);
+  *p++ = n & 0xFF;
+  *p++ = n >> 8;
+
+  uint32_t z[kORWaveformBlock];
+  int32_t prev = 0;
+  for (size_t start = 0; start < n; start += kORWaveformBlock) {
+    size_t k = (n - start < kORWaveformBlock) ? n - start : kORWaveformBlock;
+    uint32_t all = 0;
+    for (size_t i = 0; i < k; i++) {
+      int32_t s = samples[start + i];
+      z[i] = ORZigZag(s - prev);
+      prev = s;
+      all |= z[i];
+    }
+    uint32_t width = 0;
+    while (width < 32 && (all >> width) != 0) width++;
+    *p++ = (uint8_t) width;
+
+    uint64_t acc = 0;
+    uint32_t nBits = 0;
+    for (size_t i = 0; i < k; i++) {
+      acc |= (uint64_t) z[i] << nBits;
+      nBits += width;
+      while (nBits >= 8) {
+        *p++ = (uint8_t) acc;
+        acc >>= 8;
+        nBits -= 8;
+      }
+    }
+    if (nBits > 0) *p++ = (uint8_t) acc;
+  }
+  out.resize(p - &(out[0]));
+  return out.size();
+}
+
+/* Number of samples in an encoded trace, or 0 if it is too short to say. */
+inline size_t ORWaveformEncodedLength(const uint8_t* in, size_t nBytes)
+{
+  return (nBytes < 2) ? 0 : (size_t) in[0] | ((size_t) in[1] << 8);
+}
+
+/* Decodes into out (room for maxSamples).  Returns the number of samples
+   written, or 0 if the input is malformed or out is too small. */
+inline size_t ORDecodeWaveform(const uint8_t* in, size_t nBytes, uint16_t* out, size_t maxSamples)
+{
+  size_t n = ORWaveformEncodedLength(in, nBytes);
+  if (n > maxSamples) return 0;
+  const uint8_t* p = in + 2;
+  const uint8_t* end = in + nBytes;
+  int32_t prev = 0;
+  for (size_t start = 0; start < n; start += kORWaveformBlock) {
+    size_t k = (n - start < kORWaveformBlock) ? n - start : kORWaveformBlock;
+    if (p >= end) return 0;
+    uint32_t width = *p++;
+    if (width > 17) return 0;
+    size_t blockBytes = (k * width + 7) / 8;
+    if (p + blockBytes > end) return 0;
+    uint32_t mask = (width == 0) ? 0 : (uint32_t) ((1ULL << width) - 1);
+
+    size_t bitPos = 0;
+    for (size_t i = 0; i < k; i++) {
+      const uint8_t* q = p + (bitPos >> 3);
+      uint64_t word;
+      if ((size_t) (end - q) >= 8) {
+        memcpy(&word, q, 8);
+      } else {
+        word = 0;
+        for (size_t b = 0; q + b < end; b++) word |= (uint64_t) q[b] << (8 * b);
+      }
+      uint32_t zz = (uint32_t) (word >> (bitPos & 7)) & mask;
+      bitPos += width;
+      prev += ORUnZigZag(zz);
+      out[start + i] = (uint16_t) prev;
+    }
+    p += blockBytes;
+  }
+  return n;
+}
+
+#endif
@@ -0,0 +1,687 @@
+#ifndef _ORWaveformKernels_hh_
+#define _ORWaveformKernels_hh_
+
+/*
+Inner loops over raw SIS3302 traces, kept free of ROOT/ORCA types so they can
+be vectorized.  Samples are the packed 16-bit ADC values as they sit in the
+record; nothing here converts to double.
+
+x86-64 always has SSE2, so that is the baseline path.  AVX2 is picked at
+runtime (once) when the CPU supports it; other architectures use the scalar
+loop.
+*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OR_WAVEFORM_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*ORWaveformMinMaxFn)(const uint16_t*, size_t, uint16_t&, uint16_t&);
+
+inline void ORWaveformMinMaxScalar(const uint16_t* samples, size_t n,
+                                   uint16_t& min, uint16_t& max)
+{
+  uint16_t lo = 0xFFFF;
+  uint16_t hi = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+  }
+  min = lo;
+  max = hi;
+}
+
+#ifdef OR_WAVEFORM_X86
+inline void ORWaveformMinMaxSSE2(const uint16_t* samples, size_t n,
+                                 uint16_t& min, uint16_t& max)
+{
+  // SSE2 only has signed 16-bit min/max: flip the sign bit going in and out.
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  __m128i vmin = _mm_set1_epi16(0x7FFF);
+  __m128i vmax = _mm_set1_epi16((short) 0x8000);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (samples + i)), bias);
+    vmin = _mm_min_epi16(vmin, v);
+    vmax = _mm_max_epi16(vmax, v);
+  }
+  int16_t lanes[16];
+  _mm_storeu_si128((__m128i*) lanes, _mm_xor_si128(vmin, bias));
+  _mm_storeu_si128((__m128i*) (lanes + 8), _mm_xor_si128(vmax, bias));
+  uint16_t lo = 0xFFFF;
+  uint16_t hi = 0;
+  for (int k = 0; k < 8; k++) {
+    if ((uint16_t) lanes[k] < lo) lo = (uint16_t) lanes[k];
+    if ((uint16_t) lanes[k + 8] > hi) hi = (uint16_t) lanes[k + 8];
+  }
+  for (; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+  }
+  min = lo;
+  max = hi;
+}
+
+__attribute__((target("avx2")))
+inline void ORWaveformMinMaxAVX2(const uint16_t* samples, size_t n,
+                                 uint16_t& min, uint16_t& max)
+{
+  __m256i vmin = _mm256_set1_epi16((short) 0xFFFF);
+  __m256i vmax = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (samples + i));
+    vmin = _mm256_min_epu16(vmin, v);
+    vmax = _mm256_max_epu16(vmax, v);
+  }
+  uint16_t lanes[32];
+  _mm256_storeu_si256((__m256i*) lanes, vmin);
+  _mm256_storeu_si256((__m256i*) (lanes + 16), vmax);
+  uint16_t lo = 0xFFFF;
+  uint16_t hi = 0;
+  for (int k = 0; k < 16; k++) {
+    if (lanes[k] < lo) lo = lanes[k];
+    if (lanes[k + 16] > hi) hi = lanes[k + 16];
+  }
+  for (; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+  }
+  min = lo;
+  max = hi;
+}
+#endif
+
+inline ORWaveformMinMaxFn ORSelectWaveformMinMax()
+{
+#ifdef OR_WAVEFORM_X86
+  if (__builtin_cpu_supports("avx2")) return ORWaveformMinMaxAVX2;
+  return ORWaveformMinMaxSSE2;
+#else
+  return ORWaveformMinMaxScalar;
+#endif
+}
+
+inline void ORWaveformMinMax(const uint16_t* samples, size_t n,
+                             uint16_t& min, uint16_t& max)
+{
+  static const ORWaveformMinMaxFn kernel = ORSelectWaveformMinMax();
+  kernel(samples, n, min, max);
+}
+
+
+/*
+Min, max and sum in one pass, for the pulse-shape features.  Sums go through
+32-bit lanes, which can't overflow for the 16-bit sample counts the SIS3302
+records.
+*/
+
+typedef void (*ORWaveformMinMaxSumFn)(const uint16_t*, size_t, uint16_t&, uint16_t&, uint64_t&);
+
+inline void ORWaveformMinMaxSumScalar(const uint16_t* samples, size_t n,
+                                      uint16_t& min, uint16_t& max, uint64_t& sum)
+{
+  ORWaveformMinMaxScalar(samples, n, min, max);
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; i++) total += samples[i];
+  sum = total;
+}
+
+#ifdef OR_WAVEFORM_X86
+inline void ORWaveformMinMaxSumSSE2(const uint16_t* samples, size_t n,
+                                    uint16_t& min, uint16_t& max, uint64_t& sum)
+{
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i vmin = _mm_set1_epi16(0x7FFF);
+  __m128i vmax = _mm_set1_epi16((short) 0x8000);
+  __m128i vsum = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i raw = _mm_loadu_si128((const __m128i*) (samples + i));
+    __m128i v = _mm_xor_si128(raw, bias);
+    vmin = _mm_min_epi16(vmin, v);
+    vmax = _mm_max_epi16(vmax, v);
+    vsum = _mm_add_epi32(vsum, _mm_add_epi32(_mm_unpacklo_epi16(raw, zero),
+                                             _mm_unpackhi_epi16(raw, zero)));
+  }
+  int16_t lanes[16];
+  uint32_t sums[4];
+  _mm_storeu_si128((__m128i*) lanes, _mm_xor_si128(vmin, bias));
+  _mm_storeu_si128((__m128i*) (lanes + 8), _mm_xor_si128(vmax, bias));
+  _mm_storeu_si128((__m128i*) sums, vsum);
+  uint16_t lo = 0xFFFF;
+  uint16_t hi = 0;
+  for (int k = 0; k < 8; k++) {
+    if ((uint16_t) lanes[k] < lo) lo = (uint16_t) lanes[k];
+    if ((uint16_t) lanes[k + 8] > hi) hi = (uint16_t) lanes[k + 8];
+  }
+  uint64_t total = (uint64_t) sums[0] + sums[1] + sums[2] + sums[3];
+  for (; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+    total += samples[i];
+  }
+  min = lo;
+  max = hi;
+  sum = total;
+}
+
+__attribute__((target("avx2")))
+inline void ORWaveformMinMaxSumAVX2(const uint16_t* samples, size_t n,
+                                    uint16_t& min, uint16_t& max, uint64_t& sum)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i vmin = _mm256_set1_epi16((short) 0xFFFF);
+  __m256i vmax = _mm256_setzero_si256();
+  __m256i vsum = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (samples + i));
+    vmin = _mm256_min_epu16(vmin, v);
+    vmax = _mm256_max_epu16(vmax, v);
+    vsum = _mm256_add_epi32(vsum, _mm256_add_epi32(_mm256_unpacklo_epi16(v, zero),
+                                                   _mm256_unpackhi_epi16(v, zero)));
+  }
+  uint16_t lanes[32];
+  uint32_t sums[8];
+  _mm256_storeu_si256((__m256i*) lanes, vmin);
+  _mm256_storeu_si256((__m256i*) (lanes + 16), vmax);
+  _mm256_storeu_si256((__m256i*) sums, vsum);
+  uint16_t lo = 0xFFFF;
+  uint16_t hi = 0;
+  for (int k = 0; k < 16; k++) {
+    if (lanes[k] < lo) lo = lanes[k];
+    if (lanes[k + 16] > hi) hi = lanes[k + 16];
+  }
+  uint64_t total = 0;
+  for (int k = 0; k < 8; k++) total += sums[k];
+  for (; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+    total += samples[i];
+  }
+  min = lo;
+  max = hi;
+  sum = total;
+}
+#endif
+
+inline ORWaveformMinMaxSumFn ORSelectWaveformMinMaxSum()
+{
+#ifdef OR_WAVEFORM_X86
+  if (__builtin_cpu_supports("avx2")) return ORWaveformMinMaxSumAVX2;
+  return ORWaveformMinMaxSumSSE2;
+#else
+  return ORWaveformMinMaxSumScalar;
+#endif
+}
+
+inline void ORWaveformMinMaxSum(const uint16_t* samples, size_t n,
+                                uint16_t& min, uint16_t& max, uint64_t& sum)
+{
+  static const ORWaveformMinMaxSumFn kernel = ORSelectWaveformMinMaxSum();
+  kernel(samples, n, min, max, sum);
+}
+
+inline uint64_t ORWaveformSum(const uint16_t* samples, size_t n)
+{
+  uint16_t min, max;
+  uint64_t sum;
+  ORWaveformMinMaxSum(samples, n, min, max, sum);
+  return sum;
+}
+
+/*
+Pile-up search in the same pass as min, max and sum.  The derivative is
+taken over lag samples, d[i] = x[i] - x[i - lag] (saturating at +-32767),
+and a pulse edge is where d rises above threshold.  Another edge only
+counts once d has dropped back below threshold / 2 since the last one, so
+noise on one slow edge isn't taken for a second pulse; an edge already
+under way at the start of the trace isn't counted.  Edge times are the
+first sample past the threshold, from the start of the trace.
+*/
+
+struct ORPileUp {
+  uint16_t nEdges;
+  uint16_t firstTime;
+  uint16_t secondTime;   // 0 unless nEdges > 1
+};
+
+typedef void (*ORWaveformPileUpScanFn)(const uint16_t*, size_t, size_t, int16_t,
+                                       uint16_t&, uint16_t&, uint64_t&, ORPileUp&);
+
+inline void ORPileUpEdge(size_t i, ORPileUp& pileUp)
+{
+  uint16_t t = (i > 0xFFFF) ? 0xFFFF : i;
+  if (pileUp.nEdges == 0) pileUp.firstTime = t;
+  else if (pileUp.nEdges == 1) pileUp.secondTime = t;
+  if (pileUp.nEdges < 0xFFFF) pileUp.nEdges++;
+}
+
+/* Runs the edge state machine over a block of samples starting at base:
+   bit k of above/below is set if d[base + k] is above threshold / below
+   threshold / 2.  Blocks with nothing to change are one test. */
+inline void ORPileUpBlock(uint32_t above, uint32_t below, size_t base, bool& armed, ORPileUp& pileUp)
+{
+  while (true) {
+    uint32_t bits = armed ? above : below;
+    if (bits == 0) return;
+    int k = __builtin_ctz(bits);
+    if (armed) ORPileUpEdge(base + k, pileUp);
+    armed = !armed;
+    uint32_t later = (k >= 31) ? 0 : (~0U << (k + 1));
+    above &= later;
+    below &= later;
+  }
+}
+
+inline void ORWaveformPileUpScanScalar(const uint16_t* samples, size_t n, size_t lag, int16_t threshold,
+                                       uint16_t& min, uint16_t& max, uint64_t& sum, ORPileUp& pileUp)
+{
+  ORWaveformMinMaxSumScalar(samples, n, min, max, sum);
+  pileUp.nEdges = pileUp.firstTime = pileUp.secondTime = 0;
+  bool armed = false;
+  for (size_t i = lag; i < n; i++) {
+    int d = (int) samples[i] - (int) samples[i - lag];
+    if (d > 32767) d = 32767;
+    if (d < -32768) d = -32768;
+    ORPileUpBlock(d > threshold, d < threshold / 2, i, armed, pileUp);
+  }
+}
+
+#ifdef OR_WAVEFORM_X86
+inline void ORWaveformPileUpScanSSE2(const uint16_t* samples, size_t n, size_t lag, int16_t threshold,
+                                     uint16_t& min, uint16_t& max, uint64_t& sum, ORPileUp& pileUp)
+{
+  pileUp.nEdges = pileUp.firstTime = pileUp.secondTime = 0;
+  if (n < lag + 8) {
+    ORWaveformPileUpScanScalar(samples, n, lag, threshold, min, max, sum, pileUp);
+    return;
+  }
+  // The first lag samples have no derivative; only min, max and sum.
+  uint16_t lo, hi;
+  uint64_t total;
+  ORWaveformMinMaxSumScalar(samples, lag, lo, hi, total);
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i vAbove = _mm_set1_epi16(threshold);
+  const __m128i vBelow = _mm_set1_epi16(threshold / 2);
+  __m128i vmin = _mm_set1_epi16(0x7FFF);
+  __m128i vmax = _mm_set1_epi16((short) 0x8000);
+  __m128i vsum = _mm_setzero_si128();
+  bool armed = false;
+  size_t i = lag;
+  for (; i + 8 <= n; i += 8) {
+    __m128i raw = _mm_loadu_si128((const __m128i*) (samples + i));
+    __m128i v = _mm_xor_si128(raw, bias);
+    __m128i then = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (samples + i - lag)), bias);
+    vmin = _mm_min_epi16(vmin, v);
+    vmax = _mm_max_epi16(vmax, v);
+    vsum = _mm_add_epi32(vsum, _mm_add_epi32(_mm_unpacklo_epi16(raw, zero),
+                                             _mm_unpackhi_epi16(raw, zero)));
+    // Both signed after the bias, so the saturating difference is exact.
+    __m128i d = _mm_subs_epi16(v, then);
+    uint32_t mask = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(d, vAbove),
+                                                      _mm_cmplt_epi16(d, vBelow)));
+    if ((mask & (armed ? 0x00FFU : 0xFF00U)) == 0) continue;
+    ORPileUpBlock(mask & 0xFF, mask >> 8, i, armed, pileUp);
+  }
+  int16_t lanes[16];
+  uint32_t sums[4];
+  _mm_storeu_si128((__m128i*) lanes, _mm_xor_si128(vmin, bias));
+  _mm_storeu_si128((__m128i*) (lanes + 8), _mm_xor_si128(vmax, bias));
+  _mm_storeu_si128((__m128i*) sums, vsum);
+  for (int k = 0; k < 8; k++) {
+    if ((uint16_t) lanes[k] < lo) lo = (uint16_t) lanes[k];
+    if ((uint16_t) lanes[k + 8] > hi) hi = (uint16_t) lanes[k + 8];
+  }
+  total += (uint64_t) sums[0] + sums[1] + sums[2] + sums[3];
+  for (; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+    total += samples[i];
+    int d = (int) samples[i] - (int) samples[i - lag];
+    if (d > 32767) d = 32767;
+    if (d < -32768) d = -32768;
+    ORPileUpBlock(d > threshold, d < threshold / 2, i, armed, pileUp);
+  }
+  min = lo;
+  max = hi;
+  sum = total;
+}
+
+__attribute__((target("avx2")))
+inline void ORWaveformPileUpScanAVX2(const uint16_t* samples, size_t n, size_t lag, int16_t threshold,
+                                     uint16_t& min, uint16_t& max, uint64_t& sum, ORPileUp& pileUp)
+{
+  pileUp.nEdges = pileUp.firstTime = pileUp.secondTime = 0;
+  if (n < lag + 16) {
+    ORWaveformPileUpScanScalar(samples, n, lag, threshold, min, max, sum, pileUp);
+    return;
+  }
+  uint16_t lo, hi;
+  uint64_t total;
+  ORWaveformMinMaxSumScalar(samples, lag, lo, hi, total);
+  const __m256i bias = _mm256_set1_epi16((short) 0x8000);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i vAbove = _mm256_set1_epi16(threshold);
+  const __m256i vBelow = _mm256_set1_epi16(threshold / 2);
+  __m256i vmin = _mm256_set1_epi16((short) 0xFFFF);
+  __m256i vmax = _mm256_setzero_si256();
+  __m256i vsum = _mm256_setzero_si256();
+  bool armed = false;
+  size_t i = lag;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (samples + i));
+    __m256i then = _mm256_loadu_si256((const __m256i*) (samples + i - lag));
+    vmin = _mm256_min_epu16(vmin, v);
+    vmax = _mm256_max_epu16(vmax, v);
+    vsum = _mm256_add_epi32(vsum, _mm256_add_epi32(_mm256_unpacklo_epi16(v, zero),
+                                                   _mm256_unpackhi_epi16(v, zero)));
+    __m256i d = _mm256_subs_epi16(_mm256_xor_si256(v, bias), _mm256_xor_si256(then, bias));
+    // packs works per 128-bit half: bytes are above 0-7, below 0-7,
+    // above 8-15, below 8-15.
+    uint32_t mask = _mm256_movemask_epi8(_mm256_packs_epi16(_mm256_cmpgt_epi16(d, vAbove),
+                                                            _mm256_cmpgt_epi16(vBelow, d)));
+    if ((mask & (armed ? 0x00FF00FFU : 0xFF00FF00U)) == 0) continue;
+    uint32_t above = (mask & 0xFF) | ((mask >> 8) & 0xFF00);
+    uint32_t below = ((mask >> 8) & 0xFF) | ((mask >> 16) & 0xFF00);
+    ORPileUpBlock(above, below, i, armed, pileUp);
+  }
+  uint16_t lanes[32];
+  uint32_t sums[8];
+  _mm256_storeu_si256((__m256i*) lanes, vmin);
+  _mm256_storeu_si256((__m256i*) (lanes + 16), vmax);
+  _mm256_storeu_si256((__m256i*) sums, vsum);
+  for (int k = 0; k < 16; k++) {
+    if (lanes[k] < lo) lo = lanes[k];
+    if (lanes[k + 16] > hi) hi = lanes[k + 16];
+  }
+  for (int k = 0; k < 8; k++) total += sums[k];
+  for (; i < n; i++) {
+    if (samples[i] < lo) lo = samples[i];
+    if (samples[i] > hi) hi = samples[i];
+    total += samples[i];
+    int d = (int) samples[i] - (int) samples[i - lag];
+    if (d > 32767) d = 32767;
+    if (d < -32768) d = -32768;
+    ORPileUpBlock(d > threshold, d < threshold / 2, i, armed, pileUp);
+  }
+  min = lo;
+  max = hi;
+  sum = total;
+}
+#endif
+
+inline ORWaveformPileUpScanFn ORSelectWaveformPileUpScan()
+{
+#ifdef OR_WAVEFORM_X86
+  if (__builtin_cpu_supports("avx2")) return ORWaveformPileUpScanAVX2;
+  return ORWaveformPileUpScanSSE2;
+#else
+  return ORWaveformPileUpScanScalar;
+#endif
+}
+
+/* lag > 0, threshold > 0 (in ADC units over lag samples). */
+inline void ORWaveformPileUpScan(const uint16_t* samples, size_t n, size_t lag, int16_t threshold,
+                                 uint16_t& min, uint16_t& max, uint64_t& sum, ORPileUp& pileUp)
+{
+  static const ORWaveformPileUpScanFn kernel = ORSelectWaveformPileUpScan();
+  kernel(samples, n, lag, threshold, min, max, sum, pileUp);
+}
+
+/*
+Pulse-shape features of one trace.  Times are in samples from the start of
+the trace.  The rise time is between the 10% and 90% crossings of
+(max - baseline), walking back from the maximum and interpolating linearly.
+The tail ratio is the baseline-subtracted integral from tailStart samples
+after the maximum to the end, over the integral from the 10% crossing to
+the end.
+*/
+
+struct ORPulseShape {
+  double baselineMean;
+  double baselineRMS;
+  double riseTime;
+  double tailRatio;
+  uint16_t maxTime;
+};
+
+/* max and sum come from ORWaveformMinMaxSum over the whole trace. */
+inline void ORWaveformPulseShape(const uint16_t* samples, size_t n, size_t nBaseline,
+                                 size_t tailStart, uint16_t max, uint64_t sum,
+                                 ORPulseShape& shape)
+{
+  shape.baselineMean = 0;
+  shape.baselineRMS = 0;
+  shape.riseTime = 0;
+  shape.tailRatio = 0;
+  shape.maxTime = 0;
+  if (n == 0) return;
+
+  if (nBaseline > n) nBaseline = n;
+  if (nBaseline > 0) {
+    double bSum = 0, bSum2 = 0;
+    for (size_t i = 0; i < nBaseline; i++) {
+      double x = samples[i];
+      bSum += x;
+      bSum2 += x * x;
+    }
+    shape.baselineMean = bSum / nBaseline;
+    double var = bSum2 / nBaseline - shape.baselineMean * shape.baselineMean;
+    shape.baselineRMS = (var > 0) ? sqrt(var) : 0;
+  }
+  double baseline = shape.baselineMean;
+
+  size_t iMax = 0;
+  while (iMax < n && samples[iMax] != max) iMax++;
+  shape.maxTime = (iMax > 0xFFFF) ? 0xFFFF : iMax;
+  double height = max - baseline;
+  if (height <= 0) return;
+
+  // Last sample below each level before the maximum; the crossing lies
+  // between it and the next one.
+  double level10 = baseline + 0.1 * height;
+  double level90 = baseline + 0.9 * height;
+  double t10 = 0, t90 = 0;
+  size_t i = iMax;
+  while (i > 0 && samples[i - 1] >= level90) i--;
+  if (i > 0) t90 = (i - 1) + (level90 - samples[i - 1]) / ((double) samples[i] - samples[i - 1]);
+  while (i > 0 && samples[i - 1] >= level10) i--;
+  if (i > 0) t10 = (i - 1) + (level10 - samples[i - 1]) / ((double) samples[i] - samples[i - 1]);
+  shape.riseTime = t90 - t10;
+
+  size_t iStart = i;
+  size_t iTail = iMax + tailStart;
+  if (iTail >= n) return;
+  double total = (double) (sum - ORWaveformSum(samples, iStart)) - baseline * (n - iStart);
+  double tail = (double) ORWaveformSum(samples + iTail, n - iTail) - baseline * (n - iTail);
+  if (total > 0) shape.tailRatio = tail / total;
+}
+
+/*
+Trapezoidal shaping by moving-window deconvolution (MWD).  With P the prefix
+sums of the trace (P[i] = sum of samples before i), baseline b, window
+M = rise + flat and r = exp(-1/decay):
+
+  D[n] = x[n] - x[n-M] + (1 - r) * (P[n] - P[n-M] - M*b)          n >= M
+  T[n] = (C[n] - C[n-rise]) / rise,  C[n] = D[M] + ... + D[n]
+
+D turns an exponentially decaying step of height A into a box of height A
+and width M; the moving average makes that a trapezoid with the given rise
+and flat top, so max T is the pulse height in ADC units.  A decay of 0
+means no deconvolution (a plain step).  The D and max loops are element-wise
+and come in SSE2/AVX2 flavors; the two prefix sums are left serial.
+*/
+
+struct ORTrapezoidShaping {
+  unsigned int rise;
+  unsigned int flat;
+  double decay;
+};
+
+/* P gets n+1 entries. */
+inline void ORWaveformPrefixSums(const uint16_t* samples, size_t n, double* sums)
+{
+  double sum = 0;
+  sums[0] = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += samples[i];
+    sums[i + 1] = sum;
+  }
+}
+
+typedef void (*ORTrapezoidMWDFn)(const uint16_t*, const double*, size_t, size_t,
+                                 double, double, double*);
+typedef double (*ORWindowMaxDiffFn)(const double*, size_t, size_t, size_t);
+
+/* D[n] for n in [window, nSamples); other entries are left alone. */
+inline void ORTrapezoidMWDScalar(const uint16_t* samples, const double* sums, size_t nSamples,
+                                 size_t window, double baselineSum, double gain, double* out)
+{
+  for (size_t i = window; i < nSamples; i++) {
+    out[i] = ((double) samples[i] - (double) samples[i - window]) +
+             gain * (sums[i] - sums[i - window] - baselineSum);
+  }
+}
+
+/* max over i in [first, n) of c[i] - c[i - lag]. */
+inline double ORWindowMaxDiffScalar(const double* c, size_t first, size_t n, size_t lag)
+{
+  double best = c[first] - c[first - lag];
+  for (size_t i = first + 1; i < n; i++) {
+    double d = c[i] - c[i - lag];
+    if (d > best) best = d;
+  }
+  return best;
+}
+
+#ifdef OR_WAVEFORM_X86
+inline void ORTrapezoidMWDSSE2(const uint16_t* samples, const double* sums, size_t nSamples,
+                               size_t window, double baselineSum, double gain, double* out)
+{
+  const __m128d vGain = _mm_set1_pd(gain);
+  const __m128d vBase = _mm_set1_pd(baselineSum);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = window;
+  for (; i + 2 <= nSamples; i += 2) {
+    uint32_t now, then;
+    memcpy(&now, samples + i, 4);
+    memcpy(&then, samples + i - window, 4);
+    __m128d x = _mm_cvtepi32_pd(_mm_unpacklo_epi16(_mm_cvtsi32_si128(now), zero));
+    __m128d y = _mm_cvtepi32_pd(_mm_unpacklo_epi16(_mm_cvtsi32_si128(then), zero));
+    __m128d w = _mm_sub_pd(_mm_sub_pd(_mm_loadu_pd(sums + i), _mm_loadu_pd(sums + i - window)), vBase);
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_sub_pd(x, y), _mm_mul_pd(vGain, w)));
+  }
+  for (; i < nSamples; i++) {
+    out[i] = ((double) samples[i] - (double) samples[i - window]) +
+             gain * (sums[i] - sums[i - window] - baselineSum);
+  }
+}
+
+inline double ORWindowMaxDiffSSE2(const double* c, size_t first, size_t n, size_t lag)
+{
+  __m128d best = _mm_set1_pd(c[first] - c[first - lag]);
+  size_t i = first;
+  for (; i + 2 <= n; i += 2) {
+    best = _mm_max_pd(best, _mm_sub_pd(_mm_loadu_pd(c + i), _mm_loadu_pd(c + i - lag)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, best);
+  double result = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+  for (; i < n; i++) {
+    double d = c[i] - c[i - lag];
+    if (d > result) result = d;
+  }
+  return result;
+}
+
+__attribute__((target("avx2")))
+inline void ORTrapezoidMWDAVX2(const uint16_t* samples, const double* sums, size_t nSamples,
+                               size_t window, double baselineSum, double gain, double* out)
+{
+  const __m256d vGain = _mm256_set1_pd(gain);
+  const __m256d vBase = _mm256_set1_pd(baselineSum);
+  size_t i = window;
+  for (; i + 4 <= nSamples; i += 4) {
+    __m256d x = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*) (samples + i))));
+    __m256d y = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*) (samples + i - window))));
+    __m256d w = _mm256_sub_pd(_mm256_sub_pd(_mm256_loadu_pd(sums + i), _mm256_loadu_pd(sums + i - window)), vBase);
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_sub_pd(x, y), _mm256_mul_pd(vGain, w)));
+  }
+  for (; i < nSamples; i++) {
+    out[i] = ((double) samples[i] - (double) samples[i - window]) +
+             gain * (sums[i] - sums[i - window] - baselineSum);
+  }
+}
+
+__attribute__((target("avx2")))
+inline double ORWindowMaxDiffAVX2(const double* c, size_t first, size_t n, size_t lag)
+{
+  __m256d best = _mm256_set1_pd(c[first] - c[first - lag]);
+  size_t i = first;
+  for (; i + 4 <= n; i += 4) {
+    best = _mm256_max_pd(best, _mm256_sub_pd(_mm256_loadu_pd(c + i), _mm256_loadu_pd(c + i - lag)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, best);
+  double result = lanes[0];
+  for (int k = 1; k < 4; k++) if (lanes[k] > result) result = lanes[k];
+  for (; i < n; i++) {
+    double d = c[i] - c[i - lag];
+    if (d > result) result = d;
+  }
+  return result;
+}
+#endif
+
+inline ORTrapezoidMWDFn ORSelectTrapezoidMWD()
+{
+#ifdef OR_WAVEFORM_X86
+  if (__builtin_cpu_supports("avx2")) return ORTrapezoidMWDAVX2;
+  return ORTrapezoidMWDSSE2;
+#else
+  return ORTrapezoidMWDScalar;
+#endif
+}
+
+inline ORWindowMaxDiffFn ORSelectWindowMaxDiff()
+{
+#ifdef OR_WAVEFORM_X86
+  if (__builtin_cpu_supports("avx2")) return ORWindowMaxDiffAVX2;
+  return ORWindowMaxDiffSSE2;
+#else
+  return ORWindowMaxDiffScalar;
+#endif
+}
+
+/* Maximum of the trapezoid for one shaping.  sums are the trace's prefix
+   sums (ORWaveformPrefixSums), baseline is per sample, and scratch needs
+   room for nSamples doubles.  Returns 0 if the trace is shorter than
+   rise + flat + rise. */
+inline double ORTrapezoidMax(const uint16_t* samples, const double* sums, size_t nSamples,
+                             double baseline, const ORTrapezoidShaping& shaping, double* scratch)
+{
+  static const ORTrapezoidMWDFn mwd = ORSelectTrapezoidMWD();
+  static const ORWindowMaxDiffFn maxDiff = ORSelectWindowMaxDiff();
+  size_t rise = shaping.rise ? shaping.rise : 1;
+  size_t window = rise + shaping.flat;
+  if (nSamples < window + rise) return 0;
+
+  double gain = (shaping.decay > 0) ? 1 - exp(-1 / shaping.decay) : 0;
+  mwd(samples, sums, nSamples, window, window * baseline, gain, scratch);
+  // Running sum of D in place; scratch[window - 1] = 0 is the C[n - rise]
+  // for the first full average.
+  scratch[window - 1] = 0;
+  for (size_t i = window; i < nSamples; i++) scratch[i] += scratch[i - 1];
+  return maxDiff(scratch, window + rise - 1, nSamples, rise) / rise;
+}
+
+#endif
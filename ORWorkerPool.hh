@@ -0,0 +1,81 @@
+#ifndef _ORWorkerPool_hh_
+#define _ORWorkerPool_hh_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fixed-size pool of worker threads fed from a FIFO.  Each task is told the
+index of the worker running it, so callers can keep per-worker state (a
+decoder, a scratch buffer) without locking.  Submit returns a future the
+caller waits on to collect results in whatever order it needs.
+*/
+
+class ORWorkerPool
+{
+  public:
+    typedef std::function<void(size_t)> Task;
+
+    ORWorkerPool(size_t nWorkers) : fStop(false)
+    {
+      if (nWorkers == 0) nWorkers = 1;
+      for (size_t i = 0; i < nWorkers; i++) {
+        fWorkers.push_back(std::thread(&ORWorkerPool::Work, this, i));
+      }
+    }
+
+    virtual ~ORWorkerPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fStop = true;
+      }
+      fWakeUp.notify_all();
+      for (size_t i = 0; i < fWorkers.size(); i++) fWorkers[i].join();
+    }
+
+    size_t GetNWorkers() const { return fWorkers.size(); }
+
+    std::future<void> Submit(const Task& task)
+    {
+      std::shared_ptr<std::packaged_task<void(size_t)> > job(
+        new std::packaged_task<void(size_t)>(task));
+      std::future<void> result = job->get_future();
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fQueue.push_back(job);
+      }
+      fWakeUp.notify_one();
+      return result;
+    }
+
+  protected:
+    void Work(size_t iWorker)
+    {
+      while (true) {
+        std::shared_ptr<std::packaged_task<void(size_t)> > job;
+        {
+          std::unique_lock<std::mutex> lock(fMutex);
+          while (!fStop && fQueue.empty()) fWakeUp.wait(lock);
+          if (fQueue.empty()) return;
+          job = fQueue.front();
+          fQueue.pop_front();
+        }
+        (*job)(iWorker);
+      }
+    }
+
+    std::vector<std::thread> fWorkers;
+    std::deque<std::shared_ptr<std::packaged_task<void(size_t)> > > fQueue;
+    std::mutex fMutex;
+    std::condition_variable fWakeUp;
+    bool fStop;
+};
+
+#endif
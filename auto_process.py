@@ -19,9 +19,6 @@ def main(argv):
     we input its serial number and run numbers to the database,
     and run this code to process the data and handle the output files.
     For usage help, run: $ python auto_process.py -h
-
-    TODO:
-    - run number checker (verify all expected runs exist & files are OK)
     """
     # -- load our run database and make it global --
     global crysDB
@@ -39,6 +36,7 @@ def main(argv):
     arg("-o", "--over", action="store_true", help="overwrite existing files")
     arg("-z", "--zip", action="store_true", help='run gzip on raw files (on cenpa-rocks)')
     arg("-s", "--sync", action="store_true", help='sync DAQ with cenpa-rocks')
+    arg("-k", "--check", type=str, help="check a crystal's raw files exist and are intact")
     args = vars(par.parse_args())
 
     # -- set parameters --
@@ -60,6 +58,9 @@ def main(argv):
         for sn in all_sns:
             process_crystal(sn, overwrite)
 
+    if args["check"]:
+        check_runs(args["check"])
+
     if args["sync"]:
         sync_data()
 
@@ -125,43 +126,79 @@ def process_crystal(sn, overwrite=False):
         pathlib.Path(path).mkdir(parents=True, exist_ok=True)
 
     # -- loop over the raw files --
-    # process only the runs for this crystal, and sort into built directories
-    for i, f in enumerate(sorted(raw_files)):
+    # process only the runs for this crystal
+    # archived runs (RunNNNN.orz, .tar.gz, .tgz) are read directly by
+    # getSpectrum; the unpacked file is used when it's still around.
+    raw_by_run = pick_raw_files(raw_files, ["", ".orz", ".tar.gz", ".tgz"])
+
+    to_convert = []
+    for run, f in sorted(raw_by_run.items()):
 
-        run = int(f.split("Run")[-1])
         if run not in crys_runs:
             continue
 
-        print("Processing run {}, started at: {}".format(run, datetime.datetime.now()))
+        to_convert.append((run, f))
+
+    if len(to_convert) == 0:
+        print("No runs to convert.")
+
+    # -- actually process the ORCA files and create ROOT ones --
+    # each run can take 8-10 minutes.  getSpectrum converts several at once
+    # and prints a "RUNSTATUS <code> <file>" line per file.  Runs that were
+    # interrupted last time continue from their checkpoint.  Unless we're
+    # overwriting, getSpectrum leaves out runs its manifest says are already
+    # built from the same raw file with the same settings ("UPTODATE <file>").
+    run_status = {}
+    up_to_date = set()
+    if len(to_convert) > 0:
+        print("Processing runs {}, started at: {}".format(
+              [run for run, f in to_convert], datetime.datetime.now()))
+        t_start = time.time()
+        n_jobs = min(len(to_convert), os.cpu_count() or 1)
+        cmd = ["./getSpectrum", "--verbosity", "error", "--jobs", str(n_jobs),
+               "--resume"]
+        if not overwrite:
+            cmd.append("--skip-up-to-date")
+        cmd += [f for run, f in to_convert]
+        print(" ".join(cmd))
+        p = sp.run(cmd, stdout=sp.PIPE, universal_newlines=True)
+        print(p.stdout)
+        for line in p.stdout.split("\n"):
+            if line.startswith("RUNSTATUS"):
+                _, code, fname = line.split(" ", 2)
+                run_status[fname] = int(code)
+            elif line.startswith("UPTODATE"):
+                up_to_date.add(line.split(" ", 1)[1])
+        # every file gets a RUNSTATUS line, whatever --jobs is; if getSpectrum
+        # died before printing them, its exit code stands for the lot
+        for run, f in to_convert:
+            if f not in up_to_date:
+                run_status.setdefault(f, p.returncode if p.returncode != 0 else -1)
+        print("Done processing: {:.2f} min".format((time.time()-t_start)/60))
+
+    # -- sort the converted runs into built directories --
+    for run, f in to_convert:
 
         out_file = "NaI_ET_run{}.root".format(run)
 
-        if os.path.isfile(out_file) and overwrite is False:
-            print("built file already exists, use -ovr to overwrite")
+        if f in up_to_date:
+            print("run {} is up to date, use --over to rebuild it".format(run))
             continue
 
-        # -- actually process the ORCA file and create a ROOT one --
-        # this step can take 8-10 minutes
-        t_start = time.time()
-        ftmp = f.replace(' ', '\ ')
-        cmd = "./getSpectrum --verbosity error {}".format(ftmp)
-        print(cmd)
-        sh(cmd)
-        print("Done processing: {:.2f} min".format((time.time()-t_start)/60))
+        if run_status.get(f, -1) != 0:
+            print("Error, getSpectrum failed on run {} (status {}), rerun to retry."
+                  .format(run, run_status.get(f)))
+            continue
 
         # check output file
         if not os.path.isfile(out_file):
             print("Error, I expected to find an output file:", out_file)
-            exit()
+            continue
 
-        # # this check doesn't work, but could be fixed
-        # from ROOT import TFile
-        # tf = TFile(out_file)
-        # if tf.IsZombie():
-        #     print("CAAARRL, it's a goddamn Walker! ... file."
-        #           "    Found corrupted file: {}".format(out_file))
-        #     print("    Processing on this file was probably interrupted.")
-        #     exit()
+        # getSpectrum only renames NaI_ET.part_runN.root to this name once the
+        # run is complete, so an interrupted conversion can't leave a zombie
+        # file here.  Its partial file and checkpoint stay behind, and the
+        # next pass picks up from there (--resume).
 
         # now figure out which folder to move it to
         for run_type in crysDB[sn]:
@@ -186,6 +223,16 @@ def process_crystal(sn, overwrite=False):
 
             print(cmd)
             sh(cmd)
+            relocate_output(out_file, "{}/{}/{}/{}/{}".format(crysDB["built_path"],
+                            sn, run_type, folder_name, out_file))
+
+            # columnar sidecar (getSpectrum --columnar) goes with its ROOT file
+            col_file = out_file.replace(".root", ".cols")
+            if os.path.isfile(col_file):
+                cmd = "mv {} {}/{}/{}/{}/{}".format(col_file,
+                      crysDB["built_path"], sn, run_type, folder_name, col_file)
+                print(cmd)
+                sh(cmd)
 
     # add a last check that we have all files we expect
     print("Listing output files:")
@@ -197,6 +244,88 @@ def process_crystal(sn, overwrite=False):
     print("Processing is up to date!", now.strftime("%Y-%m-%d %H:%M"))
 
 
+def check_runs(sn):
+    """
+    verify all of a crystal's runs in the DB have a raw file on this
+    computer, and that each is intact.  rawIndex only walks the record
+    headers, so this is much faster than converting, and the index it
+    leaves next to each raw file (RunN.idx) is reused while the file
+    doesn't change.
+    """
+    if sn not in crysDB.keys():
+        print("Crystal {} not found! Exiting ...".format(sn))
+        exit()
+
+    fstr = crysDB["raw_path"]
+    raw_files = glob.glob("{}/**/**/Data/*Run*".format(fstr), recursive=True)
+    # plain raw files, or block archives (rawArchive --check inflates every
+    # block on all cores); .tar.gz can't be checked without unpacking
+    raw_by_run = pick_raw_files(raw_files, ["", ".orz"])
+
+    n_bad = 0
+    for run_type in crysDB[sn]:
+        for run in crysDB[sn][run_type]:
+            if run not in raw_by_run:
+                print("{} run {}: no raw file found".format(run_type, run))
+                n_bad += 1
+                continue
+            if raw_by_run[run].endswith(".orz"):
+                cmd = ["./rawArchive", "--check", raw_by_run[run]]
+            else:
+                cmd = ["./rawIndex", raw_by_run[run]]
+            p = sp.run(cmd, stdout=sp.PIPE, universal_newlines=True)
+            if p.returncode != 0:
+                print("{} run {}: damaged".format(run_type, run))
+                print(p.stdout)
+                n_bad += 1
+
+    print("Checked crystal {}: {} problem(s) found.".format(sn, n_bad))
+
+
+def relocate_output(old_file, new_file, manifest="NaI_ET.manifest"):
+    """
+    point getSpectrum's manifest entry for a converted file at the place it
+    was moved to, so --skip-up-to-date still finds the output.
+    the manifest is tab separated, output paths in the 6th column, joined
+    by "|" when a run has several (--demux, see ORManifest.hh).
+    """
+    if not os.path.isfile(manifest):
+        return
+    old_path = os.path.realpath(old_file)
+    new_path = os.path.realpath(new_file)
+    lines = []
+    with open(manifest) as f:
+        for line in f:
+            fields = line.rstrip("\n").split("\t")
+            if len(fields) == 9:
+                fields[5] = "|".join(new_path if out == old_path else out
+                                     for out in fields[5].split("|"))
+            lines.append("\t".join(fields))
+    with open(manifest + ".tmp", "w") as f:
+        f.write("\n".join(lines) + "\n")
+    os.replace(manifest + ".tmp", manifest)
+
+
+def pick_raw_files(raw_files, kinds):
+    """
+    map each run number to its raw file, given all the files named like
+    RunNNNN[.ext] in the raw data folders.  kinds lists the extensions to
+    accept, best first ("" is the unpacked file); anything else, like the
+    RunNNNN.idx that rawIndex leaves next to a run, is ignored.
+    """
+    raw_by_run, rank_by_run = {}, {}
+    for f in raw_files:
+        tail = os.path.basename(f).split("Run")[-1]
+        run_str = tail.split(".")[0]
+        ext = tail[len(run_str):]
+        if not run_str.isdigit() or ext not in kinds:
+            continue
+        run, rank = int(run_str), kinds.index(ext)
+        if run not in raw_by_run or rank < rank_by_run[run]:
+            raw_by_run[run], rank_by_run[run] = f, rank
+    return raw_by_run
+
+
 def sync_data():
     """
     to run: `python auto_process.py -s`
@@ -280,7 +409,12 @@ def zip_data(overwrite=False):
     $ crontab -e
     * * * * * ~/analysis/crystal_char/task.sh >> ~/analysis/crystal_char/logs/cron.log 2>&1
     (then change the *'s to be an appropriate time interval, say 4 hours)
+
+    raw files are archived as RunNNNN.orz by rawArchive, which compresses
+    blocks on every core and only deletes the raw file once the archive
+    has been read back and checked.  getSpectrum reads the .orz directly.
     """
+    raw_archive = os.path.join(os.path.dirname(os.path.abspath(__file__)), "rawArchive")
     raw_rocks = "{}/".format(crysDB["rocks_data2"])
 
     print("Getting file list ...")
@@ -316,14 +450,27 @@ def zip_data(overwrite=False):
                 print("Zipped file failed checks.  Deleting zipped file:\n    ", tar_file)
                 # os.remove(tar_file)
 
-        # compress the file
-        this_dir = os.getcwd()
-        dest_dir = "/".join(f_name.split("/")[:-1])
-        os.chdir(dest_dir)
-        cmd = "tar cvzf {}.tar.gz {} --remove-files".format(f, f)
-        print("Zipping file:", cmd)
+        # an archive left by an earlier pass that didn't get to remove the
+        # raw file: if it checks out and holds all of the raw file, the raw
+        # file can go.  otherwise write the archive again.
+        orz_file = raw_file + ".orz"
+        if os.path.isfile(orz_file):
+            p = sp.run([raw_archive, "--check", orz_file], stdout=sp.PIPE,
+                       universal_newlines=True)
+            q = sp.run([raw_archive, "--list", orz_file], stdout=sp.PIPE,
+                       universal_newlines=True)
+            summary = q.stdout.split("\n")[0].split()
+            raw_size = int(summary[1]) if len(summary) > 1 and summary[1].isdigit() else -1
+            if p.returncode == 0 and raw_size == os.path.getsize(raw_file):
+                print("Archive passes checks. Deleting raw file:\n    ", raw_file)
+                os.remove(raw_file)
+                continue
+            print("Archive failed checks, writing it again:\n    ", orz_file)
+
+        # compress the file, then remove it
+        cmd = "{} --remove {}".format(raw_archive, raw_file)
+        print("Archiving file:", cmd)
         sh(cmd)
-        os.chdir(this_dir)
 
         # exit()
 
@@ -17,6 +17,8 @@
 #include <TH2D.h>
 #include <TLine.h>
 #include <TSpectrum.h>
+#include <TFile.h>
+#include <TROOT.h>
 
 #include "CalStructs.h"
 #include "PeakFinder.h"
@@ -53,6 +55,11 @@ Options:
 "noise"		will display the noise wall energy vs the dependent variable set by the mode
 		parameter."
 "rate"		will display the detector count rate as a function of tested variable.
+"hist"		will build every histogram from the spectra stored by getSpectrum --histograms
+		instead of reading event data.
+"demux"		will read NaI_ET_ch4_run*.root, written by getSpectrum --demux 4, instead of
+		NaI_ET_run*.root, so only the hits of the channel being calibrated are read.
+"pileup"	will leave out hits flagged as pile-up by getSpectrum --pile-up.
 
 
 Required Directory structure for Calibration to work:
@@ -98,6 +105,9 @@ Int_t Calibration(string path, string mode, string option) {
 	vector<TChain*> DATA;
 	vector<Int_t> POSITIONS;
 	vector<Int_t> VOLTAGES;
+	// must match CHANNEL below
+	string runFiles = (option.find("demux") != string::npos) ? "NaI_ET_ch4_run*" : "NaI_ET_run*";
+	bool rejectPileUp = option.find("pileup") != string::npos;
 	if (mode == "pos") {
 		vector<Int_t> testedPositions = {1, 2, 3, 4, 5};
 		// will segfault if there's no data for any one of these positions
@@ -108,7 +118,7 @@ Int_t Calibration(string path, string mode, string option) {
 			Int_t pos = testedPositions[i];
 			cout << pos << " ";
 			string expectedPath = path + "/position/position_" + to_string(pos);
-			expectedPath += "/NaI_ET_run*";
+			expectedPath += "/" + runFiles;
 			filepaths.push_back(expectedPath);
 		}
 		POSITIONS = testedPositions;
@@ -123,7 +133,7 @@ Int_t Calibration(string path, string mode, string option) {
 			Int_t volt = testedVoltages[i];
 			cout << volt << " ";
 			string expectedPath = path + "/voltage/" + to_string(volt);
-			expectedPath += "_V/NaI_ET_run*";
+			expectedPath += "_V/" + runFiles;
 			filepaths.push_back(expectedPath);
 		}
 		VOLTAGES = testedVoltages;
@@ -135,6 +145,59 @@ Int_t Calibration(string path, string mode, string option) {
 	}
 	Int_t NUMFILES = DATA.size();
 
+	// use the flat sidecars from getSpectrum --columnar when every run in a chain has one
+	vector<vector<ORColumnarFile*> > COLUMNAR(NUMFILES);
+	for (Int_t i = 0; i < NUMFILES; i++) {
+		TObjArray *files = DATA[i]->GetListOfFiles();
+		for (Int_t j = 0; j < files->GetEntries(); j++) {
+			string rootFile = files->At(j)->GetTitle();
+			string colFile = rootFile.substr(0, rootFile.rfind(".root")) + ".cols";
+			ORColumnarFile *f = new ORColumnarFile(colFile);
+			// every column PeakFinder reads must be there (an older writer or a
+			// cut-short file may lack some); files converted without --pile-up
+			// have no flags to cut on
+			bool complete = f->IsValid() && f->GetColumn("energy", kORColFloat64) != NULL &&
+			                f->GetColumn("amp", kORColFloat64) != NULL &&
+			                f->GetColumn("channel", kORColUInt16) != NULL;
+			if (!complete || (rejectPileUp && f->GetColumn("pileUp", kORColUInt8) == NULL)) {
+				delete f;
+				for (ORColumnarFile *g : COLUMNAR[i]) {
+					delete g;
+				}
+				COLUMNAR[i].clear();
+				break;
+			}
+			COLUMNAR[i].push_back(f);
+		}
+		if (!COLUMNAR[i].empty()) {
+			cout << "Reading " << filepaths[i] << " from columnar sidecar files" << endl;
+		}
+	}
+
+	vector<vector<TFile*> > HISTFILES(NUMFILES);
+	if (option.find("hist") != string::npos) {
+		for (Int_t i = 0; i < NUMFILES; i++) {
+			TObjArray *files = DATA[i]->GetListOfFiles();
+			for (Int_t j = 0; j < files->GetEntries(); j++) {
+				TFile *f = TFile::Open(files->At(j)->GetTitle());
+				if (f == NULL || f->IsZombie()) {
+					cout << "Can't open " << files->At(j)->GetTitle()
+					     << " for its histograms, reading event data instead" << endl;
+					delete f;
+					for (TFile *g : HISTFILES[i]) {
+						delete g;
+					}
+					HISTFILES[i].clear();
+					break;
+				}
+				HISTFILES[i].push_back(f);
+			}
+		}
+		// TFile::Open made the last file the current directory; new histograms
+		// mustn't land in a file that is closed once its analyzer is built
+		gROOT->cd();
+	}
+
   /* ######################################################################### */
   /* #                  USER PARAMETERS GO BELOW THIS LINE                   # */
   /* ######################################################################### */
@@ -232,7 +295,15 @@ Int_t Calibration(string path, string mode, string option) {
 		cout << "Run time in data chain: " << time << " seconds" << endl;
 
 		Double_t pinnedE = peakPars[0].peakEnergies[0];
-		PeakFinder *analyzer = new PeakFinder(pinnedE, DATA[i], CHANNEL, app);
+		PeakFinder *analyzer = new PeakFinder(pinnedE, DATA[i], CHANNEL, app, COLUMNAR[i],
+		                                      HISTFILES[i], rejectPileUp);
+		// the analyzer has detached the spectra it keeps, and its own histograms
+		// were never in these files
+		for (TFile *f : HISTFILES[i]) {
+			f->Close();
+			delete f;
+		}
+		HISTFILES[i].clear();
 
 		for (Int_t j = 0; j < peakPars.size(); j++) {
 			FitInfo pars = peakPars[j];
@@ -512,7 +583,7 @@ Int_t Calibration(string path, string mode, string option) {
 			muFitWindow.low = calib.slope * 20000 + calib.offset;
 			muFitWindow.high = calib.slope * 38000 + calib.offset;
 
-			Double_t thresholdEnergy = 0.95 * DATA[i]->GetMaximum("energy");
+			Double_t thresholdEnergy = 0.95 * ANALYZERS[i]->getMaxEnergy();
 
 			if (muFitWindow.high < thresholdEnergy) {
 				Double_t pos = calib.slope * 25000 + calib.offset;
@@ -525,9 +596,10 @@ Int_t Calibration(string path, string mode, string option) {
 					lab = to_string(VOLTAGES[i]) + " V";
 				}
 				Int_t nBins = ANALYZERS[i]->getRawPlot()->GetNbinsX() / 100;
-				Double_t max = 1.01 * DATA[i]->GetMaximum("energy");
+				Double_t max = 1.01 * ANALYZERS[i]->getMaxEnergy();
 				TH1D *muH = new TH1D(muName.c_str(), lab.c_str(), nBins, 0, max);
-				DATA[i]->Draw(("energy >> " + muName).c_str(), CHANNEL.c_str());
+				ANALYZERS[i]->fillEnergy(muH);
+				muH->Draw();
 
 				muH->GetXaxis()->SetRangeUser(0.95 * pos, 1.05 * pos);
 				pos = muH->GetXaxis()->GetBinCenter(muH->GetMaximumBin());
@@ -954,7 +1026,7 @@ Int_t Calibration(string path, string mode, string option) {
 			}
 
 			Measurement maxEnergy;
-			maxEnergy.val = DATA[i]->GetMaximum("energy");
+			maxEnergy.val = ANALYZERS[i]->getMaxEnergy();
 			maxEnergy.err = 0;
 
 			Measurement calibratedMaxEnergy = ANALYZERS[i]->calibrate(maxEnergy);
@@ -969,10 +1041,8 @@ Int_t Calibration(string path, string mode, string option) {
 			calibrated->GetYaxis()->SetTitle("Count");
 
 			FitResults calib = ANALYZERS[i]->getCalibration();
-			string calibration = "(energy - " + to_string(calib.offset);
-			calibration += ") / " + to_string(calib.slope);
-			calibration += " >> " + calName;
-			DATA[i]->Draw(calibration.c_str(), CHANNEL.c_str(), "SAME");
+			ANALYZERS[i]->fillEnergy(calibrated, &calib);
+			calibrated->Draw("SAME");
 		}
 
 		overlayCanvas->BuildLegend(0.7,0.6,0.85,0.85); 	// legend in top right
@@ -1176,16 +1246,12 @@ Int_t Calibration(string path, string mode, string option) {
 		TH2D *AEHist = new TH2D("AEHist", "Amplitude / Energy vs calibrated Energy",
 		                        1e3, 0, 50e3, 1e3, 0, 10);
 
-		TChain* allData = new TChain("st");
-		for (TChain* c : DATA) {
-			allData->Add(c);
-		}
-
 		FitResults calib = ANALYZERS[NUMFILES / 2 + 1]->getCalibration();
 
-		string calE = "(energy-"+to_string(calib.offset)+")/"+to_string(calib.slope);
-		string toPlot = "amp / (" + calE + ") : (" + calE + ") >> AEHist";
-		allData->Draw(toPlot.c_str(), CHANNEL.c_str(), "COLZ");
+		for (Int_t i = 0; i < NUMFILES; i++) {
+			ANALYZERS[i]->fillAE(AEHist, calib);
+		}
+		AEHist->Draw("COLZ");
 
 		AEHist->GetXaxis()->SetTitle("Calibrated Energy (keV)");
 		AEHist->GetYaxis()->SetTitle("Amplitude / Callibrated Energy");
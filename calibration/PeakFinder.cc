@@ -14,6 +14,7 @@
 #include <TH2D.h>
 #include <TLine.h>
 #include <TSpectrum.h>
+#include <TParameter.h>
 
 #include "CalStructs.h"
 #include "PeakSet.h"
@@ -63,7 +64,39 @@ Returns:
 	return input.length() != 0;
 }
 
-PeakFinder::PeakFinder(Double_t pinnedEnergy, TChain *c, std::string channel, TApplication *app) {
+void PeakFinder::overlapBins(TAxis *axis, Double_t low, Double_t high,
+                             std::vector<std::pair<Double_t, Double_t> > &pieces) {
+/* splits the interval [low, high] among the bins of an axis it overlaps
+
+Accepts:
+	TAxis *axis: the axis to split over.  Underflow and overflow count as bins.
+	Double_t low, high: the interval, in units of the axis; either order.
+	std::vector<std::pair<Double_t, Double_t> > &pieces: filled with one (center, fraction)
+		pair per overlapped bin, where center lies in that bin and the fractions sum to 1.
+
+*/
+	pieces.clear();
+	if (high < low) {
+		std::swap(low, high);
+	}
+	if (high == low) {
+		pieces.push_back(std::make_pair(low, 1.0));
+		return;
+	}
+	Int_t first = axis->FindFixBin(low);
+	Int_t last = axis->FindFixBin(high);
+	for (Int_t bin = first; bin <= last; bin++) {
+		Double_t from = (bin == first) ? low : axis->GetBinLowEdge(bin);
+		Double_t to = (bin == last) ? high : axis->GetBinUpEdge(bin);
+		if (to > from) {
+			pieces.push_back(std::make_pair(0.5 * (from + to), (to - from) / (high - low)));
+		}
+	}
+}
+
+PeakFinder::PeakFinder(Double_t pinnedEnergy, TChain *c, std::string channel, TApplication *app,
+                       std::vector<ORColumnarFile*> columnar, std::vector<TFile*> histFiles,
+                       bool rejectPileUp) {
 /* Constructor: builds a PeakFinder object
 
 Accepts:
@@ -74,6 +107,15 @@ Accepts:
 	string channel: the digitizer channel for which data is to be analyzed.
 	TApplication *app: a pointer to a ROOT interactive application, to allow for user input
 		and manipulation of plots.
+	vector<ORColumnarFile*> columnar: optional sidecar files (one per file in c) written by
+		getSpectrum --columnar.  When given, histograms are filled from these instead of
+		through TTree::Draw on c.
+	vector<TFile*> histFiles: optional open output files (one per file in c) from
+		getSpectrum --histograms.  When given, and every file holds the spectra for the
+		selected channel, all histograms are rebinned from those and no event data is read.
+		The spectra are copied out, so the files can be closed once this returns.
+	bool rejectPileUp: leave out hits flagged by getSpectrum --pile-up.  The data must have
+		been converted with --pile-up (pileUp branch or column, pileUpThreshold parameter).
 
 Returns:
 	A PeakFinder object initialized with the relevant information to begin analysis.
@@ -81,20 +123,77 @@ Returns:
 */
 	this->data = c;
 	this->channel = channel;
+	this->columnar = columnar;
+	this->rejectPileUp = rejectPileUp;
+	this->maxEnergy = -1;
+
+	// the columnar path needs the channel number out of a cut like "channel==4"
+	this->channelNum = -1;
+	size_t eq = channel.find("==");
+	if (eq != std::string::npos && this->isNumber(channel.substr(eq + 2))) {
+		this->channelNum = stoi(channel.substr(eq + 2));
+	}
+	if (rejectPileUp) {
+		this->channel = "(" + channel + ") && pileUp==0";
+	}
+
+	this->storedMax = 0;
+	if (!histFiles.empty() && this->channelNum >= 0) {
+		std::string suffix = "_ch" + std::to_string(this->channelNum);
+		for (TFile *f : histFiles) {
+			TH1 *hE = (TH1*) f->Get(("hEnergy" + suffix).c_str());
+			TH2 *hMap = (TH2*) f->Get(("hAmpVsEnergy" + suffix).c_str());
+			TParameter<Double_t> *max = (TParameter<Double_t>*) f->Get("energyMax");
+			// flagged hits are kept apart, so rejecting pile-up just leaves these out
+			TH1 *hEPileUp = (TH1*) f->Get(("hEnergyPileUp" + suffix).c_str());
+			TH2 *hMapPileUp = (TH2*) f->Get(("hAmpVsEnergyPileUp" + suffix).c_str());
+			bool flagged = f->Get("pileUpThreshold") != NULL;
+			if (hE == NULL || hMap == NULL || max == NULL || (rejectPileUp && !flagged)) {
+				std::cout << "no stored histograms for " << channel;
+				if (rejectPileUp && !flagged) {
+					std::cout << " without pile-up";
+				}
+				std::cout << " in " << f->GetName() << ", reading event data instead" << std::endl;
+				for (size_t i = 0; i < this->storedEnergy.size(); i++) {
+					delete this->storedEnergy[i];
+					delete this->storedMap[i];
+				}
+				this->storedEnergy.clear();
+				this->storedMap.clear();
+				break;
+			}
+			// detached from f, so they outlive it once the caller closes it
+			hE->SetDirectory(0);
+			hMap->SetDirectory(0);
+			this->storedEnergy.push_back(hE);
+			this->storedMap.push_back(hMap);
+			if (!rejectPileUp && hEPileUp != NULL && hMapPileUp != NULL) {
+				hEPileUp->SetDirectory(0);
+				hMapPileUp->SetDirectory(0);
+				this->storedEnergy.push_back(hEPileUp);
+				this->storedMap.push_back(hMapPileUp);
+			}
+			if (max->GetVal() > this->storedMax) {
+				this->storedMax = max->GetVal();
+			}
+		}
+	}
 
 	Int_t numBins = 16384; // 2^14
   // Int_t numBins = 12000; // edit by clint to improve 600V run
 	TCanvas *tempCanvas = new TCanvas("tempCanvas", "tempCanvas");
 	gPad->SetLogy();
 
-	Double_t overflowPos = 1.01 * this->data->GetMaximum("energy");
+	Double_t overflowPos = 1.01 * this->getMaxEnergy();
 	TH1D *hTemp = new TH1D("hTemp", "Pinning Highest Energy Peak", numBins, 0, overflowPos);
+	hTemp->SetDirectory(0);	// owned here, whatever file happens to be current
 	hTemp->GetXaxis()->SetTitle("Uncalibrated Energy");
 	hTemp->GetYaxis()->SetTitle("Count");
-	this->data->Draw("energy >> hTemp", this->channel.c_str());
+	this->fillEnergy(hTemp);
 
 	// must identify the position of the pinned peak, so that other peaks may be estimated.
 	TH1D* hSmoothed = (TH1D*) hTemp->Clone();
+	hSmoothed->SetDirectory(0);
 	hSmoothed->Smooth(1);
 	TSpectrum* s = new TSpectrum();
 	Int_t nFound = s->Search(hSmoothed, 2, "", 0.0001);
@@ -154,7 +253,8 @@ Returns:
 	numBins = (Int_t) (500.0 / normPos);
 	this->numBins = numBins;
 	TH1D *h = new TH1D("h", "Uncalibrated Spectrum", numBins, 0, overflowPos);
-	this->data->Draw("energy >> h", channel.c_str(), "goff");
+	h->SetDirectory(0);
+	this->fillEnergy(h);
 	this->rawPlot = h;
 
 	this->pinnedPeak.energy = pinnedEnergy;
@@ -368,7 +468,7 @@ Returns:
 	}
 
 	// calibration is linear for now
-	TF1 *calFit = new TF1("calFit", "pol1", 0, this->data->GetMaximum("energy"));
+	TF1 *calFit = new TF1("calFit", "pol1", 0, this->getMaxEnergy());
 	this->calPlot = new TGraphErrors(expEs.size(), &expEs[0], &fitEs[0], 0, &fitEErrs[0]);
 	this->calPlot->Fit("calFit", "R+");
 
@@ -431,7 +531,158 @@ TGraphErrors* PeakFinder::getCalPlot() {
 
 Double_t PeakFinder::getOverflowPos() {
 /* returns the uncalibrated energy corresponding to the maximum bin in the raw histogram */
-	return 1.01 * this->data->GetMaximum("energy");
+	return 1.01 * this->getMaxEnergy();
+}
+
+Double_t PeakFinder::getMaxEnergy() {
+/* returns the largest uncalibrated energy in the data (all channels), computed once */
+	if (this->maxEnergy >= 0) {
+		return this->maxEnergy;
+	}
+	if (!this->storedEnergy.empty()) {
+		this->maxEnergy = this->storedMax;
+		return this->maxEnergy;
+	}
+	if (this->columnar.empty()) {
+		this->maxEnergy = this->data->GetMaximum("energy");
+		return this->maxEnergy;
+	}
+	Double_t max = 0;
+	for (ORColumnarFile *f : this->columnar) {
+		const Double_t *energy = (const Double_t*) f->GetColumn("energy", kORColFloat64);
+		for (uint64_t i = 0; i < f->GetNEntries(); i++) {
+			if (energy[i] > max) {
+				max = energy[i];
+			}
+		}
+	}
+	this->maxEnergy = max;
+	return max;
+}
+
+void PeakFinder::fillEnergy(TH1 *h, FitResults *calib) {
+/* fills a histogram with the energies passing this PeakFinder's channel cut
+
+Accepts:
+	TH1 *h: histogram to fill.  It is not drawn.
+	FitResults *calib: if given, energies are converted with (energy - offset) / slope
+		before filling.
+
+*/
+	if (!this->storedEnergy.empty()) {
+		// h's bins needn't line up with the stored ones, so each stored bin's count
+		// is shared among the bins of h it overlaps, in proportion to the overlap
+		std::vector<std::pair<Double_t, Double_t> > pieces;
+		for (TH1 *stored : this->storedEnergy) {
+			for (Int_t bin = 1; bin <= stored->GetNbinsX(); bin++) {
+				Double_t count = stored->GetBinContent(bin);
+				if (count == 0) {
+					continue;
+				}
+				Double_t low = stored->GetXaxis()->GetBinLowEdge(bin);
+				Double_t high = stored->GetXaxis()->GetBinUpEdge(bin);
+				if (calib != NULL) {
+					low = (low - calib->offset) / calib->slope;
+					high = (high - calib->offset) / calib->slope;
+				}
+				this->overlapBins(h->GetXaxis(), low, high, pieces);
+				for (size_t k = 0; k < pieces.size(); k++) {
+					h->Fill(pieces[k].first, count * pieces[k].second);
+				}
+			}
+		}
+		return;
+	}
+	if (this->columnar.empty()) {
+		std::string expr = "energy";
+		if (calib != NULL) {
+			expr = "(energy - " + std::to_string(calib->offset) + ") / " + std::to_string(calib->slope);
+		}
+		// ">>+" adds to h rather than resetting it, as the other paths do
+		expr += " >>+ " + std::string(h->GetName());
+		this->data->Draw(expr.c_str(), this->channel.c_str(), "goff");
+		return;
+	}
+	for (ORColumnarFile *f : this->columnar) {
+		const Double_t *energy = (const Double_t*) f->GetColumn("energy", kORColFloat64);
+		const UShort_t *chan = (const UShort_t*) f->GetColumn("channel", kORColUInt16);
+		const UChar_t *pileUp = (const UChar_t*) f->GetColumn("pileUp", kORColUInt8);
+		for (uint64_t i = 0; i < f->GetNEntries(); i++) {
+			if (this->channelNum >= 0 && chan[i] != this->channelNum) {
+				continue;
+			}
+			if (this->rejectPileUp && pileUp[i]) {
+				continue;
+			}
+			if (calib != NULL) {
+				h->Fill((energy[i] - calib->offset) / calib->slope);
+			} else {
+				h->Fill(energy[i]);
+			}
+		}
+	}
+}
+
+void PeakFinder::fillAE(TH2 *h, FitResults calib) {
+/* fills a histogram with amplitude / calibrated energy (y) vs calibrated energy (x)
+
+Accepts:
+	TH2 *h: histogram to fill.  It is not drawn.
+	FitResults calib: calibration used to convert energies.  Need not be this PeakFinder's.
+
+*/
+	if (!this->storedMap.empty()) {
+		// as in fillEnergy, counts are shared by overlap: first along calibrated
+		// energy, then along amplitude / energy at the middle of each energy piece
+		std::vector<std::pair<Double_t, Double_t> > xPieces, yPieces;
+		for (TH2 *stored : this->storedMap) {
+			for (Int_t ix = 1; ix <= stored->GetNbinsX(); ix++) {
+				Double_t low = (stored->GetXaxis()->GetBinLowEdge(ix) - calib.offset) / calib.slope;
+				Double_t high = (stored->GetXaxis()->GetBinUpEdge(ix) - calib.offset) / calib.slope;
+				this->overlapBins(h->GetXaxis(), low, high, xPieces);
+				for (Int_t iy = 1; iy <= stored->GetNbinsY(); iy++) {
+					Double_t count = stored->GetBinContent(ix, iy);
+					if (count == 0) {
+						continue;
+					}
+					for (size_t i = 0; i < xPieces.size(); i++) {
+						Double_t calE = xPieces[i].first;
+						if (calE == 0) {
+							continue;
+						}
+						this->overlapBins(h->GetYaxis(), stored->GetYaxis()->GetBinLowEdge(iy) / calE,
+						                  stored->GetYaxis()->GetBinUpEdge(iy) / calE, yPieces);
+						for (size_t j = 0; j < yPieces.size(); j++) {
+							h->Fill(calE, yPieces[j].first, count * xPieces[i].second * yPieces[j].second);
+						}
+					}
+				}
+			}
+		}
+		return;
+	}
+	if (this->columnar.empty()) {
+		std::string calE = "(energy-" + std::to_string(calib.offset) + ")/" + std::to_string(calib.slope);
+		std::string toPlot = "amp / (" + calE + ") : (" + calE + ") >>+ " + std::string(h->GetName());
+		this->data->Draw(toPlot.c_str(), this->channel.c_str(), "goff");
+		return;
+	}
+	for (ORColumnarFile *f : this->columnar) {
+		const Double_t *energy = (const Double_t*) f->GetColumn("energy", kORColFloat64);
+		const Double_t *amp = (const Double_t*) f->GetColumn("amp", kORColFloat64);
+		const UShort_t *chan = (const UShort_t*) f->GetColumn("channel", kORColUInt16);
+		const UChar_t *pileUp = (const UChar_t*) f->GetColumn("pileUp", kORColUInt8);
+		for (uint64_t i = 0; i < f->GetNEntries(); i++) {
+			if (this->channelNum >= 0 && chan[i] != this->channelNum) {
+				continue;
+			}
+			if (this->rejectPileUp && pileUp[i]) {
+				continue;
+			}
+			Double_t calE = (energy[i] - calib.offset) / calib.slope;
+			h->Fill(calE, amp[i] / calE);
+		}
+	}
 }
 
 PeakSet PeakFinder::getPeakSet() {
@@ -3,29 +3,43 @@
 
 #include <TCanvas.h>
 #include <TChain.h>
+#include <TFile.h>
 #include <TH1.h>
+#include <TH2.h>
 #include <TGraphErrors.h>
 
 #include "CalStructs.h"
 #include "PeakSet.h"
+#include "ORColumnarFile.hh"
 
 class PeakFinder { 
 private:
 	TCanvas *canvas;
 	TChain *data;
+	std::vector<ORColumnarFile*> columnar;
+	std::vector<TH1*> storedEnergy;
+	std::vector<TH2*> storedMap;
+	Double_t storedMax;
+	Int_t channelNum;
+	Double_t maxEnergy;
 	TH1D *rawPlot;
 	std::vector<TGraphErrors*> backPlots;
 	TGraphErrors *calPlot;
 	Double_t time;
 	Int_t numBins;
 	std::string channel;
+	bool rejectPileUp;
 	PeakSet peaks;	
 	PeakInfo pinnedPeak;
 	FitResults calibration;
 	bool isNumber(std::string input);
+	void overlapBins(TAxis *axis, Double_t low, Double_t high,
+	                 std::vector<std::pair<Double_t, Double_t> > &pieces);
 	
 public:
-	PeakFinder(Double_t pinnedEnergy, TChain *c, std::string channel, TApplication *app);
+	PeakFinder(Double_t pinnedEnergy, TChain *c, std::string channel, TApplication *app,
+	           std::vector<ORColumnarFile*> columnar = std::vector<ORColumnarFile*>(),
+	           std::vector<TFile*> histFiles = std::vector<TFile*>(), bool rejectPileUp = false);
 	void addPeakToSet(PeakInfo info);
 	PeakInfo findPeak(Double_t energy);
 	FitResults backEst(ParWindow win, Double_t range, std::string fitFunc);
@@ -34,6 +48,9 @@ public:
 	Measurement calibrate(Measurement uncalibrated);
 	std::vector<TGraphErrors*> getBackgroundPlots();
 	FitResults getCalibration();
+	Double_t getMaxEnergy();
+	void fillEnergy(TH1 *h, FitResults *calib = NULL);
+	void fillAE(TH2 *h, FitResults calib);
 	TGraphErrors *getCalPlot();
 	Double_t getOverflowPos();
 	PeakSet getPeakSet();
@@ -0,0 +1,237 @@
+/*
+Benchmark of the waveform codec (see ORWaveformCodec.hh) against storing
+the traces as raw UShort_t arrays, the two ways getSpectrum could write
+the "waveform" branch.  It needs neither ROOT nor ORCA:
+
+  make codecbench
+  ./codecBench                                10000 traces of 2048 samples
+  ./codecBench --samples 1024 --noise 4 --repeat 9
+
+The traces are synthetic (a baseline with --noise ADC counts of uniform
+noise either side, and one pulse each, fixed seed).  Four layouts are
+compared, each also as ROOT would store it: concatenated into baskets of
+--basket bytes and compressed with zlib (--level, ROOT's default is 1).
+
+  raw          2 bytes per sample
+  raw+zlib     raw baskets, compressed
+  codec        OREncodeWaveform per trace
+  codec+zlib   codec baskets, compressed
+
+For each it prints bytes per trace, the encode time and the decode
+throughput (inflate where there is zlib, then ORDecodeWaveform or a copy
+into a UShort_t array), as the best of --repeat passes.  Every layout is
+decoded back and compared with the original traces; the exit code is 1
+if any differs.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <sys/time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ORWaveformCodec.hh"
+
+using namespace std;
+
+static const char Usage[] =
+"Usage: codecBench [--samples N] [--traces N] [--noise N] [--basket bytes] [--level L] [--repeat N]\n";
+
+static double Now()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1e-6 * t.tv_usec;
+}
+
+static void MakeTraces(vector<uint16_t>& samples, size_t nSamples, size_t nTraces, int noise)
+{
+  samples.resize(nSamples * nTraces);
+  srand(1);
+  for (size_t t = 0; t < nTraces; t++) {
+    uint16_t* trace = &(samples[t * nSamples]);
+    int baseline = 8000 + rand() % 200;
+    size_t rise = nSamples / 4 + rand() % (nSamples / 4 + 1);
+    double height = 500 + rand() % 20000;
+    for (size_t i = 0; i < nSamples; i++) {
+      double value = baseline + (noise > 0 ? rand() % (2 * noise + 1) - noise : 0);
+      if (i >= rise) value += height * exp(-(double) (i - rise) / (nSamples / 2));
+      trace[i] = (value > 0xFFFF) ? 0xFFFF : (uint16_t) value;
+    }
+  }
+}
+
+// One trace's bytes, as the branch would hold them.
+struct ORBenchTrace {
+  size_t basket;
+  size_t offset;
+  size_t nBytes;
+};
+
+// A layout: traces laid out in baskets, each basket maybe compressed.
+struct ORBenchLayout {
+  string name;
+  bool codec;
+  bool zip;
+  vector<vector<uint8_t> > baskets;   // as stored
+  vector<uLongf> basketRawBytes;
+  vector<ORBenchTrace> traces;
+  double encodeTime;
+  double decodeTime;
+  size_t storedBytes;
+};
+
+static void Encode(ORBenchLayout& layout, const vector<uint16_t>& samples, size_t nSamples,
+                   size_t nTraces, size_t basketBytes, int level)
+{
+  layout.baskets.clear();
+  layout.basketRawBytes.clear();
+  layout.traces.clear();
+  vector<uint8_t> basket;
+  vector<uint8_t> encoded;
+  for (size_t t = 0; t <= nTraces; t++) {
+    bool flush = (t == nTraces) || (!basket.empty() && basket.size() >= basketBytes);
+    if (flush && !basket.empty()) {
+      layout.basketRawBytes.push_back(basket.size());
+      if (layout.zip) {
+        uLongf size = compressBound(basket.size());
+        vector<uint8_t> zipped(size);
+        compress2(&(zipped[0]), &size, &(basket[0]), basket.size(), level);
+        zipped.resize(size);
+        layout.baskets.push_back(zipped);
+      } else layout.baskets.push_back(basket);
+      basket.clear();
+    }
+    if (t == nTraces) break;
+    const uint16_t* trace = &(samples[t * nSamples]);
+    ORBenchTrace where;
+    where.basket = layout.baskets.size();
+    where.offset = basket.size();
+    if (layout.codec) {
+      OREncodeWaveform(trace, nSamples, encoded);
+      basket.insert(basket.end(), encoded.begin(), encoded.end());
+    } else {
+      const uint8_t* bytes = (const uint8_t*) trace;
+      basket.insert(basket.end(), bytes, bytes + 2 * nSamples);
+    }
+    where.nBytes = basket.size() - where.offset;
+    layout.traces.push_back(where);
+  }
+  layout.storedBytes = 0;
+  for (size_t b = 0; b < layout.baskets.size(); b++) layout.storedBytes += layout.baskets[b].size();
+}
+
+// Decodes every trace into out; false if a basket or trace is damaged.
+static bool Decode(const ORBenchLayout& layout, size_t nSamples, vector<uint16_t>& out)
+{
+  out.resize(nSamples * layout.traces.size());
+  vector<uint8_t> inflated;
+  size_t t = 0;
+  for (size_t b = 0; b < layout.baskets.size(); b++) {
+    const uint8_t* basket = &(layout.baskets[b][0]);
+    if (layout.zip) {
+      inflated.resize(layout.basketRawBytes[b]);
+      uLongf size = inflated.size();
+      if (uncompress(&(inflated[0]), &size, basket, layout.baskets[b].size()) != Z_OK) return false;
+      basket = &(inflated[0]);
+    }
+    for (; t < layout.traces.size() && layout.traces[t].basket == b; t++) {
+      const ORBenchTrace& where = layout.traces[t];
+      uint16_t* trace = &(out[t * nSamples]);
+      if (layout.codec) {
+        if (ORDecodeWaveform(basket + where.offset, where.nBytes, trace, nSamples) != nSamples) return false;
+      } else memcpy(trace, basket + where.offset, where.nBytes);
+    }
+  }
+  return t == layout.traces.size();
+}
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"samples", required_argument, 0, 's'},
+    {"traces", required_argument, 0, 't'},
+    {"noise", required_argument, 0, 'n'},
+    {"basket", required_argument, 0, 'b'},
+    {"level", required_argument, 0, 'l'},
+    {"repeat", required_argument, 0, 'r'},
+    {0, 0, 0, 0}
+  };
+  size_t nSamples = 2048;
+  size_t nTraces = 10000;
+  int noise = 8;
+  size_t basketBytes = 32000;
+  int level = 1;
+  size_t nRepeat = 5;
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('s'): nSamples = abs(atoi(optarg)); break;
+      case('t'): nTraces = abs(atoi(optarg)); break;
+      case('n'): noise = abs(atoi(optarg)); break;
+      case('b'): basketBytes = abs(atoi(optarg)); break;
+      case('l'): level = atoi(optarg); break;
+      case('r'): nRepeat = abs(atoi(optarg)); break;
+      default:
+        cerr << Usage;
+        return 1;
+    }
+  }
+  // The codec stores the length in 16 bits.
+  if (nSamples == 0 || nSamples > 0xFFFF || nTraces == 0 || nRepeat == 0 || level < 1 || level > 9) {
+    cerr << Usage;
+    return 1;
+  }
+
+  vector<uint16_t> samples;
+  MakeTraces(samples, nSamples, nTraces, noise);
+
+  vector<ORBenchLayout> layouts(4);
+  const char* names[4] = { "raw", "raw+zlib", "codec", "codec+zlib" };
+  for (size_t i = 0; i < layouts.size(); i++) {
+    layouts[i].name = names[i];
+    layouts[i].codec = (i >= 2);
+    layouts[i].zip = (i % 2 == 1);
+  }
+
+  cout << nTraces << " traces of " << nSamples << " samples, noise +-" << noise << ", "
+       << basketBytes << "-byte baskets, zlib level " << level << ", best of " << nRepeat << endl;
+  int exitCode = 0;
+  vector<uint16_t> decoded;
+  for (size_t i = 0; i < layouts.size(); i++) {
+    ORBenchLayout& layout = layouts[i];
+    for (size_t r = 0; r < nRepeat; r++) {
+      double tStart = Now();
+      Encode(layout, samples, nSamples, nTraces, basketBytes, level);
+      double elapsed = Now() - tStart;
+      if (r == 0 || elapsed < layout.encodeTime) layout.encodeTime = elapsed;
+    }
+    bool same = true;
+    for (size_t r = 0; r < nRepeat; r++) {
+      double tStart = Now();
+      same = Decode(layout, nSamples, decoded) && same;
+      double elapsed = Now() - tStart;
+      if (r == 0 || elapsed < layout.decodeTime) layout.decodeTime = elapsed;
+    }
+    same = same && decoded == samples;
+    if (!same) exitCode = 1;
+
+    double perTrace = (double) layout.storedBytes / nTraces;
+    cout << "  " << setw(11) << left << layout.name << right << fixed << setprecision(1)
+         << setw(8) << perTrace << " bytes/trace (" << setprecision(2) << setw(5)
+         << perTrace / (2. * nSamples) << " of raw, " << setw(5) << 8 * perTrace / nSamples
+         << " bits/sample)  encode " << setprecision(1) << setw(7) << 1e9 * layout.encodeTime / nTraces
+         << " ns/trace  decode " << setw(7) << 1e9 * layout.decodeTime / nTraces << " ns/trace = "
+         << setprecision(2) << setw(6) << 60 * nTraces / layout.decodeTime / 1e6 << " M traces/min"
+         << (same ? "" : "  MISMATCH") << endl;
+  }
+  return exitCode;
+}
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string>
@@ -6,23 +7,46 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
 #include <set>
+#include <vector>
+#include <thread>
 
 #include "ORDataProcManager.hh"
 #include "ORFileReader.hh"
 #include "ORFileWriter.hh"
+#include "ORAtomicFileWriter.hh"
+#include "ORCheckpoint.hh"
+#include "ORManifest.hh"
 #include "ORLogger.hh"
 #include "ORSocketReader.hh"
+#include "ORMMapFileReader.hh"
+#include "ORGzipFileReader.hh"
+#include "ORBlockArchive.hh"
+#include "ORBlockArchiveReader.hh"
+#include "ORFollowFileReader.hh"
+#include "ORLiveSpectra.hh"
+#include "ORTimedReader.hh"
+#include "ORStreamServer.hh"
 
 #include "OROrcaRequestProcessor.hh"
 #include "ORServer.hh"
 #include "ORHandlerThread.hh"
 
-#include "ORVTreeWriter.hh"
-#include "ORSIS3302Decoder.hh"
+#include "ORSIS3302TreeWriter.hh"
+#include "ORWorkerPool.hh"
+
+#include "TROOT.h"
 
 using namespace std;
 
+/* Set by the Makefile from git describe. */
+#ifndef OR_CONVERTER_VERSION
+#define OR_CONVERTER_VERSION "unknown"
+#endif
+
 static const char Usage[] =
 "\n"
 "\n"
@@ -32,6 +56,12 @@ static const char Usage[] =
 "a host and port of a socket from which to read data. For a file, you may either\n"
 "enter a series of files to be processed, or use a wildcard like \"file*.dat\"\n"
 "For a socket, the argument should be formatted as host:port.\n"
+"Archived runs (RunNNNN.tar.gz, .tgz, .gz or .tar) are decompressed on the\n"
+"fly on a separate thread; nothing is unpacked to disk.  Block archives\n"
+"written by rawArchive (RunNNNN.orz) are inflated on --threads workers\n"
+"(at least two).\n"
+"Output is written to NaI_ET.part_run[N].root and only renamed to\n"
+"NaI_ET_run[N].root once the run is complete.\n"
 "\n"
 "Available options:\n"
 "  --help : print this message and exit\n"
@@ -44,6 +74,116 @@ static const char Usage[] =
 "    A [num] value of 0 sets this to infinity (i.e. no timeout).\n"
 "  --daemon [port] : Runs as a server accepting connections on [port]. \n"
 "  --connections [num] : Maximum [num] connections accepted by server. \n"
+"  --event-loop : with --daemon, serve every connection from this one\n"
+"    process instead of forking: one epoll loop reads all sockets, each\n"
+"    stream is converted (NaI_ET_run[N].root) on its own thread, and\n"
+"    --threads sets a decode pool shared by all streams.\n"
+"  --follow : convert a run while ORCA is still writing it. The (single)\n"
+"    input file is read as it grows, and the conversion ends on the\n"
+"    run-end record. Checkpoints default to every 10 s, so the tree is\n"
+"    on disk as the run goes and only the tail is left at the end.\n"
+"  --follow-timeout [sec] : with --follow, give up if the file doesn't\n"
+"    appear or stops growing for [sec] seconds without a run-end record\n"
+"    (default 60).\n"
+"  --records [first,last] : with .orz inputs, convert only records first\n"
+"    to last (record 0 is the run header), rounded out to whole archive\n"
+"    blocks. Ranges that meet (0,99999 then 100000,199999) split a run\n"
+"    into parts that neither overlap nor miss a hit. Every part also gets\n"
+"    the run header, run start and run end records, so each is converted\n"
+"    as a complete run, to NaI_ET_rec[first]-[last]_run[N].root.\n"
+"  --mmap : read input files through a memory map instead of ORFileReader.\n"
+"    Records are handed to the processors in place, without copying.\n"
+"  --threads [num] : decode SIS3302 records on [num] worker threads.\n"
+"    Entries are still written in the order they were read. More threads\n"
+"    than cores are cut back to one per core.\n"
+"  --fill-thread : fill and compress the tree on a separate thread, fed\n"
+"    blocks of decoded events (at most two waiting), so decoding doesn't\n"
+"    wait on basket compression and disk writes. Ignored on one core.\n"
+"  --columnar : also write energy, amp, time and channel as flat arrays\n"
+"    to NaI_ET_run[N].cols, which Calibration reads in place of the tree.\n"
+"  --histograms : fill per-channel energy spectra (65536 bins) and\n"
+"    amplitude-vs-energy maps during conversion and store them in the\n"
+"    output file, for Calibration's \"hist\" option.\n"
+"  --waveforms : keep every trace, losslessly packed (ORWaveformCodec.hh),\n"
+"    in a \"waveform\" branch for pulse-shape studies.\n"
+"  --trapezoid [rise,flat,decay] : re-shape each trace with a trapezoidal\n"
+"    filter (all in samples, 10 ns each at 100 MHz; decay 0 skips pole-zero\n"
+"    correction) and store its maximum as trapE_[rise]_[flat]_[decay].\n"
+"    Repeat for up to 8 settings, all evaluated in the same pass.\n"
+"  --baseline-samples [num] : leading samples averaged for the baseline\n"
+"    of --trapezoid and --pulse-shape (default 64, at most a quarter of\n"
+"    the trace).\n"
+"  --pulse-shape : store baseline mean/RMS, 10-90% rise time, tail/total\n"
+"    integral ratio and time of maximum (in samples) for every trace.\n"
+"  --tail-start [num] : samples after the maximum where the tail integral\n"
+"    of --pulse-shape starts (default 20).\n"
+"  --pile-up [threshold] : flag traces with a second pulse: count rises of\n"
+"    more than [threshold] ADC counts over --pile-up-lag samples, and store\n"
+"    the flag (pileUp), the number of rises (nEdges) and where the second\n"
+"    one starts (pileUpTime, in samples). Flagged hits get their own\n"
+"    histograms (hEnergyPileUp_ch[N]) so Calibration can leave them out.\n"
+"  --pile-up-lag [num] : samples the rise of --pile-up is taken over\n"
+"    (default 10).\n"
+"  --demux [list] : write the hits of these channels to their own output,\n"
+"    NaI_ET_ch[list]_run[N].root (e.g. \"--demux 4\" gives NaI_ET_ch4,\n"
+"    \"--demux 5,6\" NaI_ET_ch5_6). Repeat for one output per channel or\n"
+"    channel group, all written in the same pass over the raw data;\n"
+"    channels in no group are skipped. Replaces --channels, and turns\n"
+"    checkpoints off.\n"
+"  --coincidence [window] : also build events across channels: hits are\n"
+"    merged into time order and grouped, each event taking every hit up to\n"
+"    [window] (in units of the time branch, 10 ns at 100 MHz) after its\n"
+"    first one. Written as the \"events\" tree, with multiplicity, a mask\n"
+"    of the channels hit and per-hit channel, energy, amplitude and dt.\n"
+"  --temperature [dir] : add the \"temperature\" of every hit, interpolated\n"
+"    at t0 + time from [dir]/run[N]_temperature_data.txt (the 1 Hz log of\n"
+"    characterization_run.py) in one pass alongside the hits.\n"
+"  --gain-table [file] : with --temperature, also store \"energyCorr\", the\n"
+"    energy corrected to a reference temperature. [file] has one line\n"
+"    \"channel coefficient reference\" per channel: the gain goes as\n"
+"    1 + coefficient * (T - reference). Other channels are not corrected.\n"
+"  --live [name] : keep per-channel energy and amplitude spectra while\n"
+"    converting and publish them in the shared-memory segment [name] (e.g.\n"
+"    /orcaroot_live), for liveSpectra or any other reader to map while data\n"
+"    comes in. Meant for --daemon --event-loop, socket and --follow input;\n"
+"    counts add up over every stream and run until the process ends.\n"
+"  --live-interval [sec] : publish the live spectra at most every [sec]\n"
+"    seconds (default 0.25).\n"
+"  --slim : write energy (Int_t), amplitude (UShort_t), time (ULong64_t\n"
+"    timestamp) and channel (one byte) in their natural sizes instead of\n"
+"    as doubles, with t0 and peakingTime stored once per run (TParameters\n"
+"    and tree aliases) instead of in every entry, in larger baskets and\n"
+"    compressed with ZSTD level 5. Leaf names stay the same. treeReport\n"
+"    compares the sizes and read times of two outputs.\n"
+"  --compression [algorithm,level] : compress the output with zlib, lzma,\n"
+"    lz4 or zstd (ROOT 6.20 and later) at level 1-9 (default 5).\n"
+"  --channels [list] : only convert hits on these SIS3302 channels, e.g.\n"
+"    \"--channels 4\" or \"--channels 4,5\". Other channels are skipped\n"
+"    before decoding and only counted (rejectedHits_ch[N] in the output).\n"
+"  --metrics : time the read, process, decode, fill and flush stages and\n"
+"    print a summary with record/byte rates and peak memory at the end.\n"
+"  --metrics-interval [sec] : as --metrics, and also print the counters as\n"
+"    one JSON line every [sec] seconds while converting.\n"
+"  --checkpoint-interval [sec] : for a single input file, save the tree\n"
+"    and record progress in NaI_ET_[file].ckpt every [sec] seconds\n"
+"    (default 60, or 10 with --follow; 0 turns checkpoints off).\n"
+"  --resume : continue an interrupted conversion from its last checkpoint\n"
+"    instead of starting over. Without a usable checkpoint (none, or one\n"
+"    written with different output options) the file is converted from\n"
+"    the start.\n"
+"  --manifest [file] : after each converted file, record raw size, mtime\n"
+"    and hash, converter version and options, and output size and hash in\n"
+"    [file] (default NaI_ET.manifest).\n"
+"  --skip-up-to-date : leave out input files the manifest says were\n"
+"    converted from the same data, by this version, with the same options,\n"
+"    into an output that is still there. \"UPTODATE [file]\" is printed\n"
+"    for each.\n"
+"  --jobs [num] : with several input files, convert [num] at a time\n"
+"    (default 1). Each input file is always converted in its own process,\n"
+"    so each gets its own manifest entry. --threads is then split between\n"
+"    the running jobs. One line \"RUNSTATUS [exit code] [file]\" is printed\n"
+"    per file input, even a single one, and the exit code is nonzero if any\n"
+"    file failed or left an output unwritten.\n"
 "\n"
 "Example usage:\n"
 "orcaroot run194ecpu\n"
@@ -63,74 +203,6 @@ static const char Usage[] =
 "\n";
 
 
-class ORSIS3302TreeWriter : public ORVTreeWriter
-{
-  public:
-    ORSIS3302TreeWriter(std::string treeName = "") : ORVTreeWriter(new ORSIS3302Decoder, treeName)
-    {
-      f3302Decoder = dynamic_cast<ORSIS3302Decoder*>(fDataDecoder);
-      fEnergy = 0;
-      fAmplitude = 0;
-      fTime = 0;
-      fStart = 0;
-      fPeakingTime = 0;
-      SetDoNotAutoFillTree();
-    }
-
-    virtual ~ORSIS3302TreeWriter() { delete f3302Decoder; }
-
-    virtual EReturnCode ProcessMyDataRecord(UInt_t* record) {
-      f3302Decoder->SetDataRecord(record);
-      fEnergy = f3302Decoder->GetEnergyMax();
-      fTime = f3302Decoder->GetTimeStamp();
-      fStart = fRunContext->GetStartTime();
-      fChannel = f3302Decoder->GetChannelNum();
-      if(fPeakingTime == 0) {
-        fPeakingTime = f3302Decoder->GetPeakingTime(f3302Decoder->CrateOf(record),
-                                                    f3302Decoder->CardOf(record),
-                                                    fChannel);
-      }
-
-      size_t nSamples = f3302Decoder->GetWaveformLen();
-      vector<double> waveform(nSamples);
-      f3302Decoder->CopyWaveformDataDouble(&(waveform[0]), nSamples);
-      double min = 1e99;
-      double max = -1e99;
-      for (int i = 0; i < nSamples; i++) {
-        if (waveform[i] < min) {
-          min = waveform[i];
-        }
-        if (waveform[i] > max) {
-          max = waveform[i];
-        }
-      }
-      fAmplitude = max - min;
-
-      fTree->Fill();
-      return kSuccess;
-    }
-
-    virtual inline void Clear() { fEnergy = 0; fTime = 0; fStart = 0; fAmplitude = 0; }
-
-  protected:
-    virtual EReturnCode InitializeBranches() {
-      fTree->Branch("energy", &fEnergy, "energy/D");
-      fTree->Branch("amplitude", &fAmplitude, "amp/D");
-      fTree->Branch("time", &fTime, "time/D");
-      fTree->Branch("t0", &fStart, "t0/D");
-      fTree->Branch("ChannelNumber", &fChannel, "channel/s");
-      fTree->Branch("peakingTime", &fPeakingTime, "peaktime/s");
-      return kSuccess;
-    }
-
-  protected:
-    ORSIS3302Decoder* f3302Decoder;
-    double fEnergy, fTime, fStart, fAmplitude;
-    UShort_t fChannel;
-    UInt_t fPeakingTime;
-};
-
-
 int main(int argc, char** argv)
 {
   if(argc == 1) {
@@ -146,11 +218,45 @@ int main(int argc, char** argv)
     //{"keepalive", optional_argument, 0, 'k'},
     //{"maxreconnect", required_argument, 0, 'm'},
     {"daemon", required_argument, 0, 'd'},
-    {"connections", required_argument, 0, 'c'}
+    {"connections", required_argument, 0, 'c'},
+    {"event-loop", no_argument, 0, 'E'},
+    {"mmap", no_argument, 0, 'M'},
+    {"follow", no_argument, 0, 'f'},
+    {"follow-timeout", required_argument, 0, 'o'},
+    {"records", required_argument, 0, 'J'},
+    {"threads", required_argument, 0, 't'},
+    {"columnar", no_argument, 0, 'C'},
+    {"fill-thread", no_argument, 0, 'F'},
+    {"jobs", required_argument, 0, 'j'},
+    {"histograms", no_argument, 0, 'H'},
+    {"waveforms", no_argument, 0, 'w'},
+    {"channels", required_argument, 0, 'n'},
+    {"slim", no_argument, 0, 'D'},
+    {"compression", required_argument, 0, 'O'},
+    {"coincidence", required_argument, 0, 'W'},
+    {"demux", required_argument, 0, 'X'},
+    {"trapezoid", required_argument, 0, 'T'},
+    {"baseline-samples", required_argument, 0, 'B'},
+    {"pulse-shape", no_argument, 0, 'P'},
+    {"tail-start", required_argument, 0, 'L'},
+    {"pile-up", required_argument, 0, 'Q'},
+    {"pile-up-lag", required_argument, 0, 'G'},
+    {"temperature", required_argument, 0, 'Y'},
+    {"gain-table", required_argument, 0, 'Z'},
+    {"live", required_argument, 0, 'V'},
+    {"live-interval", required_argument, 0, 'N'},
+    {"metrics", no_argument, 0, 'S'},
+    {"metrics-interval", required_argument, 0, 'I'},
+    {"checkpoint-interval", required_argument, 0, 'K'},
+    {"resume", no_argument, 0, 'R'},
+    {"manifest", required_argument, 0, 'A'},
+    {"skip-up-to-date", no_argument, 0, 'U'},
+    {0, 0, 0, 0}
   };
 
   string label = "OR";
   ORVReader* reader = NULL;
+  ORFollowFileReader* followReader = NULL;
 
   //bool keepAliveSocket = false;
   bool runAsDaemon = false;
@@ -158,6 +264,42 @@ int main(int argc, char** argv)
   //unsigned int reconnectAttempts = 0; // default reconnect tries for sockets.
   unsigned int portToListenOn = 0;
   unsigned int maxConnections = 5; // default connections accepted by server
+  bool useEventLoop = false;
+  bool useMMap = false;
+  bool follow = false;
+  double followTimeout = 60;
+  bool useGzip = false;
+  bool useArchive = false;
+  uint64_t firstRecord = 0;
+  uint64_t lastRecord = UINT64_MAX;
+  unsigned int nThreads = 1;
+  bool writeColumnar = false;
+  bool fillThread = false;
+  unsigned int nJobs = 1;
+  bool fillHistograms = false;
+  bool storeWaveforms = false;
+  set<UShort_t> channels;
+  bool slimSchema = false;
+  int compression = -1; // ZSTD 5 with --slim
+  double coincidenceWindow = 0;
+  vector<set<UShort_t> > demuxGroups;
+  vector<ORTrapezoidShaping> trapezoids;
+  size_t baselineSamples = 64;
+  bool pulseShape = false;
+  size_t tailStart = 20;
+  int pileUpThreshold = 0;
+  size_t pileUpLag = 10;
+  string temperatureDir;
+  string gainTablePath;
+  ORGainTable gainTable;
+  string liveName;
+  double liveInterval = 0.25;
+  bool collectMetrics = false;
+  double metricsInterval = 0;
+  double checkpointInterval = -1; // 60 s, or 10 s with --follow
+  bool resume = false;
+  string manifestPath = "NaI_ET.manifest";
+  bool skipUpToDate = false;
 
   while(1) {
     char optId = getopt_long(argc, argv, "", longOptions, NULL);
@@ -203,6 +345,167 @@ int main(int argc, char** argv)
       case('c'):
         maxConnections = abs(atoi(optarg));
         break;
+      case('E'):
+        useEventLoop = true;
+        break;
+      case('M'):
+        useMMap = true;
+        break;
+      case('f'):
+        follow = true;
+        break;
+      case('o'):
+        followTimeout = atof(optarg);
+        break;
+      case('J'): {
+        unsigned long long first, last;
+        if (sscanf(optarg, "%llu,%llu", &first, &last) != 2 || first > last) {
+          ORLog(kError) << "--records wants first,last with first <= last, not " << optarg << endl;
+          return 1;
+        }
+        firstRecord = first;
+        lastRecord = last;
+        break;
+      }
+      case('t'):
+        nThreads = abs(atoi(optarg));
+        break;
+      case('C'):
+        writeColumnar = true;
+        break;
+      case('F'):
+        fillThread = true;
+        break;
+      case('j'):
+        nJobs = abs(atoi(optarg));
+        if (nJobs == 0) nJobs = 1;
+        break;
+      case('H'):
+        fillHistograms = true;
+        break;
+      case('w'):
+        storeWaveforms = true;
+        break;
+      case('n'): {
+        istringstream channelList(optarg);
+        string channel;
+        while (getline(channelList, channel, ',')) {
+          if (channel != "") channels.insert(atoi(channel.c_str()));
+        }
+        break;
+      }
+      case('D'):
+        slimSchema = true;
+        break;
+      case('O'): {
+        string algorithm = optarg;
+        int level = 5;
+        size_t comma = algorithm.find(',');
+        if (comma != string::npos) {
+          level = atoi(algorithm.substr(comma + 1).c_str());
+          algorithm = algorithm.substr(0, comma);
+        }
+        /* ROOT's encoding, as ROOT::CompressionSettings gives it. */
+        int code = (algorithm == "zlib") ? 1 : (algorithm == "lzma") ? 2 :
+                   (algorithm == "lz4") ? 4 : (algorithm == "zstd") ? 5 : 0;
+        if (code == 0 || level < 1 || level > 9) {
+          ORLog(kError) << "--compression wants zlib, lzma, lz4 or zstd and a level of 1 to 9, not "
+                        << optarg << endl;
+          return 1;
+        }
+        compression = 100 * code + level;
+        break;
+      }
+      case('X'): {
+        istringstream channelList(optarg);
+        string channel;
+        set<UShort_t> group;
+        while (getline(channelList, channel, ',')) {
+          if (channel != "") group.insert(atoi(channel.c_str()));
+        }
+        if (group.empty()) {
+          ORLog(kError) << "--demux wants a list of channels, not " << optarg << endl;
+          return 1;
+        }
+        demuxGroups.push_back(group);
+        break;
+      }
+      case('W'):
+        coincidenceWindow = atof(optarg);
+        if (coincidenceWindow <= 0) {
+          ORLog(kError) << "--coincidence wants a window > 0, not " << optarg << endl;
+          return 1;
+        }
+        break;
+      case('T'): {
+        ORTrapezoidShaping shaping;
+        if (sscanf(optarg, "%u,%u,%lf", &shaping.rise, &shaping.flat, &shaping.decay) != 3 ||
+            shaping.rise == 0) {
+          ORLog(kError) << "--trapezoid wants rise,flat,decay (rise > 0), not " << optarg << endl;
+          return 1;
+        }
+        trapezoids.push_back(shaping);
+        break;
+      }
+      case('B'):
+        baselineSamples = abs(atoi(optarg));
+        break;
+      case('P'):
+        pulseShape = true;
+        break;
+      case('L'):
+        tailStart = abs(atoi(optarg));
+        break;
+      case('Q'):
+        pileUpThreshold = atoi(optarg);
+        if (pileUpThreshold <= 0 || pileUpThreshold > 32767) {
+          ORLog(kError) << "--pile-up wants a threshold of 1 to 32767, not " << optarg << endl;
+          return 1;
+        }
+        break;
+      case('G'):
+        pileUpLag = abs(atoi(optarg));
+        if (pileUpLag == 0) pileUpLag = 1;
+        break;
+      case('Y'):
+        temperatureDir = optarg;
+        break;
+      case('V'):
+        liveName = optarg;
+        break;
+      case('N'):
+        liveInterval = atof(optarg);
+        if (liveInterval <= 0) {
+          ORLog(kError) << "--live-interval wants a time > 0, not " << optarg << endl;
+          return 1;
+        }
+        break;
+      case('Z'):
+        gainTablePath = optarg;
+        if (!gainTable.Read(gainTablePath)) {
+          ORLog(kError) << "Couldn't read the gain table " << gainTablePath << endl;
+          return 1;
+        }
+        break;
+      case('S'):
+        collectMetrics = true;
+        break;
+      case('I'):
+        collectMetrics = true;
+        metricsInterval = atof(optarg);
+        break;
+      case('K'):
+        checkpointInterval = atof(optarg);
+        break;
+      case('R'):
+        resume = true;
+        break;
+      case('A'):
+        manifestPath = optarg;
+        break;
+      case('U'):
+        skipUpToDate = true;
+        break;
       default: // unrecognized option
         ORLog(kError) << Usage;
         return 1;
@@ -215,8 +518,213 @@ int main(int argc, char** argv)
     return 1;
   }
 
+  vector<string> inputs;
+  for (int i=optind; i<argc; i++) inputs.push_back(argv[i]);
+
+  if (!demuxGroups.empty() && !channels.empty()) {
+    ORLog(kError) << "--demux and --channels don't mix; put the channels in --demux groups" << endl;
+    return 1;
+  }
+  if (gainTablePath != "" && temperatureDir == "") {
+    ORLog(kError) << "--gain-table needs --temperature" << endl;
+    return 1;
+  }
+  /* Workers beyond the cores only add hand-off overhead (10-20% on one
+     core), they don't overlap anything. */
+  unsigned int nCores = thread::hardware_concurrency();
+  if (nCores > 0 && nThreads > nCores) {
+    ORLog(kWarning) << "--threads " << nThreads << " is more than the " << nCores
+                    << " core(s) here; using " << nCores << endl;
+    nThreads = nCores;
+  }
+  /* Likewise the fill thread: on one core it can't overlap decoding. */
+  if (fillThread && nCores == 1) {
+    ORLog(kWarning) << "--fill-thread needs a second core; filling inline" << endl;
+    fillThread = false;
+  }
+  if (liveName != "" && nJobs > 1) {
+    ORLog(kError) << "--live doesn't mix with --jobs; the processes would share one segment" << endl;
+    return 1;
+  }
+  /* Label and channels of each output: NaI_ET, or one per --demux group. */
+  vector<pair<string, set<UShort_t> > > outputs;
+  if (demuxGroups.empty()) outputs.push_back(make_pair(string("NaI_ET"), channels));
+  for (size_t i = 0; i < demuxGroups.size(); i++) {
+    ostringstream outputLabel;
+    outputLabel << "NaI_ET_ch";
+    for (set<UShort_t>::iterator it = demuxGroups[i].begin(); it != demuxGroups[i].end(); it++) {
+      outputLabel << (it == demuxGroups[i].begin() ? "" : "_") << *it;
+    }
+    outputs.push_back(make_pair(outputLabel.str(), demuxGroups[i]));
+  }
+  /* Parts of a run converted with --records get files of their own. */
+  if (firstRecord > 0 || lastRecord != UINT64_MAX) {
+    ostringstream rangeLabel;
+    rangeLabel << "_rec" << firstRecord << "-" << lastRecord;
+    for (size_t i = 0; i < outputs.size(); i++) outputs[i].first += rangeLabel.str();
+  }
+
+  /* Everything that changes what goes into the output.  Checkpoints and
+     manifest entries made with other settings don't count. */
+  ostringstream outputOptions;
+  outputOptions << "columnar=" << writeColumnar << " histograms=" << fillHistograms
+                << " waveforms=" << storeWaveforms << " pulseShape=" << pulseShape
+                << " tailStart=" << tailStart << " baseline=" << baselineSamples << " channels=";
+  for (set<UShort_t>::iterator it = channels.begin(); it != channels.end(); it++) {
+    outputOptions << *it << ",";
+  }
+  for (size_t i = 0; i < trapezoids.size(); i++) {
+    outputOptions << " trapezoid=" << trapezoids[i].rise << "," << trapezoids[i].flat
+                  << "," << trapezoids[i].decay;
+  }
+
+  if (coincidenceWindow > 0) outputOptions << " coincidence=" << coincidenceWindow;
+  if (pileUpThreshold > 0) outputOptions << " pileUp=" << pileUpThreshold << "," << pileUpLag;
+  if (temperatureDir != "") outputOptions << " temperature=" << temperatureDir;
+  if (gainTablePath != "") outputOptions << " gainTable=" << gainTablePath;
+  if (slimSchema && compression < 0) compression = 505;
+  if (slimSchema) outputOptions << " slim=1";
+  if (compression >= 0) outputOptions << " compression=" << compression;
+  if (firstRecord > 0 || lastRecord != UINT64_MAX) {
+    outputOptions << " records=" << firstRecord << "," << lastRecord;
+  }
+  if (!demuxGroups.empty()) {
+    outputOptions << " demux=";
+    for (size_t i = 0; i < outputs.size(); i++) outputOptions << outputs[i].first << ",";
+  }
+
+  if (skipUpToDate && !runAsDaemon && !follow) {
+    /* Only stat() calls for unchanged files, so this is cheap enough to
+       run over every raw file of a crystal each time. */
+    ORManifest manifest(manifestPath);
+    manifest.Read();
+    vector<string> outOfDate;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (inputs[i].find(":") == string::npos &&
+          manifest.IsUpToDate(inputs[i], OR_CONVERTER_VERSION, outputOptions.str())) {
+        cout << "UPTODATE " << inputs[i] << endl;
+      } else {
+        outOfDate.push_back(inputs[i]);
+      }
+    }
+    if (outOfDate.empty()) {
+      ORLog(kRoutine) << "All " << inputs.size() << " files are up to date" << endl;
+      return 0;
+    }
+    inputs = outOfDate;
+  }
+
+  /***************************************************************************/
+  /*   Several input files: one child process per file, --jobs at a time.   */
+  /***************************************************************************/
+  bool isChild = false;
+  if (!runAsDaemon && !follow && inputs.size() > 1 &&
+      inputs[0].find(":") == string::npos) {
+    /* Same scheme as the daemon: fork, and the child falls through to the
+       normal single-input code below.  The parent only keeps track of pids. */
+    map<pid_t, size_t> running;
+    vector<int> exitCodes(inputs.size(), -1);
+    size_t iNext = 0;
+    while (iNext < inputs.size() || !running.empty()) {
+      if (iNext < inputs.size() && running.size() < nJobs) {
+        pid_t childpid = fork();
+        if (childpid == 0) {
+          isChild = true;
+          inputs = vector<string>(1, inputs[iNext]);
+          break;
+        }
+        if (childpid < 0) {
+          ORLog(kError) << "Couldn't fork for " << inputs[iNext] << endl;
+        } else {
+          ORLog(kRoutine) << "Converting " << inputs[iNext] << " in process " << childpid << endl;
+          running[childpid] = iNext;
+        }
+        iNext++;
+        continue;
+      }
+      int status = 0;
+      pid_t childpid = wait(&status);
+      if (childpid < 0) break;
+      if (running.count(childpid) == 0) {
+        ORLog(kError) << "Ended child process " << childpid << " not recognized!" << endl;
+        continue;
+      }
+      size_t iInput = running[childpid];
+      running.erase(childpid);
+      if (WIFEXITED(status)) exitCodes[iInput] = WEXITSTATUS(status);
+      else if (WIFSIGNALED(status)) exitCodes[iInput] = 128 + WTERMSIG(status);
+    }
+    if (!isChild) {
+      int nFailed = 0;
+      for (size_t i = 0; i < inputs.size(); i++) {
+        cout << "RUNSTATUS " << exitCodes[i] << " " << inputs[i] << endl;
+        if (exitCodes[i] != 0) nFailed++;
+      }
+      ORLog(kRoutine) << inputs.size() - nFailed << " of " << inputs.size()
+                      << " files converted" << endl;
+      return (nFailed == 0) ? 0 : 1;
+    }
+    nThreads = (nThreads > nJobs) ? nThreads / nJobs : 1;
+  }
+
   ORHandlerThread* handlerThread = new ORHandlerThread();
   handlerThread->StartThread();
+  /* Live spectra, filled by every tree writer below. */
+  ORLiveSpectra* live = NULL;
+  if (liveName != "") {
+    live = new ORLiveSpectra(liveName, liveInterval);
+    if (!live->IsValid()) {
+      ORLog(kError) << "Couldn't create the shared-memory segment " << live->GetName() << endl;
+      return 1;
+    }
+    ORLog(kRoutine) << "Publishing live spectra in " << live->GetName() << endl;
+  }
+  /***************************************************************************/
+  /*   Daemon with one event loop for all connections.                       */
+  /***************************************************************************/
+  if (runAsDaemon && useEventLoop) {
+    /* Each stream gets its own manager and processors on its own thread,
+       and they all write ROOT files concurrently. */
+    ROOT::EnableThreadSafety();
+    if (!demuxGroups.empty()) ORLog(kWarning) << "--demux is ignored with --event-loop" << endl;
+    ORWorkerPool* pool = (nThreads > 1) ? new ORWorkerPool(nThreads) : NULL;
+    ORStreamServer server(portToListenOn, maxConnections,
+      [&](ORVReader* streamReader, size_t) -> int {
+        ORDataProcManager streamManager(streamReader);
+        ORAtomicFileWriter streamFileWriter("NaI_ET");
+        ORSIS3302TreeWriter streamTreeWriter("st");
+        streamTreeWriter.SetWorkerPool(pool);
+        streamTreeWriter.SetBackgroundFill(fillThread);
+        if (writeColumnar) streamTreeWriter.SetColumnarOutput("NaI_ET");
+        streamTreeWriter.SetFillHistograms(fillHistograms);
+        streamTreeWriter.SetStoreWaveforms(storeWaveforms);
+        streamTreeWriter.SetChannels(channels);
+        streamTreeWriter.SetCoincidenceWindow(coincidenceWindow);
+        streamTreeWriter.SetTrapezoids(trapezoids);
+        streamTreeWriter.SetBaselineSamples(baselineSamples);
+        streamTreeWriter.SetPulseShape(pulseShape);
+        streamTreeWriter.SetTailStart(tailStart);
+        streamTreeWriter.SetPileUp(pileUpThreshold);
+        streamTreeWriter.SetPileUpLag(pileUpLag);
+        streamTreeWriter.SetTemperatureLogs(temperatureDir);
+        streamTreeWriter.SetGainTable(gainTable);
+        streamTreeWriter.SetLiveSpectra(live);
+        streamTreeWriter.SetSlimSchema(slimSchema);
+        streamTreeWriter.SetCompression(compression);
+        streamManager.AddProcessor(&streamFileWriter);
+        streamManager.AddProcessor(&streamTreeWriter);
+        return (streamManager.ProcessDataStream() == ORDataProcessor::kFailure) ? 1 : 0;
+      });
+    if (!server.IsValid()) {
+      ORLog(kError) << "Error listening on port " << portToListenOn << endl;
+      return 1;
+    }
+    server.Run();
+    delete pool;
+    delete live;
+    delete handlerThread;
+    return (server.GetNFailed() == 0) ? 0 : 1;
+  }
   /***************************************************************************/
   /*   Running orcaroot as a daemon server. */
   /***************************************************************************/
@@ -225,6 +733,7 @@ int main(int argc, char** argv)
     /* We are doing this very simply with a simple fork. Eventually want
        to check number of spawned processes, etc.  */
     ORLog(kRoutine) << "Running orcaroot as daemon on port: " << portToListenOn << endl;
+    if (live != NULL) ORLog(kWarning) << "--live needs --event-loop as a daemon; nothing will be published" << endl;
     pid_t childpid = 0;
     std::set<pid_t> childPIDRecord;
 
@@ -293,12 +802,54 @@ int main(int argc, char** argv)
   /***************************************************************************/
   } else {
     /* Normal running, either connecting to a server or reading in a file. */
-    string readerArg = argv[optind];
+    string readerArg = inputs[0];
     size_t iColon = readerArg.find(":");
-    if (iColon == string::npos) {
+    for (size_t i=0; i<inputs.size(); i++) {
+      if (ORGzipFileReader::IsCompressed(inputs[i])) useGzip = true;
+      if (ORBlockArchive::IsArchive(inputs[i])) useArchive = true;
+    }
+    if (useArchive) {
+      for (size_t i=0; i<inputs.size(); i++) {
+        if (!ORBlockArchive::IsArchive(inputs[i])) {
+          ORLog(kError) << ".orz inputs don't mix with other kinds: " << inputs[i] << endl;
+          return 1;
+        }
+      }
+    } else if (firstRecord > 0 || lastRecord != UINT64_MAX) {
+      ORLog(kError) << "--records needs .orz inputs (see rawArchive)" << endl;
+      return 1;
+    }
+    if (follow) {
+      if (inputs.size() != 1 || iColon != string::npos || useGzip || useArchive) {
+        ORLog(kError) << "--follow takes a single, uncompressed raw file" << endl;
+        return 1;
+      }
+      if (useMMap) ORLog(kWarning) << "--mmap ignored with --follow" << endl;
+      useMMap = false;
+      reader = followReader = new ORFollowFileReader(inputs[0], followTimeout);
+    } else if (useArchive) {
+      if (useMMap) ORLog(kWarning) << "--mmap ignored for compressed inputs" << endl;
+      useMMap = false;
+      ORBlockArchiveReader* archiveReader = new ORBlockArchiveReader((nThreads > 1) ? nThreads : 2);
+      archiveReader->SetRecordRange(firstRecord, lastRecord);
+      for (size_t i=0; i<inputs.size(); i++) archiveReader->AddFileToProcess(inputs[i]);
+      reader = archiveReader;
+    } else if (iColon == string::npos && useGzip) {
+      if (useMMap) ORLog(kWarning) << "--mmap ignored for compressed inputs" << endl;
+      useMMap = false;
+      reader = new ORGzipFileReader;
+      for (size_t i=0; i<inputs.size(); i++) {
+        ((ORGzipFileReader*) reader)->AddFileToProcess(inputs[i]);
+      }
+    } else if (iColon == string::npos && useMMap) {
+      reader = new ORMMapFileReader;
+      for (size_t i=0; i<inputs.size(); i++) {
+        ((ORMMapFileReader*) reader)->AddFileToProcess(inputs[i]);
+      }
+    } else if (iColon == string::npos) {
       reader = new ORFileReader;
-      for (int i=optind; i<argc; i++) {
-        ((ORFileReader*) reader)->AddFileToProcess(argv[i]);
+      for (size_t i=0; i<inputs.size(); i++) {
+        ((ORFileReader*) reader)->AddFileToProcess(inputs[i]);
       }
     } else {
       reader = new ORSocketReader(readerArg.substr(0, iColon).c_str(),
@@ -323,12 +874,78 @@ int main(int argc, char** argv)
     return 1;
   }
 
+  /* Checkpoints need a single file to come back to, and a single output. */
+  if (checkpointInterval < 0) checkpointInterval = follow ? 10 : 60;
+  string checkpointPath;
+  if (!runAsDaemon && checkpointInterval > 0 && inputs.size() == 1 &&
+      inputs[0].find(":") == string::npos && outputs.size() == 1) {
+    checkpointPath = outputs[0].first + "_" + inputs[0].substr(inputs[0].find_last_of('/') + 1) + ".ckpt";
+  }
+
+  ORStageMetrics* metrics = NULL;
+  ORTimedReader* timedReader = NULL;
+  if (collectMetrics && !runAsDaemon) metrics = new ORStageMetrics;
+  if (metrics || checkpointPath != "") timedReader = new ORTimedReader(reader, metrics);
+
   ORLog(kRoutine) << "Setting up data processing manager..." << endl;
-  ORDataProcManager dataProcManager(reader);
+  ORDataProcManager dataProcManager(timedReader ? timedReader : reader);
 
-  /* Declare processors here. */
-  ORFileWriter fileWriter("NaI_ET");
-  ORSIS3302TreeWriter sisTreeWriter("st");
+  /* Declare processors here.  A file and tree writer per output; with
+     --demux every tree writer sees every record and keeps its own channels
+     (from the record header, before decoding), sharing one decode pool. */
+  vector<ORAtomicFileWriter*> fileWriters;
+  vector<ORSIS3302TreeWriter*> treeWriters;
+  ORWorkerPool* sharedPool = (outputs.size() > 1 && nThreads > 1) ? new ORWorkerPool(nThreads) : NULL;
+  if (fillThread) ROOT::EnableThreadSafety();
+  for (size_t i = 0; i < outputs.size(); i++) {
+    ORSIS3302TreeWriter* treeWriter = new ORSIS3302TreeWriter("st");
+    if (sharedPool) treeWriter->SetWorkerPool(sharedPool);
+    else treeWriter->SetNThreads(nThreads);
+    if (fillThread) treeWriter->SetBackgroundFill();
+    if (writeColumnar) treeWriter->SetColumnarOutput(outputs[i].first);
+    treeWriter->SetFillHistograms(fillHistograms);
+    treeWriter->SetStoreWaveforms(storeWaveforms);
+    treeWriter->SetChannels(outputs[i].second);
+    treeWriter->SetCoincidenceWindow(coincidenceWindow);
+    treeWriter->SetTrapezoids(trapezoids);
+    treeWriter->SetBaselineSamples(baselineSamples);
+    treeWriter->SetPulseShape(pulseShape);
+    treeWriter->SetTailStart(tailStart);
+    treeWriter->SetPileUp(pileUpThreshold);
+    treeWriter->SetPileUpLag(pileUpLag);
+    treeWriter->SetTemperatureLogs(temperatureDir);
+    treeWriter->SetGainTable(gainTable);
+    treeWriter->SetLiveSpectra(live);
+    treeWriter->SetSlimSchema(slimSchema);
+    treeWriter->SetCompression(compression);
+    treeWriter->SetMetrics(metrics);
+    fileWriters.push_back(new ORAtomicFileWriter(outputs[i].first));
+    treeWriters.push_back(treeWriter);
+  }
+
+  if (checkpointPath != "") {
+    treeWriters[0]->SetCheckpoint(checkpointPath, checkpointInterval, timedReader,
+                                  outputOptions.str());
+
+    ORCheckpoint checkpoint;
+    if (resume && checkpoint.Read(checkpointPath) && checkpoint.options == outputOptions.str()) {
+      /* Move the partial file out of the way before ORFileWriter recreates
+         it.  A .resume file that is still around belongs to a resume that
+         never got to its own first checkpoint, so it is still the file
+         this checkpoint describes. */
+      string resumeFile = checkpoint.partialFile + ".resume";
+      if (access(resumeFile.c_str(), F_OK) == 0 ||
+          rename(checkpoint.partialFile.c_str(), resumeFile.c_str()) == 0) {
+        treeWriters[0]->SetResume(resumeFile, checkpoint);
+      } else {
+        ORLog(kWarning) << checkpoint.partialFile << " from " << checkpointPath
+                        << " is gone; converting from the start" << endl;
+      }
+    } else if (resume) {
+      ORLog(kRoutine) << "No usable checkpoint in " << checkpointPath
+                      << "; converting from the start" << endl;
+    }
+  }
 
   OROrcaRequestProcessor orcaReq;
   if (runAsDaemon) {
@@ -336,17 +953,100 @@ int main(int argc, char** argv)
     dataProcManager.SetRunAsDaemon();
     dataProcManager.AddProcessor(&orcaReq);
   } else {
-    /* Add the processors here to run them in normal mode. */
-    dataProcManager.AddProcessor(&fileWriter);
-    dataProcManager.AddProcessor(&sisTreeWriter);
+    /* Add the processors here to run them in normal mode.  Each tree
+       writer right after the file writer its tree goes into. */
+    for (size_t i = 0; i < outputs.size(); i++) {
+      dataProcManager.AddProcessor(fileWriters[i]);
+      dataProcManager.AddProcessor(treeWriters[i]);
+    }
+  }
+  ORFollowRunEnd followRunEnd(followReader);
+  if (followReader) {
+    /* Lets the reader end the stream once the run-end record is through. */
+    dataProcManager.AddProcessor(&followRunEnd);
   }
 
   ORLog(kRoutine) << "Start processing..." << endl;
-  dataProcManager.ProcessDataStream();
+  struct timeval tStart, tStop;
+  gettimeofday(&tStart, NULL);
+  if (metrics && metricsInterval > 0) {
+    metrics->StartReporting(metricsInterval, stdout, inputs.size() == 1 ? inputs[0] : "");
+  }
+  ORDataProcessor::EReturnCode result = dataProcManager.ProcessDataStream();
+  gettimeofday(&tStop, NULL);
+  if (metrics) {
+    metrics->StopReporting();
+    metrics->PrintSummary(stdout);
+    if (metricsInterval > 0) cout << metrics->JSON(inputs.size() == 1 ? inputs[0] : "") << endl;
+  }
   ORLog(kRoutine) << "Finished processing..." << endl;
 
+  double elapsed = (tStop.tv_sec - tStart.tv_sec) + 1e-6 * (tStop.tv_usec - tStart.tv_usec);
+  if (!runAsDaemon && elapsed > 0) {
+    size_t nRecords = 0;
+    for (size_t i = 0; i < treeWriters.size(); i++) nRecords += treeWriters[i]->GetNRecords();
+    ORLog(kRoutine) << nRecords << " SIS3302 records in "
+                    << elapsed << " s (" << nRecords / elapsed
+                    << " records/s, " << nThreads << " thread(s))" << endl;
+    off_t inputBytes = 0;
+    struct stat st;
+    for (size_t i=0; i<inputs.size(); i++) {
+      if (stat(inputs[i].c_str(), &st) == 0) inputBytes += st.st_size;
+    }
+    if (inputBytes > 0 && useGzip) {
+      size_t rawBytes = ((ORGzipFileReader*) reader)->GetBytesRead();
+      ORLog(kRoutine) << "gzip reader: " << inputBytes << " compressed bytes, "
+                      << rawBytes << " raw bytes, " << rawBytes / elapsed / 1.e6
+                      << " MB/s raw" << endl;
+    } else if (inputBytes > 0 && useArchive) {
+      ORBlockArchiveReader* archiveReader = (ORBlockArchiveReader*) reader;
+      size_t rawBytes = archiveReader->GetBytesRead();
+      ORLog(kRoutine) << "archive reader: " << archiveReader->GetCompressedBytes()
+                      << " of " << inputBytes << " compressed bytes, " << rawBytes
+                      << " raw bytes, " << rawBytes / elapsed / 1.e6 << " MB/s raw" << endl;
+    } else if (inputBytes > 0) {
+      ORLog(kRoutine) << (useMMap ? "mmap" : "file") << " reader: " << inputBytes
+                      << " bytes, " << inputBytes / elapsed / 1.e6 << " MB/s" << endl;
+    }
+  }
+
+  /* A run that failed, or any output that never got its final name, fails
+     the conversion. */
+  int exitCode = (result == ORDataProcessor::kFailure) ? 1 : 0;
+  if (!runAsDaemon) {
+    for (size_t i = 0; i < fileWriters.size(); i++) {
+      if (fileWriters[i]->GetLastFileName() == "") {
+        ORLog(kError) << "No complete output for " << outputs[i].first << endl;
+        exitCode = 1;
+      }
+    }
+  }
+
+  /* One entry per raw file.  Several files are each converted in a process
+     of their own (above), so a file input here is the only one. */
+  bool fileInput = !runAsDaemon && inputs.size() == 1 && inputs[0].find(":") == string::npos;
+  if (fileInput && exitCode == 0) {
+    // Every --demux group's file, so a missing one isn't taken as up to date.
+    vector<string> written;
+    for (size_t i = 0; i < fileWriters.size(); i++) written.push_back(fileWriters[i]->GetLastFileName());
+    ORManifest manifest(manifestPath);
+    if (!manifest.Record(inputs[0], written, OR_CONVERTER_VERSION, outputOptions.str())) {
+      ORLog(kWarning) << "Couldn't record " << inputs[0] << " in " << manifestPath << endl;
+    }
+  }
+
+  for (size_t i = 0; i < outputs.size(); i++) {
+    delete treeWriters[i];
+    delete fileWriters[i];
+  }
+  delete sharedPool;
+  delete live;
+  delete timedReader;
+  delete metrics;
   delete reader;
   delete handlerThread;
 
-  return 0;
+  /* The parent of --jobs prints these for its children. */
+  if (fileInput && !isChild) cout << "RUNSTATUS " << exitCode << " " << inputs[0] << endl;
+  return exitCode;
 }
@@ -0,0 +1,202 @@
+/*
+Microbenchmark of the waveform kernels behind the SIS3302 amplitude (see
+ORWaveformKernels.hh), against the per-record vector<double> loop they
+replaced.  It needs neither ROOT nor ORCA:
+
+  make kernelbench
+  ./kernelBench                               10000 traces of 2048 samples
+  ./kernelBench --samples 1024 --traces 50000 --repeat 9
+
+The traces are synthetic (a noisy baseline and one pulse each, fixed
+seed).  Every variant runs over the same traces, its result is checked
+against the scalar loop, and its time is the best of --repeat passes.
+"double" copies each trace into a new vector<double> and scans it, as the
+tree writer used to; "scalar" is the plain 16-bit loop, as the compiler
+builds it with these flags.  AVX2 rows are left out on CPUs without it.
+The exit code is 1 if any variant disagrees.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ORWaveformKernels.hh"
+
+using namespace std;
+
+static const char Usage[] =
+"Usage: kernelBench [--samples N] [--traces N] [--repeat N]\n";
+
+static double Now()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1e-6 * t.tv_usec;
+}
+
+static void MakeTraces(vector<uint16_t>& samples, size_t nSamples, size_t nTraces)
+{
+  samples.resize(nSamples * nTraces);
+  srand(1);
+  for (size_t t = 0; t < nTraces; t++) {
+    uint16_t* trace = &(samples[t * nSamples]);
+    int baseline = 8000 + rand() % 200;
+    size_t rise = nSamples / 4 + rand() % (nSamples / 4 + 1);
+    double height = 500 + rand() % 20000;
+    for (size_t i = 0; i < nSamples; i++) {
+      double value = baseline + rand() % 16 - 8;
+      if (i >= rise) value += height * exp(-(double) (i - rise) / (nSamples / 2));
+      trace[i] = (value > 0xFFFF) ? 0xFFFF : (uint16_t) value;
+    }
+  }
+}
+
+// The loop ORSIS3302TreeWriter ran before the kernels.
+static uint64_t RunDouble(const vector<uint16_t>& samples, size_t nSamples, size_t nTraces)
+{
+  uint64_t total = 0;
+  for (size_t t = 0; t < nTraces; t++) {
+    vector<double> waveform(nSamples);
+    for (size_t i = 0; i < nSamples; i++) waveform[i] = samples[t * nSamples + i];
+    double min = 1e99;
+    double max = -1e99;
+    for (size_t i = 0; i < nSamples; i++) {
+      if (waveform[i] < min) min = waveform[i];
+      if (waveform[i] > max) max = waveform[i];
+    }
+    total += (uint64_t) (max - min);
+  }
+  return total;
+}
+
+static uint64_t RunMinMax(ORWaveformMinMaxFn kernel, const vector<uint16_t>& samples,
+                          size_t nSamples, size_t nTraces)
+{
+  uint64_t total = 0;
+  for (size_t t = 0; t < nTraces; t++) {
+    uint16_t min, max;
+    kernel(&(samples[t * nSamples]), nSamples, min, max);
+    total += max - min;
+  }
+  return total;
+}
+
+static uint64_t RunMinMaxSum(ORWaveformMinMaxSumFn kernel, const vector<uint16_t>& samples,
+                             size_t nSamples, size_t nTraces)
+{
+  uint64_t total = 0;
+  for (size_t t = 0; t < nTraces; t++) {
+    uint16_t min, max;
+    uint64_t sum;
+    kernel(&(samples[t * nSamples]), nSamples, min, max, sum);
+    total += (max - min) + sum;
+  }
+  return total;
+}
+
+struct ORBenchVariant {
+  string name;
+  ORWaveformMinMaxFn minMax;         // both NULL: the double loop
+  ORWaveformMinMaxSumFn minMaxSum;
+};
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"samples", required_argument, 0, 's'},
+    {"traces", required_argument, 0, 't'},
+    {"repeat", required_argument, 0, 'r'},
+    {0, 0, 0, 0}
+  };
+  size_t nSamples = 2048;
+  size_t nTraces = 10000;
+  size_t nRepeat = 5;
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('s'): nSamples = abs(atoi(optarg)); break;
+      case('t'): nTraces = abs(atoi(optarg)); break;
+      case('r'): nRepeat = abs(atoi(optarg)); break;
+      default:
+        cerr << Usage;
+        return 1;
+    }
+  }
+  if (nSamples == 0 || nTraces == 0 || nRepeat == 0) {
+    cerr << Usage;
+    return 1;
+  }
+
+  vector<uint16_t> samples;
+  MakeTraces(samples, nSamples, nTraces);
+
+  vector<ORBenchVariant> variants;
+  ORBenchVariant variant;
+  variant.minMax = NULL;
+  variant.minMaxSum = NULL;
+  variant.name = "minmax double";
+  variants.push_back(variant);
+  variant.name = "minmax scalar";
+  variant.minMax = ORWaveformMinMaxScalar;
+  variants.push_back(variant);
+#ifdef OR_WAVEFORM_X86
+  variant.name = "minmax sse2";
+  variant.minMax = ORWaveformMinMaxSSE2;
+  variants.push_back(variant);
+  if (__builtin_cpu_supports("avx2")) {
+    variant.name = "minmax avx2";
+    variant.minMax = ORWaveformMinMaxAVX2;
+    variants.push_back(variant);
+  }
+#endif
+  variant.minMax = NULL;
+  variant.name = "minmaxsum scalar";
+  variant.minMaxSum = ORWaveformMinMaxSumScalar;
+  variants.push_back(variant);
+#ifdef OR_WAVEFORM_X86
+  variant.name = "minmaxsum sse2";
+  variant.minMaxSum = ORWaveformMinMaxSumSSE2;
+  variants.push_back(variant);
+  if (__builtin_cpu_supports("avx2")) {
+    variant.name = "minmaxsum avx2";
+    variant.minMaxSum = ORWaveformMinMaxSumAVX2;
+    variants.push_back(variant);
+  }
+#endif
+
+  cout << nTraces << " traces of " << nSamples << " samples, best of " << nRepeat << endl;
+  int exitCode = 0;
+  double doubleTime = 0;
+  uint64_t expectMinMax = RunMinMax(ORWaveformMinMaxScalar, samples, nSamples, nTraces);
+  uint64_t expectMinMaxSum = RunMinMaxSum(ORWaveformMinMaxSumScalar, samples, nSamples, nTraces);
+  for (size_t v = 0; v < variants.size(); v++) {
+    const ORBenchVariant& bench = variants[v];
+    double best = 0;
+    uint64_t result = 0;
+    for (size_t r = 0; r < nRepeat; r++) {
+      double tStart = Now();
+      if (bench.minMax != NULL) result = RunMinMax(bench.minMax, samples, nSamples, nTraces);
+      else if (bench.minMaxSum != NULL) result = RunMinMaxSum(bench.minMaxSum, samples, nSamples, nTraces);
+      else result = RunDouble(samples, nSamples, nTraces);
+      double elapsed = Now() - tStart;
+      if (r == 0 || elapsed < best) best = elapsed;
+    }
+    if (bench.minMax == NULL && bench.minMaxSum == NULL) doubleTime = best;
+    bool agrees = (result == (bench.minMaxSum != NULL ? expectMinMaxSum : expectMinMax));
+    if (!agrees) exitCode = 1;
+    cout << "  " << setw(18) << left << bench.name << right << fixed << setprecision(1)
+         << setw(9) << 1e9 * best / nTraces << " ns/trace " << setw(8)
+         << nSamples * nTraces / best / 1e6 << " Msamples/s";
+    if (best > 0 && doubleTime > 0) cout << setw(7) << setprecision(2) << doubleTime / best << "x";
+    cout << (agrees ? "" : "  WRONG RESULT") << endl;
+  }
+  return exitCode;
+}
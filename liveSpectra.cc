@@ -0,0 +1,148 @@
+/*
+Reads the live spectra getSpectrum --live publishes in shared memory (see
+ORLiveSpectra.hh) without slowing the conversion down.
+
+  make livespectra
+  ./liveSpectra /orcaroot_live                    one summary per channel
+  ./liveSpectra --watch 2 /orcaroot_live          again every 2 s, with rates
+  ./liveSpectra --root quick.root /orcaroot_live  also write the spectra
+
+--root writes hLiveEnergy_ch<N> and hLiveAmp_ch<N> (TH1D), replacing the
+file as a whole on every snapshot, for a quick look in ROOT while the run
+is still going.  The exit code is 1 if the segment can't be read.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "TFile.h"
+#include "TH1.h"
+
+#include "ORLiveSpectra.hh"
+
+using namespace std;
+
+static const char Usage[] =
+"Usage: liveSpectra [--watch sec] [--root file] segment\n";
+
+static bool WriteSpectra(const ORLiveSegment& segment, const string& path)
+{
+  string tmpPath = path + ".tmp";
+  TFile file(tmpPath.c_str(), "RECREATE");
+  if (file.IsZombie()) return false;
+  for (size_t i = 0; i < segment.header.nChannels; i++) {
+    const ORLiveChannel& channel = segment.channels[i];
+    ostringstream number;
+    number << channel.channel;
+    string suffix = "_ch" + number.str();
+    TH1D hEnergy(("hLiveEnergy" + suffix).c_str(), ("Live energy, channel " + number.str()).c_str(),
+                 kORLiveEnergyBins, 0, kORLiveEnergyBins * channel.energyBinWidth);
+    for (size_t j = 0; j <= kORLiveEnergyBins; j++) {
+      if (channel.energy[j] != 0) hEnergy.SetBinContent(j, channel.energy[j]);
+    }
+    hEnergy.SetEntries(channel.nEntries);
+    TH1D hAmp(("hLiveAmp" + suffix).c_str(), ("Live amplitude, channel " + number.str()).c_str(),
+              kORLiveAmpBins, 0, kORLiveAmpBins * kORLiveAmpBinWidth);
+    for (size_t j = 0; j < kORLiveAmpBins; j++) {
+      if (channel.amplitude[j] != 0) hAmp.SetBinContent(j + 1, channel.amplitude[j]);
+    }
+    hAmp.SetEntries(channel.nEntries);
+    file.WriteTObject(&hEnergy);
+    file.WriteTObject(&hAmp);
+  }
+  file.Close();
+  return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+static void PrintSummary(const ORLiveSegment& segment, const string& name,
+                         const map<uint32_t, uint64_t>& previous, double elapsed)
+{
+  const ORLiveHeader& header = segment.header;
+  double age = 1e-9 * (ORLiveNow() - header.publishTime);
+  cout << name << ": " << header.nHits << " hits in " << header.nSnapshots << " snapshots, last "
+       << age << " s ago" << endl;
+  for (size_t i = 0; i < header.nChannels; i++) {
+    const ORLiveChannel& channel = segment.channels[i];
+    size_t top = kORLiveEnergyBins;
+    while (top > 0 && channel.energy[top] == 0) top--;
+    cout << "  channel " << channel.channel << ": " << channel.nEntries << " hits";
+    map<uint32_t, uint64_t>::const_iterator it = previous.find(channel.channel);
+    if (elapsed >= 0) {
+      uint64_t before = (it == previous.end()) ? 0 : it->second;
+      cout << " (" << ((elapsed > 0) ? (channel.nEntries - before) / elapsed : 0) << " /s)";
+    }
+    cout << ", energy up to " << top * channel.energyBinWidth << endl;
+  }
+  if (header.nDropped > 0) {
+    cout << "  " << header.nDropped << " hits on channels past the first "
+         << kORLiveMaxChannels << " not kept" << endl;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"watch", required_argument, 0, 'w'},
+    {"root", required_argument, 0, 'r'},
+    {0, 0, 0, 0}
+  };
+  double watch = 0;
+  string rootFile;
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('w'): watch = atof(optarg); break;
+      case('r'): rootFile = optarg; break;
+      default:
+        cerr << Usage;
+        return 1;
+    }
+  }
+  if (optind + 1 != argc) {
+    cerr << Usage;
+    return 1;
+  }
+  string name = argv[optind];
+
+  ORLiveSpectraReader reader;
+  if (!reader.Open(name)) {
+    cerr << "No live spectra in " << ORLiveSegmentName(name) << endl;
+    return 1;
+  }
+  // About 2 MB; too much for the stack.
+  ORLiveSegment* segment = new ORLiveSegment;
+  map<uint32_t, uint64_t> previous;
+  int64_t previousTime = 0;
+  int exitCode = 0;
+  while (true) {
+    if (!reader.Snapshot(*segment)) {
+      cerr << "Couldn't get a consistent snapshot of " << name << endl;
+      exitCode = 1;
+      break;
+    }
+    // No rates on the first snapshot.
+    double elapsed = (previousTime > 0) ? 1e-9 * (segment->header.publishTime - previousTime) : -1;
+    PrintSummary(*segment, name, previous, elapsed);
+    if (rootFile != "" && !WriteSpectra(*segment, rootFile)) {
+      cerr << "Couldn't write " << rootFile << endl;
+      exitCode = 1;
+      break;
+    }
+    if (watch <= 0) break;
+    previousTime = segment->header.publishTime;
+    for (size_t i = 0; i < segment->header.nChannels; i++) {
+      previous[segment->channels[i].channel] = segment->channels[i].nEntries;
+    }
+    usleep((useconds_t) (watch * 1e6));
+  }
+  delete segment;
+  return exitCode;
+}
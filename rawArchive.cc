@@ -0,0 +1,200 @@
+/*
+Archives raw ORCA files as seekable block-compressed <raw>.orz files (see
+ORBlockArchive.hh), compressing on every core, in place of tar czf.
+getSpectrum reads the .orz directly, inflating blocks in parallel.
+
+  make rawarchive
+  ./rawArchive Run1234 [more runs]          write Run1234.orz
+  ./rawArchive --jobs 8 --level 9 Run1234   8 threads, zlib level 9
+  ./rawArchive --remove Run1234             write, check, delete Run1234
+  ./rawArchive --check Run1234.orz          inflate every block, check crcs
+  ./rawArchive --list Run1234.orz           show the blocks
+  ./rawArchive --extract Run1234.orz        write Run1234 back out
+
+--block-size is in MB (default 4).  --remove deletes the raw file only
+after the new archive has been read back and checked.  The exit code is 0
+if every file is fine, 1 if an archive is damaged, 2 if one can't be
+read or written.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ORBlockArchive.hh"
+#include "ORLogger.hh"
+#include "ORWorkerPool.hh"
+
+using namespace std;
+
+static const char Usage[] =
+"Usage: rawArchive [--jobs N] [--level L] [--block-size MB] [--remove] run [run ...]\n"
+"       rawArchive --check | --list | --extract archive [archive ...]\n";
+
+static double Since(const struct timeval& tStart)
+{
+  struct timeval tStop;
+  gettimeofday(&tStop, NULL);
+  return (tStop.tv_sec - tStart.tv_sec) + 1e-6 * (tStop.tv_usec - tStart.tv_usec);
+}
+
+// Inflates every block on the pool; false at the first damaged one.
+static bool CheckArchive(const ORBlockArchive& archive, ORWorkerPool& pool)
+{
+  size_t nBlocks = archive.GetHeader().nBlocks;
+  vector<char> ok(nBlocks, 0);
+  vector<future<void> > done;
+  for (size_t i = 0; i < nBlocks; i++) {
+    done.push_back(pool.Submit([&archive, &ok, i](size_t) {
+      vector<char> raw;
+      ok[i] = archive.ReadBlock(i, raw);
+    }));
+  }
+  bool good = true;
+  for (size_t i = 0; i < nBlocks; i++) {
+    done[i].wait();
+    if (!ok[i]) {
+      cout << archive.GetPath() << ": block " << i << " is damaged" << endl;
+      good = false;
+    }
+  }
+  return good;
+}
+
+static void PrintArchive(const ORBlockArchive& archive)
+{
+  const ORBlockArchiveHeader& header = archive.GetHeader();
+  const vector<ORBlockArchiveEntry>& entries = archive.GetEntries();
+  cout << archive.GetPath() << ": " << header.rawSize << " bytes in " << header.nBlocks
+       << " blocks, " << header.nRecords << " records, zlib level " << header.level << endl;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const ORBlockArchiveEntry& entry = entries[i];
+    cout << "  " << i << ": bytes " << entry.rawOffset << " - " << entry.rawOffset + entry.rawBytes
+         << " -> " << entry.size;
+    if (entry.nRecords > 0) {
+      cout << ", records " << entry.firstRecord << " - " << entry.firstRecord + entry.nRecords - 1;
+    }
+    if (entry.flags & kORBlockRunControl) cout << " (run records)";
+    cout << endl;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"jobs", required_argument, 0, 'j'},
+    {"level", required_argument, 0, 'l'},
+    {"block-size", required_argument, 0, 'b'},
+    {"remove", no_argument, 0, 'r'},
+    {"check", no_argument, 0, 'c'},
+    {"list", no_argument, 0, 't'},
+    {"extract", no_argument, 0, 'x'},
+    {0, 0, 0, 0}
+  };
+  size_t nJobs = thread::hardware_concurrency();
+  int level = 6;
+  double blockMB = 4;
+  bool remove = false;
+  char mode = 'a';
+  ORLogger::SetSeverity(ORLogger::kError);
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('j'): nJobs = abs(atoi(optarg)); break;
+      case('l'): level = atoi(optarg); break;
+      case('b'): blockMB = atof(optarg); break;
+      case('r'): remove = true; break;
+      case('c'): case('t'): case('x'): mode = optId; break;
+      default:
+        cerr << Usage;
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    cerr << Usage;
+    return 1;
+  }
+  if (nJobs == 0) nJobs = 1;
+  if (level < 1 || level > 9) {
+    cerr << "--level must be 1 to 9" << endl;
+    return 1;
+  }
+  // Block sizes are stored in 32 bits.
+  if (blockMB < 0.0625 || blockMB > 1024) {
+    cerr << "--block-size must be 0.0625 to 1024 MB" << endl;
+    return 1;
+  }
+  size_t blockSize = (size_t) (blockMB * (1 << 20));
+  ORWorkerPool pool(nJobs);
+
+  int exitCode = 0;
+  for (int i = optind; i < argc; i++) {
+    string fileName = argv[i];
+    struct timeval tStart;
+    gettimeofday(&tStart, NULL);
+    if (mode == 'a') {
+      string path = ORBlockArchive::ArchivePath(fileName);
+      if (!ORBlockArchive::Write(fileName, path, pool, level, blockSize)) {
+        cout << fileName << ": couldn't be archived" << endl;
+        exitCode = 2;
+        continue;
+      }
+      double elapsed = Since(tStart);
+      ORBlockArchive archive;
+      if (!archive.Open(path)) {
+        cout << path << ": can't be read back" << endl;
+        exitCode = 2;
+        continue;
+      }
+      uint64_t rawSize = archive.GetHeader().rawSize;
+      uint64_t size = archive.GetHeader().indexOffset;
+      cout << path << ": " << rawSize << " -> " << size << " bytes ("
+           << (rawSize > 0 ? 100. * size / rawSize : 0) << "%) in " << elapsed << " s";
+      if (elapsed > 0) cout << " (" << rawSize / elapsed / 1e6 << " MB/s)";
+      cout << " on " << pool.GetNWorkers() << " thread(s)" << endl;
+      if (!remove) continue;
+      if (!CheckArchive(archive, pool)) {
+        cout << fileName << ": kept, the archive didn't check out" << endl;
+        exitCode = 1;
+      } else if (unlink(fileName.c_str()) != 0) {
+        cerr << "Couldn't remove " << fileName << endl;
+        exitCode = 2;
+      }
+      continue;
+    }
+
+    ORBlockArchive archive;
+    if (!archive.Open(fileName)) {
+      cout << fileName << ": not a readable block archive" << endl;
+      exitCode = 2;
+      continue;
+    }
+    if (mode == 't') PrintArchive(archive);
+    else if (mode == 'c') {
+      bool good = CheckArchive(archive, pool);
+      if (good) cout << fileName << ": OK, " << archive.GetHeader().nBlocks << " blocks checked in "
+                     << Since(tStart) << " s" << endl;
+      else if (exitCode == 0) exitCode = 1;
+    } else {
+      string rawFile = ORBlockArchive::IsArchive(fileName) ?
+                       fileName.substr(0, fileName.size() - 4) : fileName + ".raw";
+      if (access(rawFile.c_str(), F_OK) == 0) {
+        cout << rawFile << ": already there, not overwritten" << endl;
+        exitCode = 2;
+      } else if (!archive.Extract(rawFile, pool)) {
+        cout << fileName << ": couldn't be extracted" << endl;
+        exitCode = 2;
+      } else cout << rawFile << ": extracted in " << Since(tStart) << " s" << endl;
+    }
+  }
+  return exitCode;
+}
@@ -0,0 +1,134 @@
+/*
+Checks and indexes raw ORCA files by walking the record headers only (see
+ORRecordIndex.hh), at disk read speed instead of conversion speed.
+
+  make rawindex
+  ./rawIndex Run1234 [more runs]        check, write Run1234.idx, report
+  ./rawIndex --check Run1234            check only, no index file
+  ./rawIndex --record 1000 Run1234      show record 1000 (0 is the header)
+  ./rawIndex --split 8 Run1234          8 byte ranges on record boundaries
+
+An index that is still current (same size and mtime as the raw file) is
+reused instead of walking the file again.  The exit code is 0 if every
+file is intact, 1 if any is truncated or corrupt, 2 if one can't be read.
+*/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ORLogger.hh"
+#include "ORRecordIndex.hh"
+
+using namespace std;
+
+static const char Usage[] =
+"Usage: rawIndex [--check] [--rebuild] [--record N] [--split N] run [run ...]\n";
+
+static void PrintRecord(const string& rawFile, const ORRecordIndex& index, size_t iRecord)
+{
+  const vector<ORRecordIndexEntry>& entries = index.GetEntries();
+  if (iRecord >= entries.size()) {
+    cout << rawFile << ": no record " << iRecord << " (" << entries.size() << " records)" << endl;
+    return;
+  }
+  const ORRecordIndexEntry& entry = entries[iRecord];
+  cout << rawFile << " record " << iRecord << ": byte " << entry.offset << ", data ID 0x"
+       << hex << entry.dataId << dec;
+  if (entry.flags & kORIndexSIS3302) {
+    cout << ", SIS3302 crate " << (int) entry.crate << " card " << (int) entry.card
+         << " channel " << (int) entry.channel << ", timestamp " << entry.timestamp;
+  }
+  if (entry.flags & kORIndexUnknownId) cout << ", undeclared data ID";
+  cout << endl;
+
+  // The first few words, read straight from the offset.
+  uint32_t words[8];
+  int fd = open(rawFile.c_str(), O_RDONLY);
+  ssize_t n = (fd < 0) ? -1 : pread(fd, words, sizeof(words), entry.offset);
+  if (fd >= 0) close(fd);
+  for (ssize_t i = 0; i < n / (ssize_t) sizeof(uint32_t); i++) {
+    cout << (i == 0 ? "  " : " ") << "0x" << hex << setw(8) << setfill('0') << words[i]
+         << dec << setfill(' ');
+  }
+  if (n > 0) cout << endl;
+}
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"check", no_argument, 0, 'c'},
+    {"rebuild", no_argument, 0, 'r'},
+    {"record", required_argument, 0, 'n'},
+    {"split", required_argument, 0, 's'},
+    {0, 0, 0, 0}
+  };
+  bool writeIndex = true;
+  bool rebuild = false;
+  long iRecord = -1;
+  size_t nParts = 0;
+  ORLogger::SetSeverity(ORLogger::kError);
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('c'): writeIndex = false; break;
+      case('r'): rebuild = true; break;
+      case('n'): iRecord = atol(optarg); break;
+      case('s'): nParts = abs(atoi(optarg)); break;
+      default:
+        cerr << Usage;
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    cerr << Usage;
+    return 1;
+  }
+
+  int exitCode = 0;
+  for (int i = optind; i < argc; i++) {
+    string rawFile = argv[i];
+    string indexFile = ORRecordIndex::IndexPath(rawFile);
+    ORRecordIndex index;
+    bool fromIndex = !rebuild && index.Read(indexFile) && index.IsCurrent(rawFile);
+    struct timeval tStart, tStop;
+    gettimeofday(&tStart, NULL);
+    if (!fromIndex) {
+      if (!index.Build(rawFile)) {
+        cout << rawFile << ": can't be read" << endl;
+        exitCode = 2;
+        continue;
+      }
+      if (writeIndex && !index.Write(indexFile)) cerr << "Couldn't write " << indexFile << endl;
+    }
+    gettimeofday(&tStop, NULL);
+
+    if (iRecord >= 0) PrintRecord(rawFile, index, iRecord);
+    else if (nParts == 0) {
+      index.PrintReport(cout, rawFile);
+      double elapsed = (tStop.tv_sec - tStart.tv_sec) + 1e-6 * (tStop.tv_usec - tStart.tv_usec);
+      if (!fromIndex && elapsed > 0) {
+        cout << "  scanned in " << elapsed << " s ("
+             << index.GetHeader().rawSize / elapsed / 1e6 << " MB/s)" << endl;
+      }
+    }
+    if (nParts > 0) {
+      // Record boundaries, so each range can be read on its own after the header.
+      vector<pair<uint64_t, uint64_t> > ranges = index.Split(nParts);
+      for (size_t j = 0; j < ranges.size(); j++) {
+        cout << rawFile << " " << j << " " << ranges[j].first << " " << ranges[j].second << endl;
+      }
+    }
+    if (index.GetStatus() != kORIndexOK && exitCode == 0) exitCode = 1;
+  }
+  return exitCode;
+}
@@ -0,0 +1,186 @@
+/*
+Loopback load test for the event-loop daemon (ORStreamServer).  Starts the
+server on a free local port with the same per-stream conversion as
+getSpectrum --daemon --event-loop, replays recorded raw runs over N sockets
+at once, and reports aggregate throughput.  Output files go to a scratch
+directory that is removed afterwards.
+
+  make loadtest
+  ./streamLoadTest --streams 8 --threads 4 /path/to/Run1234 [more runs]
+
+Stream i replays run i % (number of runs).
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ORDataProcManager.hh"
+#include "ORFileWriter.hh"
+#include "ORLogger.hh"
+#include "ORSIS3302TreeWriter.hh"
+#include "ORStreamServer.hh"
+#include "ORWorkerPool.hh"
+
+#include "TROOT.h"
+
+using namespace std;
+
+static bool SendFile(unsigned int port, const string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  bool ok = sock >= 0 && connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+  vector<char> buffer(1 << 20);
+  ssize_t n;
+  while (ok && (n = read(fd, &(buffer[0]), buffer.size())) > 0) {
+    for (ssize_t sent = 0; ok && sent < n; ) {
+      ssize_t m = send(sock, &(buffer[sent]), n - sent, MSG_NOSIGNAL);
+      if (m <= 0) ok = false;
+      else sent += m;
+    }
+  }
+  if (sock >= 0) close(sock);
+  close(fd);
+  return ok;
+}
+
+static void RemoveDirectory(const string& dir)
+{
+  DIR* d = opendir(dir.c_str());
+  if (d == NULL) return;
+  struct dirent* entry;
+  while ((entry = readdir(d)) != NULL) {
+    string name = entry->d_name;
+    if (name != "." && name != "..") unlink((dir + "/" + name).c_str());
+  }
+  closedir(d);
+  rmdir(dir.c_str());
+}
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"streams", required_argument, 0, 's'},
+    {"threads", required_argument, 0, 't'},
+    {"verbosity", required_argument, 0, 'v'},
+    {0, 0, 0, 0}
+  };
+  size_t nStreams = 4;
+  size_t nThreads = 4;
+  ORLogger::SetSeverity(ORLogger::kWarning);
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('s'): nStreams = abs(atoi(optarg)); break;
+      case('t'): nThreads = abs(atoi(optarg)); break;
+      case('v'):
+        if (strcmp(optarg, "routine") == 0) ORLogger::SetSeverity(ORLogger::kRoutine);
+        else if (strcmp(optarg, "error") == 0) ORLogger::SetSeverity(ORLogger::kError);
+        break;
+      default:
+        cerr << "Usage: streamLoadTest [--streams N] [--threads N] run [run ...]" << endl;
+        return 1;
+    }
+  }
+  vector<string> runs;
+  for (int i = optind; i < argc; i++) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (realpath(argv[i], path) == NULL || stat(path, &st) != 0) {
+      cerr << "Can't read " << argv[i] << endl;
+      return 1;
+    }
+    runs.push_back(path);
+  }
+  if (runs.empty() || nStreams == 0) {
+    cerr << "Usage: streamLoadTest [--streams N] [--threads N] run [run ...]" << endl;
+    return 1;
+  }
+  uint64_t totalBytes = 0;
+  for (size_t i = 0; i < nStreams; i++) {
+    struct stat st;
+    stat(runs[i % runs.size()].c_str(), &st);
+    totalBytes += st.st_size;
+  }
+
+  char scratch[] = "/tmp/streamLoadTest.XXXXXX";
+  if (mkdtemp(scratch) == NULL || chdir(scratch) != 0) {
+    cerr << "Can't make a scratch directory" << endl;
+    return 1;
+  }
+
+  ROOT::EnableThreadSafety();
+  ORWorkerPool* pool = (nThreads > 1) ? new ORWorkerPool(nThreads) : NULL;
+  atomic<size_t> nDone(0);
+  atomic<uint64_t> nRecords(0);
+  ORStreamServer server(0, nStreams, [&](ORVReader* reader, size_t id) -> int {
+    ostringstream label;
+    label << "loadtest_s" << id;
+    ORDataProcManager manager(reader);
+    ORFileWriter fileWriter(label.str());
+    ORSIS3302TreeWriter treeWriter("st");
+    treeWriter.SetWorkerPool(pool);
+    manager.AddProcessor(&fileWriter);
+    manager.AddProcessor(&treeWriter);
+    int status = (manager.ProcessDataStream() == ORDataProcessor::kFailure) ? 1 : 0;
+    nRecords += treeWriter.GetNRecords();
+    nDone++;
+    return status;
+  });
+  if (!server.IsValid()) return 1;
+  thread serverThread(&ORStreamServer::Run, &server);
+
+  struct timeval tStart, tStop;
+  gettimeofday(&tStart, NULL);
+  vector<thread> clients;
+  atomic<size_t> nSendFailed(0);
+  for (size_t i = 0; i < nStreams; i++) {
+    clients.push_back(thread([&, i]() {
+      if (!SendFile(server.GetPort(), runs[i % runs.size()])) nSendFailed++;
+    }));
+  }
+  for (size_t i = 0; i < clients.size(); i++) clients[i].join();
+  while (nDone + nSendFailed < nStreams) usleep(10000);
+  gettimeofday(&tStop, NULL);
+  server.Stop();
+  serverThread.join();
+  delete pool;
+  RemoveDirectory(scratch);
+
+  double elapsed = (tStop.tv_sec - tStart.tv_sec) + 1e-6 * (tStop.tv_usec - tStart.tv_usec);
+  cout << nStreams << " streams, " << nThreads << " decode threads: "
+       << totalBytes / 1e6 << " MB, " << nRecords << " SIS3302 records in "
+       << elapsed << " s" << endl
+       << "  " << totalBytes / 1e6 / elapsed << " MB/s, " << nRecords / elapsed
+       << " records/s aggregate" << endl;
+  if (nSendFailed > 0 || server.GetNFailed() > 0) {
+    cout << "  " << nSendFailed << " streams failed to send, "
+         << server.GetNFailed() << " failed to convert" << endl;
+    return 1;
+  }
+  return 0;
+}
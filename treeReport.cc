@@ -0,0 +1,150 @@
+/*
+Compares the size and read time of getSpectrum outputs, e.g. a run
+converted with the default schema and again with --slim:
+
+  make treereport
+  ./treeReport NaI_ET_run1234.root slim/NaI_ET_run1234.root
+  ./treeReport --cut "channel==5" NaI_ET_run1234.root
+
+For each file it prints the "st" tree's entries, bytes per entry and
+compression setting, then every branch with its type and its bytes before
+and after compression.  The read times are for what Calibration does with
+the tree: the maximum and spectrum of energy, and the amplitude/energy
+map, both through TTree::Draw with the cut (default "channel==4").  Later
+files are also given as a fraction of the first.  The page cache isn't
+dropped, so run it twice, or on fresh copies, for cold reads.  The exit
+code is 1 if a file has no "st" tree.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "TBranch.h"
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TParameter.h"
+#include "TTree.h"
+
+using namespace std;
+
+static const char Usage[] =
+"Usage: treeReport [--cut selection] file.root [file.root ...]\n";
+
+struct ORTreeSummary {
+  double zipBytes;
+  double readTime;
+};
+
+static double Since(const struct timeval& tStart)
+{
+  struct timeval tStop;
+  gettimeofday(&tStop, NULL);
+  return (tStop.tv_sec - tStart.tv_sec) + 1e-6 * (tStop.tv_usec - tStart.tv_usec);
+}
+
+static string MB(double bytes)
+{
+  ostringstream text;
+  text << fixed << setprecision(2) << bytes / 1e6 << " MB";
+  return text.str();
+}
+
+static bool Report(const string& path, const string& cut, ORTreeSummary& summary)
+{
+  TFile* file = TFile::Open(path.c_str(), "READ");
+  TTree* tree = (file == NULL || file->IsZombie()) ? NULL : dynamic_cast<TTree*>(file->Get("st"));
+  if (tree == NULL) {
+    cout << path << ": no \"st\" tree" << endl;
+    delete file;
+    return false;
+  }
+  Long64_t nEntries = tree->GetEntries();
+  summary.zipBytes = tree->GetZipBytes();
+  cout << path << ": " << nEntries << " entries, " << MB(summary.zipBytes) << " compressed ("
+       << (nEntries > 0 ? summary.zipBytes / nEntries : 0) << " bytes/entry), "
+       << MB(tree->GetTotBytes()) << " uncompressed, compression "
+       << file->GetCompressionSettings() << endl;
+  TObjArray* branches = tree->GetListOfBranches();
+  for (Int_t i = 0; i < branches->GetEntriesFast(); i++) {
+    TBranch* branch = (TBranch*) branches->At(i);
+    double zip = branch->GetZipBytes();
+    double tot = branch->GetTotBytes();
+    cout << "  " << setw(16) << left << branch->GetName() << setw(16) << branch->GetTitle() << right
+         << MB(tot) << " -> " << MB(zip);
+    if (zip > 0) cout << " (" << setprecision(3) << tot / zip << "x)" << setprecision(6);
+    cout << endl;
+  }
+  // --slim keeps the run constants out of the entries.
+  TParameter<double>* start = dynamic_cast<TParameter<double>*>(file->Get("t0"));
+  TParameter<int>* peaking = dynamic_cast<TParameter<int>*>(file->Get("peakingTime"));
+  if (start != NULL) cout << "  t0 = " << setprecision(17) << start->GetVal() << setprecision(6);
+  if (peaking != NULL) cout << ", peakingTime = " << peaking->GetVal();
+  if (start != NULL || peaking != NULL) cout << " (once per run)" << endl;
+
+  struct timeval tStart;
+  gettimeofday(&tStart, NULL);
+  double energyMax = tree->GetMaximum("energy");
+  ostringstream spectrum;
+  spectrum << "energy >> hReportEnergy(65536, 0, " << energyMax + 1 << ")";
+  Long64_t nSelected = tree->Draw(spectrum.str().c_str(), cut.c_str(), "goff");
+  double spectrumTime = Since(tStart);
+  gettimeofday(&tStart, NULL);
+  ostringstream ampVsEnergy;
+  ampVsEnergy << "amp / energy : energy >> hReportAmpVsEnergy(1000, 0, " << energyMax + 1 << ", 1000, 0, 1)";
+  tree->Draw(ampVsEnergy.str().c_str(), cut.c_str(), "goff");
+  double mapTime = Since(tStart);
+  summary.readTime = spectrumTime + mapTime;
+  cout << "  " << nSelected << " entries pass " << cut << "; energy spectrum read in "
+       << spectrumTime << " s, amplitude vs energy in " << mapTime << " s" << endl;
+  delete file;
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  static struct option longOptions[] = {
+    {"cut", required_argument, 0, 'c'},
+    {0, 0, 0, 0}
+  };
+  string cut = "channel==4";
+  while (1) {
+    int optId = getopt_long(argc, argv, "", longOptions, NULL);
+    if (optId == -1) break;
+    switch (optId) {
+      case('c'): cut = optarg; break;
+      default:
+        cerr << Usage;
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    cerr << Usage;
+    return 1;
+  }
+
+  int exitCode = 0;
+  vector<ORTreeSummary> summaries;
+  vector<string> paths;
+  for (int i = optind; i < argc; i++) {
+    ORTreeSummary summary;
+    if (!Report(argv[i], cut, summary)) {
+      exitCode = 1;
+      continue;
+    }
+    summaries.push_back(summary);
+    paths.push_back(argv[i]);
+  }
+  for (size_t i = 1; i < summaries.size() && summaries[0].zipBytes > 0 && summaries[0].readTime > 0; i++) {
+    cout << paths[i] << " vs " << paths[0] << ": " << setprecision(3)
+         << 100 * summaries[i].zipBytes / summaries[0].zipBytes << "% of the size, "
+         << 100 * summaries[i].readTime / summaries[0].readTime << "% of the read time" << endl;
+  }
+  return exitCode;
+}